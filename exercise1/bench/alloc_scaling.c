@@ -0,0 +1,90 @@
+/*
+ * Allocator scalability benchmark.
+ *
+ * Every thread repeatedly creates files of its own, grows them block by block
+ * and removes them, so all the shared work is inode and block allocation.
+ * With allocation groups each thread allocates from its own group, and
+ * throughput should grow with the number of threads (up to the number of
+ * CPUs) instead of queueing on a single allocator lock.
+ *
+ *   make bench && ./bench/alloc_scaling
+ */
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_THREADS (8)
+#define FILES_PER_THREAD (8)
+#define BLOCKS_PER_FILE (16)
+#define ROUNDS (200)
+#define BLOCK_SIZE (4096)
+
+void *churner(void *arg) {
+    int thread = *(int *)arg;
+    char path[] = "/t0_f0";
+    path[2] = (char)('0' + thread);
+    char block[BLOCK_SIZE];
+    memset(block, 'b', sizeof(block));
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int file = 0; file < FILES_PER_THREAD; file++) {
+            path[5] = (char)('0' + file);
+            int f = tfs_open(path, TFS_O_CREAT);
+            assert(f != -1);
+            for (size_t b = 0; b < BLOCKS_PER_FILE; b++) {
+                assert(tfs_pwrite(f, block, sizeof(block), b * BLOCK_SIZE) ==
+                       sizeof(block));
+            }
+            assert(tfs_close(f) != -1);
+        }
+        for (int file = 0; file < FILES_PER_THREAD; file++) {
+            path[5] = (char)('0' + file);
+            assert(tfs_unlink(path) != -1);
+        }
+    }
+    return NULL;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_file_blocks = BLOCKS_PER_FILE;
+    params.max_inode_count = MAX_THREADS * FILES_PER_THREAD + 1;
+    params.max_block_count =
+        MAX_THREADS * FILES_PER_THREAD * BLOCKS_PER_FILE + 1;
+    params.max_open_files_count = MAX_THREADS;
+
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        assert(tfs_init(&params) != -1);
+
+        pthread_t tids[MAX_THREADS];
+        int ids[MAX_THREADS];
+        double start = now_ns();
+        for (int t = 0; t < threads; t++) {
+            ids[t] = t;
+            assert(pthread_create(&tids[t], NULL, churner, &ids[t]) == 0);
+        }
+        for (int t = 0; t < threads; t++) {
+            assert(pthread_join(tids[t], NULL) == 0);
+        }
+        double elapsed = now_ns() - start;
+
+        double allocations = (double)threads * ROUNDS * FILES_PER_THREAD *
+                             (1 + BLOCKS_PER_FILE);
+        printf("%d thread(s): %.0f allocations/s\n", threads,
+               allocations / (elapsed / 1e9));
+
+        assert(tfs_destroy() != -1);
+    }
+
+    return 0;
+}
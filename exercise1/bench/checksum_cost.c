@@ -0,0 +1,85 @@
+/*
+ * Checksum cost on the write path.
+ *
+ * Overwrites the blocks of a file, with whole-block and with small writes,
+ * first without checksums and then with them, and prints the throughput of
+ * each. Every write recomputes the CRC32C of the blocks it touches, so
+ * small writes pay for a whole block. The raw speed of the CRC32C
+ * implementation in use (SSE4.2 or the software fallback) is printed too.
+ *
+ *   make bench && ./bench/checksum_cost
+ */
+#include "fs/crc32c.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCK_SIZE (4096)
+#define FILE_BLOCKS (16)
+#define ROUNDS (2000)
+#define SMALL_WRITE (64)
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Returns the throughput in MB/s of writes of write_size bytes
+static double overwrite(bool checksums, size_t write_size) {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_file_blocks = FILE_BLOCKS;
+    params.checksums = checksums;
+    assert(tfs_init(&params) != -1);
+
+    char buffer[BLOCK_SIZE];
+    memset(buffer, 'c', sizeof(buffer));
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    for (size_t b = 0; b < FILE_BLOCKS; b++) {
+        assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    }
+
+    size_t writes = FILE_BLOCKS * BLOCK_SIZE / write_size;
+    double start = now_ns();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t w = 0; w < writes; w++) {
+            assert(tfs_pwrite(f, buffer, write_size, w * write_size) ==
+                   (ssize_t)write_size);
+        }
+    }
+    double elapsed = now_ns() - start;
+
+    assert(tfs_close(f) != -1);
+    assert(tfs_destroy() != -1);
+    return (double)ROUNDS * FILE_BLOCKS * BLOCK_SIZE / (elapsed / 1e3);
+}
+
+int main() {
+    crc32c_init();
+    char block[BLOCK_SIZE];
+    memset(block, 'c', sizeof(block));
+    uint32_t crc = 0;
+    double start = now_ns();
+    for (int i = 0; i < 100000; i++) {
+        crc = crc32c(crc, block, sizeof(block));
+    }
+    double elapsed = now_ns() - start;
+    printf("crc32c (%s): %.0f MB/s (%08x)\n", crc32c_impl_name(),
+           100000.0 * BLOCK_SIZE / (elapsed / 1e3), crc);
+
+    size_t sizes[] = {BLOCK_SIZE, SMALL_WRITE};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        double off = overwrite(false, sizes[i]);
+        double on = overwrite(true, sizes[i]);
+        printf("%zu-byte writes: %.0f MB/s without checksums, %.0f MB/s with "
+               "(%.1f%% slower)\n",
+               sizes[i], off, on, 100.0 * (off - on) / off);
+    }
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * False sharing benchmark.
+ *
+ * Every thread updates the size of its own file and the offset of its own
+ * file handle, as writers to different files do. Nothing is shared between
+ * threads, so time per operation should stay flat as threads are added; when
+ * neighbouring inodes or open file entries share cache lines it grows
+ * instead.
+ *
+ * Compare the two layouts with:
+ *   make clean && make bench
+ *   make clean && make bench LAYOUT=packed
+ */
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_THREADS (8)
+#define ITERATIONS (1000000)
+
+typedef struct {
+    inode_t *inode;
+    open_file_entry_t *file;
+} target_t;
+
+static target_t targets[MAX_THREADS];
+
+void *updater(void *arg) {
+    target_t *target = arg;
+
+    for (size_t i = 1; i <= ITERATIONS; i++) {
+        inode_extend_size(target->inode, i);
+        target->file->of_offset = inode_meta_get(target->inode).size;
+    }
+    return NULL;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main() {
+#ifdef TFS_PACKED_LAYOUT
+    char const *layout = "packed";
+#else
+    char const *layout = "cache-line aligned";
+#endif
+    printf("layout: %s (inode_t: %zu bytes, open_file_entry_t: %zu bytes)\n",
+           layout, sizeof(inode_t), sizeof(open_file_entry_t));
+
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        assert(tfs_init(NULL) != -1);
+
+        // Consecutive files get neighbouring inodes and open file entries
+        char path[] = "/f0";
+        for (int t = 0; t < threads; t++) {
+            path[2] = (char)('0' + t);
+            int f = tfs_open(path, TFS_O_CREAT);
+            assert(f != -1);
+            targets[t].file = get_open_file_entry(f);
+            targets[t].inode = inode_get(targets[t].file->of_inumber);
+        }
+
+        pthread_t tids[MAX_THREADS];
+        double start = now_ns();
+        for (int t = 0; t < threads; t++) {
+            assert(pthread_create(&tids[t], NULL, updater, &targets[t]) == 0);
+        }
+        for (int t = 0; t < threads; t++) {
+            assert(pthread_join(tids[t], NULL) == 0);
+        }
+        double elapsed = now_ns() - start;
+
+        // flat across thread counts when the threads do not interfere
+        printf("%d thread(s): %.1f ns per round (one update per thread)\n",
+               threads, elapsed / ITERATIONS);
+
+        assert(tfs_destroy() != -1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Metadata scan benchmark: total size of every file in a 100k-inode table,
+ * read from the size column.
+ */
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#define INODES (100000)
+#define FILES (1000)
+#define ROUNDS (100)
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = INODES;
+    assert(tfs_init(&params) != -1);
+
+    // Files are created directly (the root directory only holds a few)
+    for (size_t i = 0; i < FILES; i++) {
+        int inumber = inode_create(T_FILE);
+        assert(inumber != -1);
+        inode_extend_size(inode_get(inumber), i);
+    }
+
+    size_t expected = (size_t)FILES * (FILES - 1) / 2;
+    double start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        assert(inode_total_size(T_FILE) == expected);
+    }
+    double elapsed = now_ns() - start;
+    printf("inode_total_size over %d inodes: %.1f us\n", INODES,
+           elapsed / ROUNDS / 1000);
+
+    static int inumbers[FILES];
+    static size_t sizes[FILES];
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        assert(inode_scan(T_FILE, inumbers, sizes, FILES) == FILES);
+    }
+    elapsed = now_ns() - start;
+    printf("inode_scan over %d inodes: %.1f us\n", INODES,
+           elapsed / ROUNDS / 1000);
+
+    assert(tfs_destroy() != -1);
+
+    return 0;
+}
@@ -0,0 +1,615 @@
+#include "alloc.h"
+#include "betterassert.h"
+#include "shm.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Allocation groups.
+ *
+ * A pool's bitmap is split into a fixed number of groups, each with its own
+ * lock, free count and search cursor. Every thread has a home group and
+ * allocates from it, visiting the other groups only when its home group has
+ * nothing left, so concurrent allocators normally hold different locks and
+ * touch different parts of the bitmap.
+ *
+ * Allocations first claim entries from the pool-wide count of available
+ * ones (a single atomic operation, which is also how delayed allocation
+ * reserves blocks), and only then pick which entries to take: once claimed,
+ * entries are known to be free somewhere, so taking them cannot fail.
+ *
+ * On top of that, single entries go through per-thread magazines: a thread
+ * takes MAGAZINE_BATCH entries at a time and keeps the ones it does not need
+ * yet (marked CACHED), and keeps the entries it frees, up to
+ * ALLOC_MAGAZINE_SIZE, so most allocations and frees only touch memory of
+ * the thread's own. Magazines are drained into the pool when their thread
+ * exits, or when an allocation would otherwise fail.
+ */
+
+#define MAGAZINE_BATCH (ALLOC_MAGAZINE_SIZE / 2)
+
+// next home group to hand out, and the calling thread's one
+static atomic_size_t next_home;
+static _Thread_local size_t home;
+static _Thread_local bool home_set;
+
+/**
+ * New size of a table that needs at least 'needed' more entries: double it
+ * (or more, if needed), without going over its limit.
+ */
+size_t alloc_grown_size(size_t size, size_t needed, size_t limit) {
+    size_t grown = size > needed ? 2 * size : size + needed;
+    if (grown < 1) {
+        grown = 1;
+    }
+    return grown < limit ? grown : limit;
+}
+
+/**
+ * Number of groups with entries in use.
+ */
+static size_t active_groups(alloc_pool_t *pool) {
+    size_t count = atomic_load(&pool->count);
+    return (count + pool->group_size - 1) / pool->group_size;
+}
+
+/**
+ * The calling thread's home group (threads are spread over the groups in the
+ * order they first allocate).
+ */
+static size_t home_group(alloc_pool_t *pool) {
+    if (!home_set) {
+        home = atomic_fetch_add(&next_home, 1);
+        home_set = true;
+    }
+    return home % active_groups(pool);
+}
+
+static void magazine_exit(void *arg);
+static void drain_magazines(alloc_pool_t *pool);
+static void alloc_pool_destroy_groups(alloc_pool_t *pool);
+
+/**
+ * Initialize a pool.
+ *
+ * Input:
+ *   - pool: the pool
+ *   - bitmap: one entry per number, up to limit, all FREE
+ *   - count: entries initially in use
+ *   - limit: entries the pool may grow to (at least count)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int alloc_pool_init(alloc_pool_t *pool, allocation_state_t *bitmap,
+                    size_t count, size_t limit) {
+    pool->bitmap = bitmap;
+    atomic_store(&pool->count, count);
+    pool->limit = limit;
+
+    // groups cover the whole limit, so growing never moves them
+    pool->group_size = (limit + ALLOC_GROUPS - 1) / ALLOC_GROUPS;
+    if (pool->group_size < ALLOC_GROUP_MIN_SIZE) {
+        pool->group_size = ALLOC_GROUP_MIN_SIZE;
+    }
+    pool->group_count = (limit + pool->group_size - 1) / pool->group_size;
+    if (pool->group_count == 0) {
+        pool->group_count = 1;
+    }
+
+    pool->groups = shm_malloc(pool->group_count * sizeof(alloc_group_t));
+    if (pool->groups == NULL) {
+        return -1;
+    }
+    for (size_t g = 0; g < pool->group_count; g++) {
+        alloc_group_t *group = &pool->groups[g];
+        size_t base = g * pool->group_size;
+        size_t size = count > base ? count - base : 0;
+        if (size > pool->group_size) {
+            size = pool->group_size;
+        }
+        shm_mutex_init(&group->lock);
+        group->size = size;
+        group->free = size;
+        group->cursor = 0;
+        atomic_init(&group->used, 0);
+    }
+
+    atomic_store(&pool->available, count);
+    shm_mutex_init(&pool->grow_lock);
+
+    pool->shared = shm_enabled();
+    if (!pool->shared &&
+        pthread_key_create(&pool->magazine_key, magazine_exit) != 0) {
+        alloc_pool_destroy_groups(pool);
+        return -1;
+    }
+    pthread_mutex_init(&pool->magazines_lock, NULL);
+    pool->magazines = NULL;
+    return 0;
+}
+
+static void alloc_pool_destroy_groups(alloc_pool_t *pool) {
+    for (size_t g = 0; g < pool->group_count; g++) {
+        pthread_mutex_destroy(&pool->groups[g].lock);
+    }
+    pthread_mutex_destroy(&pool->grow_lock);
+    shm_free(pool->groups);
+    pool->groups = NULL;
+}
+
+/**
+ * Destroy a pool (the bitmap belongs to the caller), along with the
+ * magazines of every thread.
+ */
+void alloc_pool_destroy(alloc_pool_t *pool) {
+    // once the key is gone, threads neither see nor drain their magazines
+    if (!pool->shared) {
+        pthread_key_delete(pool->magazine_key);
+    }
+    while (pool->magazines != NULL) {
+        magazine_t *mag = pool->magazines;
+        pool->magazines = mag->next;
+        pthread_mutex_destroy(&mag->lock);
+        free(mag);
+    }
+    pthread_mutex_destroy(&pool->magazines_lock);
+
+    alloc_pool_destroy_groups(pool);
+}
+
+/**
+ * Grow a pool in place until at least n entries are available, if its limit
+ * allows.
+ *
+ * Returns 0 if the pool grew (or others already made room), -1 if it is at
+ * its limit.
+ */
+static int pool_grow(alloc_pool_t *pool, size_t n) {
+    shm_mutex_lock(&pool->grow_lock);
+
+    size_t available = atomic_load(&pool->available);
+    size_t count = atomic_load(&pool->count);
+    if (available >= n) {
+        pthread_mutex_unlock(&pool->grow_lock);
+        return 0;
+    }
+    if (count >= pool->limit) {
+        pthread_mutex_unlock(&pool->grow_lock);
+        return -1;
+    }
+
+    // the new entries are still FREE in the bitmap: add them to their groups
+    size_t grown = alloc_grown_size(count, n - available, pool->limit);
+    for (size_t g = count / pool->group_size;
+         g < pool->group_count && g * pool->group_size < grown; g++) {
+        alloc_group_t *group = &pool->groups[g];
+        size_t size = grown - g * pool->group_size;
+        if (size > pool->group_size) {
+            size = pool->group_size;
+        }
+        shm_mutex_lock(&group->lock);
+        group->free += size - group->size;
+        group->size = size;
+        pthread_mutex_unlock(&group->lock);
+    }
+    atomic_store(&pool->count, grown);
+    atomic_fetch_add(&pool->available, grown - count);
+
+    pthread_mutex_unlock(&pool->grow_lock);
+    return 0;
+}
+
+/**
+ * Claim free entries, growing the pool if needed.
+ *
+ * Returns 0 if successful, -1 if there are not enough free entries.
+ */
+static int claim(alloc_pool_t *pool, size_t n) {
+    size_t available = atomic_load(&pool->available);
+    for (;;) {
+        if (available >= n) {
+            if (atomic_compare_exchange_weak(&pool->available, &available,
+                                             available - n)) {
+                return 0;
+            }
+        } else if (pool_grow(pool, n) == -1) {
+            return -1;
+        } else {
+            available = atomic_load(&pool->available);
+        }
+    }
+}
+
+/**
+ * Claim up to max of the free entries there are, without growing the pool.
+ *
+ * Returns the number of entries claimed.
+ */
+static size_t claim_up_to(alloc_pool_t *pool, size_t max) {
+    size_t available = atomic_load(&pool->available);
+    size_t n;
+    do {
+        n = available < max ? available : max;
+    } while (n > 0 && !atomic_compare_exchange_weak(&pool->available,
+                                                    &available, available - n));
+    return n;
+}
+
+/**
+ * Claim free entries, to be taken later with alloc_pool_take, growing the
+ * pool and taking back the entries cached in magazines if needed.
+ *
+ * Input:
+ *   - pool: the pool
+ *   - n: number of entries
+ *
+ * Returns 0 if successful, -1 if there are not enough free entries.
+ */
+int alloc_pool_claim(alloc_pool_t *pool, size_t n) {
+    if (claim(pool, n) == 0) {
+        return 0;
+    }
+    drain_magazines(pool);
+    return claim(pool, n);
+}
+
+/**
+ * Give back claimed entries that will not be taken.
+ */
+void alloc_pool_unclaim(alloc_pool_t *pool, size_t n) {
+    atomic_fetch_add(&pool->available, n);
+}
+
+/**
+ * Take a contiguous run of n free entries from a group, first fit.
+ * Must be called with the group's lock held.
+ *
+ * Returns whether a run was found.
+ */
+static bool group_take_run(alloc_pool_t *pool, size_t g, size_t n,
+                           int *numbers) {
+    alloc_group_t *group = &pool->groups[g];
+    if (group->free < n) {
+        return false;
+    }
+
+    size_t base = g * pool->group_size;
+    size_t run_length = 0;
+    for (size_t i = 0; i < group->size; i++) {
+        if (pool->bitmap[base + i] != FREE) {
+            run_length = 0;
+        } else if (++run_length == n) {
+            size_t start = base + i + 1 - n;
+            for (size_t j = 0; j < n; j++) {
+                pool->bitmap[start + j] = TAKEN;
+                numbers[j] = (int)(start + j);
+            }
+            group->free -= n;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Take up to n free entries from a group, starting at its cursor.
+ * Must be called with the group's lock held.
+ *
+ * Returns the number of entries taken.
+ */
+static size_t group_take(alloc_pool_t *pool, size_t g, size_t n,
+                         int *numbers) {
+    alloc_group_t *group = &pool->groups[g];
+    size_t base = g * pool->group_size;
+    size_t taken = 0;
+    for (size_t k = 0; k < group->size && taken < n && group->free > 0; k++) {
+        size_t i = (group->cursor + k) % group->size;
+        if (pool->bitmap[base + i] == FREE) {
+            pool->bitmap[base + i] = TAKEN;
+            numbers[taken++] = (int)(base + i);
+            group->free--;
+            group->cursor = i + 1;
+        }
+    }
+    return taken;
+}
+
+/**
+ * Account for an entry being handed out (delta 1) or given back (delta -1),
+ * in its group.
+ */
+static void count_used(alloc_pool_t *pool, int number, int delta) {
+    alloc_group_t *group = &pool->groups[(size_t)number / pool->group_size];
+    if (delta > 0) {
+        atomic_fetch_add_explicit(&group->used, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_sub_explicit(&group->used, 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * Number of entries in use (neither free nor cached in a magazine), adding
+ * up the counters of the groups (a constant amount of work, as there are at
+ * most ALLOC_GROUPS of them, save for tiny pools).
+ *
+ * Input:
+ *   - pool: the pool
+ */
+size_t alloc_pool_used(alloc_pool_t *pool) {
+    size_t used = 0;
+    for (size_t g = 0; g < pool->group_count; g++) {
+        used += atomic_load_explicit(&pool->groups[g].used,
+                                     memory_order_relaxed);
+    }
+    return used;
+}
+
+/**
+ * Take claimed entries, preferring the calling thread's home group and, if
+ * asked to, one contiguous run.
+ */
+static void take_entries(alloc_pool_t *pool, size_t n, bool contiguous,
+                         int *numbers) {
+    size_t first = home_group(pool);
+
+    if (contiguous && n > 1) {
+        size_t groups = active_groups(pool);
+        for (size_t k = 0; k < groups; k++) {
+            size_t g = (first + k) % groups;
+            shm_mutex_lock(&pool->groups[g].lock);
+            bool found = group_take_run(pool, g, n, numbers);
+            pthread_mutex_unlock(&pool->groups[g].lock);
+            if (found) {
+                return;
+            }
+        }
+    }
+
+    // Steal from the other groups as needed: the claimed entries are free
+    // somewhere, though maybe in a group visited before they were released
+    size_t taken = 0;
+    for (size_t k = 0; taken < n; k++) {
+        size_t g = (first + k) % active_groups(pool);
+        shm_mutex_lock(&pool->groups[g].lock);
+        taken += group_take(pool, g, n - taken, numbers + taken);
+        pthread_mutex_unlock(&pool->groups[g].lock);
+    }
+}
+
+/**
+ * Take claimed entries, preferring the calling thread's home group and, for
+ * several entries, one contiguous run.
+ *
+ * Input:
+ *   - pool: the pool
+ *   - n: number of entries, previously claimed with alloc_pool_claim
+ *   - numbers: output array with room for n entry numbers
+ */
+void alloc_pool_take(alloc_pool_t *pool, size_t n, int *numbers) {
+    take_entries(pool, n, true, numbers);
+    for (size_t i = 0; i < n; i++) {
+        count_used(pool, numbers[i], 1);
+    }
+}
+
+/**
+ * Return an entry (in use or cached) to its group.
+ */
+static void release_entry(alloc_pool_t *pool, int number) {
+    alloc_group_t *group = &pool->groups[(size_t)number / pool->group_size];
+
+    shm_mutex_lock(&group->lock);
+    ALWAYS_ASSERT(pool->bitmap[number] != FREE,
+                  "release_entry: entry already free");
+    pool->bitmap[number] = FREE;
+    group->free++;
+    pthread_mutex_unlock(&group->lock);
+
+    atomic_fetch_add(&pool->available, 1);
+}
+
+/**
+ * Drain a thread's magazine when it exits (pthread key destructor).
+ */
+static void magazine_exit(void *arg) {
+    magazine_t *mag = arg;
+    alloc_pool_t *pool = mag->pool;
+
+    pthread_mutex_lock(&pool->magazines_lock);
+    magazine_t **link = &pool->magazines;
+    while (*link != mag) {
+        link = &(*link)->next;
+    }
+    *link = mag->next;
+    pthread_mutex_unlock(&pool->magazines_lock);
+
+    for (size_t i = 0; i < mag->count; i++) {
+        release_entry(pool, mag->entries[i]);
+    }
+    pthread_mutex_destroy(&mag->lock);
+    free(mag);
+}
+
+/**
+ * The calling thread's magazine for a pool, created on first use.
+ *
+ * Returns the magazine, or NULL if it could not be created.
+ */
+static magazine_t *get_magazine(alloc_pool_t *pool) {
+    if (pool->shared) {
+        return NULL;
+    }
+    magazine_t *mag = pthread_getspecific(pool->magazine_key);
+    if (mag != NULL) {
+        return mag;
+    }
+
+    mag = aligned_alloc(CACHE_LINE_SIZE, sizeof(magazine_t));
+    if (mag == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&mag->lock, NULL);
+    mag->count = 0;
+    mag->pool = pool;
+    if (pthread_setspecific(pool->magazine_key, mag) != 0) {
+        pthread_mutex_destroy(&mag->lock);
+        free(mag);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->magazines_lock);
+    mag->next = pool->magazines;
+    pool->magazines = mag;
+    pthread_mutex_unlock(&pool->magazines_lock);
+    return mag;
+}
+
+/**
+ * Return the entries cached in every thread's magazine to the pool.
+ */
+static void drain_magazines(alloc_pool_t *pool) {
+    pthread_mutex_lock(&pool->magazines_lock);
+    for (magazine_t *mag = pool->magazines; mag != NULL; mag = mag->next) {
+        pthread_mutex_lock(&mag->lock);
+        for (size_t i = 0; i < mag->count; i++) {
+            release_entry(pool, mag->entries[i]);
+        }
+        mag->count = 0;
+        pthread_mutex_unlock(&mag->lock);
+    }
+    pthread_mutex_unlock(&pool->magazines_lock);
+}
+
+/**
+ * Allocate a single entry (see alloc_pool_get), without accounting for it.
+ */
+static int get_entry(alloc_pool_t *pool) {
+    int number;
+    magazine_t *mag = get_magazine(pool);
+    if (mag != NULL) {
+        // (the entries in a magazine are only in use by its thread, so
+        // switching them between CACHED and TAKEN needs no group lock)
+        pthread_mutex_lock(&mag->lock);
+        if (mag->count > 0) {
+            number = mag->entries[--mag->count];
+            pool->bitmap[number] = TAKEN;
+            pthread_mutex_unlock(&mag->lock);
+            return number;
+        }
+        pthread_mutex_unlock(&mag->lock);
+
+        // Refill (without growing the pool for entries not needed yet): the
+        // first entry of the batch is handed out
+        size_t n = claim_up_to(pool, MAGAZINE_BATCH);
+        if (n > 0) {
+            int batch[MAGAZINE_BATCH];
+            take_entries(pool, n, false, batch);
+            pthread_mutex_lock(&mag->lock);
+            for (size_t i = 1; i < n; i++) {
+                pool->bitmap[batch[i]] = CACHED;
+                mag->entries[mag->count++] = batch[i];
+            }
+            pthread_mutex_unlock(&mag->lock);
+            return batch[0];
+        }
+    }
+
+    // Nearly full: take a single entry, if need be one cached by some thread
+    if (alloc_pool_claim(pool, 1) == -1) {
+        return -1;
+    }
+    take_entries(pool, 1, false, &number);
+    return number;
+}
+
+/**
+ * Allocate a single entry, from the calling thread's magazine if possible.
+ *
+ * Input:
+ *   - pool: the pool
+ *
+ * Returns the entry's number, or -1 if there are no free entries (the pool
+ * grows if it can).
+ */
+int alloc_pool_get(alloc_pool_t *pool) {
+    int number = get_entry(pool);
+    if (number != -1) {
+        count_used(pool, number, 1);
+    }
+    return number;
+}
+
+/**
+ * Free a single entry into the calling thread's magazine (when the magazine
+ * is full, half of it goes back to the pool).
+ *
+ * Input:
+ *   - pool: the pool
+ *   - number: the entry, allocated with alloc_pool_get or alloc_pool_take
+ */
+void alloc_pool_put(alloc_pool_t *pool, int number) {
+    ALWAYS_ASSERT(pool->bitmap[number] == TAKEN,
+                  "alloc_pool_put: entry not in use");
+    count_used(pool, number, -1);
+
+    magazine_t *mag = get_magazine(pool);
+    if (mag == NULL) {
+        release_entry(pool, number);
+        return;
+    }
+
+    int batch[MAGAZINE_BATCH];
+    size_t flushed = 0;
+    pthread_mutex_lock(&mag->lock);
+    if (mag->count == ALLOC_MAGAZINE_SIZE) {
+        flushed = MAGAZINE_BATCH;
+        memcpy(batch, mag->entries, sizeof(batch));
+        mag->count -= MAGAZINE_BATCH;
+        memmove(mag->entries, mag->entries + MAGAZINE_BATCH,
+                mag->count * sizeof(int));
+    }
+    pool->bitmap[number] = CACHED;
+    mag->entries[mag->count++] = number;
+    pthread_mutex_unlock(&mag->lock);
+
+    for (size_t i = 0; i < flushed; i++) {
+        release_entry(pool, batch[i]);
+    }
+}
+
+/**
+ * Return several entries in use to their groups at once, bypassing the
+ * magazines: consecutive entries of the same group (such as a run taken with
+ * alloc_pool_take) are released under a single acquisition of its lock.
+ *
+ * Input:
+ *   - pool: the pool
+ *   - numbers: the entries
+ *   - n: number of entries
+ */
+void alloc_pool_put_many(alloc_pool_t *pool, int const *numbers, size_t n) {
+    alloc_group_t *locked = NULL;
+    for (size_t i = 0; i < n; i++) {
+        alloc_group_t *group =
+            &pool->groups[(size_t)numbers[i] / pool->group_size];
+        if (group != locked) {
+            if (locked != NULL) {
+                pthread_mutex_unlock(&locked->lock);
+            }
+            shm_mutex_lock(&group->lock);
+            locked = group;
+        }
+        ALWAYS_ASSERT(pool->bitmap[numbers[i]] == TAKEN,
+                      "alloc_pool_put_many: entry not in use");
+        pool->bitmap[numbers[i]] = FREE;
+        group->free++;
+        count_used(pool, numbers[i], -1);
+    }
+    if (locked != NULL) {
+        pthread_mutex_unlock(&locked->lock);
+    }
+
+    atomic_fetch_add(&pool->available, n);
+}
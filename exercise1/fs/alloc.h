@@ -0,0 +1,79 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// CACHED: held in a thread's magazine, neither free nor in use
+typedef enum { FREE = 0, TAKEN = 1, CACHED = 2 } allocation_state_t;
+
+/**
+ * Allocation group: a slice of a pool's bitmap with its own lock, so that
+ * threads allocating from different groups never contend.
+ */
+typedef struct {
+    alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;
+    size_t size;   // entries of the slice in use (grows with the pool)
+    size_t free;   // free entries among them
+    size_t cursor; // where the last search in the group ended
+    atomic_size_t used; // entries handed out (changed without the lock)
+} alloc_group_t;
+
+/**
+ * Magazine: a thread's private stash of entries taken from a pool, so that
+ * allocating and freeing single entries rarely touches the pool itself.
+ */
+typedef struct magazine {
+    alignas(CACHE_LINE_SIZE) pthread_mutex_t lock; // only contended by drains
+    size_t count;
+    int entries[ALLOC_MAGAZINE_SIZE];
+    struct alloc_pool *pool;
+    struct magazine *next; // in the pool's list
+} magazine_t;
+
+/**
+ * Pool of numbered entries (inodes, data blocks) tracked by a bitmap that is
+ * split into allocation groups.
+ */
+typedef struct alloc_pool {
+    allocation_state_t *bitmap;
+    atomic_size_t count; // entries in use, grows up to limit
+    size_t limit;
+
+    alloc_group_t *groups; // enough groups to cover limit entries
+    size_t group_size;
+    size_t group_count;
+
+    // free entries not yet claimed by an allocation or a reservation
+    atomic_size_t available;
+    pthread_mutex_t grow_lock;
+
+    // per-thread magazines (pthread key values), drained on thread exit;
+    // none in shared volumes, whose other processes could not drain them
+    bool shared;
+    pthread_key_t magazine_key;
+    pthread_mutex_t magazines_lock;
+    magazine_t *magazines;
+} alloc_pool_t;
+
+size_t alloc_grown_size(size_t size, size_t needed, size_t limit);
+
+int alloc_pool_init(alloc_pool_t *pool, allocation_state_t *bitmap,
+                    size_t count, size_t limit);
+void alloc_pool_destroy(alloc_pool_t *pool);
+
+int alloc_pool_claim(alloc_pool_t *pool, size_t n);
+void alloc_pool_unclaim(alloc_pool_t *pool, size_t n);
+void alloc_pool_take(alloc_pool_t *pool, size_t n, int *numbers);
+
+int alloc_pool_get(alloc_pool_t *pool);
+void alloc_pool_put(alloc_pool_t *pool, int number);
+void alloc_pool_put_many(alloc_pool_t *pool, int const *numbers, size_t n);
+size_t alloc_pool_used(alloc_pool_t *pool);
+
+#endif // ALLOC_H
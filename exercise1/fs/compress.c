@@ -0,0 +1,222 @@
+#include "compress.h"
+#include "betterassert.h"
+#include "instance.h"
+#include "lz.h"
+#include "state.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Compressed storage.
+ *
+ * When enabled, the write-back cache compresses each page it writes back
+ * (see flush_locked) and packs the result into a data block shared with
+ * other compressed pages; the block map records the byte range of each
+ * one (block_extent_t). Pages that do not compress are stored whole.
+ *
+ * Compressed blocks are never changed in place: a rewrite packs a new copy
+ * and drops the old one, so each packed data block is owned once per page
+ * in it (see data_block_hold) and freed with the last one.
+ *
+ * Reads decompress into a cache of pages keyed by where the compressed
+ * bytes are, so repeated reads of a block pay the decoding once. A data
+ * block that is packed again after being freed gets a new generation,
+ * which invalidates what was cached from its previous contents.
+ */
+
+typedef struct {
+    pthread_mutex_t lock;
+    int block; // -1 if the slot is empty
+    unsigned int generation;
+    size_t offset;
+    char *page;
+} cache_slot_t;
+
+// Compressed storage of an instance (see instance.h), if enabled
+struct compress {
+    size_t block_size;
+    cache_slot_t *cache;
+    size_t cache_size;
+    char *cache_pages;
+    atomic_uint *generations; // of each data block
+
+    atomic_size_t bytes_in;
+    atomic_size_t bytes_out;
+    atomic_uint_fast64_t compress_ns;
+    atomic_uint_fast64_t decompress_ns;
+    atomic_size_t cache_hits;
+    atomic_size_t cache_misses;
+};
+
+#define COMPRESS (tfs_current->compress)
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Initialize compressed storage (a no-op unless params->compress is set).
+ *
+ * Input:
+ *   - params: TécnicoFS parameters
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - write_back is off (the write-back cache does the compression).
+ *   - The block size does not fit a block_extent_t, or the cache is empty.
+ *   - malloc failure.
+ */
+int compress_init(tfs_params const *params) {
+    if (!params->compress) {
+        return 0;
+    }
+    if (!params->write_back || params->block_size > UINT16_MAX ||
+        params->compress_cache_blocks == 0) {
+        return -1;
+    }
+
+    struct compress *cs = calloc(1, sizeof(struct compress));
+    if (cs == NULL) {
+        return -1;
+    }
+    size_t blocks = params->block_count_limit > params->max_block_count
+                        ? params->block_count_limit
+                        : params->max_block_count;
+    cs->block_size = params->block_size;
+    cs->cache_size = params->compress_cache_blocks;
+    cs->cache = malloc(cs->cache_size * sizeof(cache_slot_t));
+    cs->cache_pages = malloc(cs->cache_size * cs->block_size);
+    cs->generations = calloc(blocks, sizeof(atomic_uint));
+    if (cs->cache == NULL || cs->cache_pages == NULL ||
+        cs->generations == NULL) {
+        free(cs->cache);
+        free(cs->cache_pages);
+        free(cs->generations);
+        free(cs);
+        return -1;
+    }
+    for (size_t i = 0; i < cs->cache_size; i++) {
+        pthread_mutex_init(&cs->cache[i].lock, NULL);
+        cs->cache[i].block = -1;
+        cs->cache[i].page = cs->cache_pages + i * cs->block_size;
+    }
+
+    COMPRESS = cs;
+    return 0;
+}
+
+void compress_destroy(void) {
+    struct compress *cs = COMPRESS;
+    if (cs == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < cs->cache_size; i++) {
+        pthread_mutex_destroy(&cs->cache[i].lock);
+    }
+    free(cs->cache);
+    free(cs->cache_pages);
+    free(cs->generations);
+    free(cs);
+    COMPRESS = NULL;
+}
+
+bool compress_enabled(void) { return COMPRESS != NULL; }
+
+/**
+ * Compress a page (one block of file data).
+ *
+ * Input:
+ *   - page: the page
+ *   - dst: where to put the compressed data (block size - 1 bytes)
+ *
+ * Returns the compressed size, or 0 if the page does not compress (and
+ * should be stored whole).
+ */
+size_t compress_block(void const *page, void *dst) {
+    struct compress *cs = COMPRESS;
+    uint64_t start = now_ns();
+    size_t size = lz_compress(page, cs->block_size, dst, cs->block_size - 1);
+    atomic_fetch_add(&cs->compress_ns, now_ns() - start);
+
+    atomic_fetch_add(&cs->bytes_in, cs->block_size);
+    atomic_fetch_add(&cs->bytes_out, size > 0 ? size : cs->block_size);
+    return size;
+}
+
+/**
+ * Read from a compressed block, decompressing it into the cache unless it
+ * is there already.
+ *
+ * Input:
+ *   - block_number: data block holding the compressed bytes
+ *   - offset, length: where they are in the block
+ *   - from: offset in the decompressed block to read from
+ *   - buffer, len: destination (from + len must not exceed the block size)
+ *
+ * Returns 0 if successful, -1 if the block failed its checksum.
+ */
+int compress_read(int block_number, size_t offset, size_t length,
+                  size_t from, void *buffer, size_t len) {
+    struct compress *cs = COMPRESS;
+    unsigned int generation = atomic_load(&cs->generations[block_number]);
+    cache_slot_t *slot =
+        &cs->cache[((size_t)block_number * 31 + offset) % cs->cache_size];
+
+    pthread_mutex_lock(&slot->lock);
+    if (slot->block == block_number && slot->offset == offset &&
+        slot->generation == generation) {
+        atomic_fetch_add(&cs->cache_hits, 1);
+    } else {
+        atomic_fetch_add(&cs->cache_misses, 1);
+        char const *block = data_block_read_begin(block_number);
+        if (block == NULL) {
+            pthread_mutex_unlock(&slot->lock);
+            return -1;
+        }
+        uint64_t start = now_ns();
+        size_t size =
+            lz_decompress(block + offset, length, slot->page, cs->block_size);
+        atomic_fetch_add(&cs->decompress_ns, now_ns() - start);
+        data_block_read_end(block_number);
+        ALWAYS_ASSERT(size == cs->block_size, "compress_read: corrupted block");
+        slot->block = block_number;
+        slot->offset = offset;
+        slot->generation = generation;
+    }
+    memcpy(buffer, slot->page + from, len);
+    pthread_mutex_unlock(&slot->lock);
+    return 0;
+}
+
+/**
+ * Invalidate what was cached from a data block, which is about to be packed
+ * with new contents.
+ */
+void compress_forget(int block_number) {
+    struct compress *cs = COMPRESS;
+    atomic_fetch_add(&cs->generations[block_number], 1);
+}
+
+void compress_get_stats(tfs_stats *stats) {
+    struct compress *cs = COMPRESS;
+    if (cs == NULL) {
+        stats->compress_bytes_in = stats->compress_bytes_out = 0;
+        stats->compress_ns = stats->decompress_ns = 0;
+        stats->decompress_cache_hits = stats->decompress_cache_misses = 0;
+        return;
+    }
+    stats->compress_bytes_in = atomic_load(&cs->bytes_in);
+    stats->compress_bytes_out = atomic_load(&cs->bytes_out);
+    stats->compress_ns = atomic_load(&cs->compress_ns);
+    stats->decompress_ns = atomic_load(&cs->decompress_ns);
+    stats->decompress_cache_hits = atomic_load(&cs->cache_hits);
+    stats->decompress_cache_misses = atomic_load(&cs->cache_misses);
+}
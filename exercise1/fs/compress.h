@@ -0,0 +1,19 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "operations.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+int compress_init(tfs_params const *params);
+void compress_destroy(void);
+bool compress_enabled(void);
+
+size_t compress_block(void const *page, void *dst);
+int compress_read(int block_number, size_t offset, size_t length,
+                  size_t from, void *buffer, size_t len);
+void compress_forget(int block_number);
+void compress_get_stats(tfs_stats *stats);
+
+#endif // COMPRESS_H
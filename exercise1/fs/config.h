@@ -8,4 +8,44 @@
 
 #define DELAY (5000)
 
+// Size of the per-inode block map (upper bound for tfs_params.max_file_blocks)
+#define MAX_BLOCKS_PER_FILE (32)
+
+// Threads that can read directories without touching shared memory; readers
+// beyond this share a counter
+#define EPOCH_MAX_THREADS (64)
+
+#define CACHE_LINE_SIZE (64)
+
+// Page size requested by tfs_params.huge_pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Allocation groups per inode/block pool, unless that would make groups
+// smaller than ALLOC_GROUP_MIN_SIZE entries
+#define ALLOC_GROUPS (16)
+#define ALLOC_GROUP_MIN_SIZE (8)
+
+// Entries each thread keeps at hand per pool; refilled and drained in
+// batches of half that
+#define ALLOC_MAGAZINE_SIZE (16)
+
+// Snapshots that can exist at the same time
+#define MAX_SNAPSHOTS (16)
+
+// Checksums: inodes covered by one inode table checksum, and locks shared
+// by the blocks (and inode chunks) being written or verified
+#define INODE_CHUNK_SIZE (8)
+#define CHECKSUM_LOCK_STRIPES (64)
+
+// The scrubber verifies a batch of blocks every SCRUB_INTERVAL_MS
+#define SCRUB_INTERVAL_MS (100)
+
+// Shared volumes (tfs_params.shm_name): where they are mapped if that
+// address is free (each one is mapped at the same address in every process
+// using it), how long attaching waits for one to be formatted, and how many
+// byte ranges (see rangelock.c) one has room for at the same time
+#define SHM_ADDRESS_HINT (0x600000000000ULL)
+#define SHM_ATTACH_TIMEOUT_MS (1000)
+#define SHM_RANGES (1024)
+
 #endif // CONFIG_H
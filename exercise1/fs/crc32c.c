@@ -0,0 +1,110 @@
+#include "crc32c.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32C_X86
+#endif
+
+/*
+ * CRC32C (Castagnoli), with the SSE4.2 crc32 instruction picked at run time
+ * when the CPU has it, and slicing-by-8 tables otherwise.
+ */
+
+#define CRC32C_POLY (0x82f63b78u) // reflected
+
+typedef uint32_t (*crc_fn)(uint32_t, unsigned char const *, size_t);
+
+static uint32_t tables[8][256];
+
+static void tables_fill(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (size_t t = 1; t < 8; t++) {
+            uint32_t prev = tables[t - 1][i];
+            tables[t][i] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+}
+
+static uint32_t crc_slicing8(uint32_t crc, unsigned char const *p,
+                             size_t len) {
+    for (; len >= 8; p += 8, len -= 8) {
+        uint32_t low;
+        uint32_t high;
+        memcpy(&low, p, sizeof(low));
+        memcpy(&high, p + 4, sizeof(high));
+        low ^= crc; // (little-endian)
+        crc = tables[7][low & 0xff] ^ tables[6][(low >> 8) & 0xff] ^
+              tables[5][(low >> 16) & 0xff] ^ tables[4][low >> 24] ^
+              tables[3][high & 0xff] ^ tables[2][(high >> 8) & 0xff] ^
+              tables[1][(high >> 16) & 0xff] ^ tables[0][high >> 24];
+    }
+    for (; len > 0; p++, len--) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *p) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2"))) static uint32_t
+crc_sse42(uint32_t crc, unsigned char const *p, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    uint32_t crc32 = (uint32_t)crc64;
+    for (; len > 0; p++, len--) {
+        crc32 = _mm_crc32_u8(crc32, *p);
+    }
+    return crc32;
+}
+#endif
+
+static crc_fn crc_impl = crc_slicing8;
+static char const *crc_name = "slicing-by-8";
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_select(void) {
+    tables_fill();
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc_impl = crc_sse42;
+        crc_name = "sse4.2";
+    }
+#endif
+}
+
+/**
+ * Pick the fastest implementation the CPU supports. Safe to call repeatedly.
+ */
+void crc32c_init(void) { pthread_once(&crc_once, crc_select); }
+
+/**
+ * Name of the implementation in use ("sse4.2" or "slicing-by-8").
+ */
+char const *crc32c_impl_name(void) { return crc_name; }
+
+/**
+ * Compute the CRC32C of a buffer.
+ *
+ * Input:
+ *   - crc: CRC of the data before it (0 to start)
+ *   - data, len: the buffer
+ *
+ * Returns the CRC of everything so far.
+ */
+uint32_t crc32c(uint32_t crc, void const *data, size_t len) {
+    return ~crc_impl(~crc, data, len);
+}
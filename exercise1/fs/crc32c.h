@@ -0,0 +1,12 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void crc32c_init(void);
+char const *crc32c_impl_name(void);
+
+uint32_t crc32c(uint32_t crc, void const *data, size_t len);
+
+#endif // CRC32C_H
@@ -0,0 +1,309 @@
+#include "dedup.h"
+#include "betterassert.h"
+#include "instance.h"
+#include "state.h"
+#include "writeback.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Block deduplication.
+ *
+ * A fingerprint index maps the hash of a block's contents to a block with
+ * those contents. The index owns each block it holds (see data_block_hold),
+ * so every other owner copies it before changing it (copy-on-write) and its
+ * contents stay the ones that were hashed.
+ *
+ * A pass goes over the full blocks of the files that are not open (see
+ * dedup_files): a block whose contents are in the index is replaced by the
+ * indexed block, which gains an owner; any other block is added to the
+ * index. Hash matches are confirmed by comparing the blocks, so a collision
+ * only misses a chance to share. The index releases the blocks that are not
+ * shared by two other owners before and after the pass, so in between passes
+ * the others are freed with their files and are not copied when written to.
+ *
+ * Passes run in a background thread every dedup_interval_ms, and on demand
+ * (tfs_dedup); the write path is not involved.
+ */
+
+typedef struct {
+    uint64_t hash;
+    int block; // -1 if the slot is free
+} dedup_slot_t;
+
+// Deduplication of an instance (see instance.h), if enabled
+struct dedup {
+    size_t block_size;
+    // open addressing with linear probing; twice as many slots as blocks, so
+    // it never fills up
+    dedup_slot_t *slots;
+    dedup_slot_t *spare_slots; // to rebuild the index into
+    size_t slot_count;         // a power of 2
+    pthread_mutex_t pass_lock;
+
+    pthread_t deduper;
+    pthread_mutex_t deduper_lock;
+    pthread_cond_t deduper_cond;
+    bool deduper_stop;
+    unsigned int interval_ms;
+};
+
+#define DEDUP (tfs_current->dedup)
+
+/**
+ * Hash the contents of a block, 8 bytes at a time.
+ */
+static uint64_t block_hash(void const *data, size_t size) {
+    unsigned char const *bytes = data;
+    uint64_t hash = 0x9e3779b97f4a7c15u ^ size;
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        size_t n = size - i < sizeof(word) ? size - i : sizeof(word);
+        memcpy(&word, bytes + i, n);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdu;
+        hash ^= hash >> 32;
+    }
+    hash ^= hash >> 29;
+    hash *= 0xc4ceb9fe1a85ec53u;
+    return hash ^ (hash >> 32);
+}
+
+static size_t slot_find(dedup_slot_t const *table, uint64_t hash) {
+    struct dedup *dd = DEDUP;
+    size_t i = (size_t)hash & (dd->slot_count - 1);
+    while (table[i].block != -1 && table[i].hash != hash) {
+        i = (i + 1) & (dd->slot_count - 1);
+    }
+    return i;
+}
+
+/**
+ * Find the indexed block with the same contents as a given one, adding the
+ * given one to the index if its contents are new. Blocks that fail their
+ * checksum are neither indexed nor shared.
+ * Must be called with pass_lock held (and the range lock of the file that
+ * owns block_number, so it does not change meanwhile).
+ *
+ * Returns the indexed block (possibly block_number itself).
+ */
+static int canonical_block(int block_number) {
+    struct dedup *dd = DEDUP;
+    // (one block at a time: the checksum locks are striped)
+    void const *data = data_block_read_begin(block_number);
+    if (data == NULL) {
+        return block_number; // corrupted: leave it to its file
+    }
+    uint64_t hash = block_hash(data, dd->block_size);
+    data_block_read_end(block_number);
+    size_t i = slot_find(dd->slots, hash);
+
+    if (dd->slots[i].block == -1) {
+        data_block_hold(block_number);
+        dd->slots[i].hash = hash;
+        dd->slots[i].block = block_number;
+        return block_number;
+    }
+    int indexed = dd->slots[i].block;
+    if (indexed == block_number) {
+        return indexed;
+    }
+    void const *same = data_block_read_begin(indexed);
+    if (same == NULL) {
+        return block_number; // the indexed copy is corrupted
+    }
+    bool equal = memcmp(same, data, dd->block_size) == 0;
+    data_block_read_end(indexed);
+    // (on a collision, the first one stays indexed)
+    return equal ? indexed : block_number;
+}
+
+/**
+ * Release the blocks that no two other owners share anymore (the index's
+ * hold would otherwise keep them allocated, and copied when written to),
+ * rebuilding the index with the others.
+ * Must be called with pass_lock held.
+ */
+static void index_prune(void) {
+    struct dedup *dd = DEDUP;
+    for (size_t i = 0; i < dd->slot_count; i++) {
+        dd->spare_slots[i].block = -1;
+    }
+    for (size_t i = 0; i < dd->slot_count; i++) {
+        int block = dd->slots[i].block;
+        if (block == -1) {
+            continue;
+        }
+        if (data_block_owners(block) <= 2) {
+            data_block_free(block);
+            continue;
+        }
+        dd->spare_slots[slot_find(dd->spare_slots, dd->slots[i].hash)] =
+            dd->slots[i];
+    }
+
+    dedup_slot_t *rebuilt = dd->spare_slots;
+    dd->spare_slots = dd->slots;
+    dd->slots = rebuilt;
+}
+
+static void flush_file(int inumber) {
+    if (wb_enabled()) {
+        wb_flush(inumber);
+    }
+}
+
+/**
+ * Run a deduplication pass.
+ *
+ * Returns the number of blocks that were replaced by identical ones.
+ */
+size_t dedup_pass(void) {
+    struct dedup *dd = DEDUP;
+    pthread_mutex_lock(&dd->pass_lock);
+    index_prune();
+    size_t replaced = dedup_files(canonical_block, flush_file);
+    index_prune();
+    pthread_mutex_unlock(&dd->pass_lock);
+    return replaced;
+}
+
+/**
+ * Background deduplicator: runs a pass every interval_ms.
+ */
+static void *dedup_worker(void *arg) {
+    instance_enter(arg); // the instance that started it
+    struct dedup *dd = DEDUP;
+
+    pthread_mutex_lock(&dd->deduper_lock);
+    while (!dd->deduper_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += (time_t)(dd->interval_ms / 1000);
+        deadline.tv_nsec += (long)(dd->interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&dd->deduper_cond, &dd->deduper_lock, &deadline);
+        if (dd->deduper_stop) {
+            break;
+        }
+
+        pthread_mutex_unlock(&dd->deduper_lock);
+        dedup_pass();
+        pthread_mutex_lock(&dd->deduper_lock);
+    }
+    pthread_mutex_unlock(&dd->deduper_lock);
+
+    return NULL;
+}
+
+/**
+ * Initialize deduplication (a no-op unless params->dedup is set).
+ *
+ * Input:
+ *   - params: TécnicoFS parameters
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - malloc or thread creation failure.
+ */
+int dedup_init(tfs_params const *params) {
+    if (!params->dedup) {
+        return 0;
+    }
+
+    struct dedup *dd = calloc(1, sizeof(struct dedup));
+    if (dd == NULL) {
+        return -1;
+    }
+
+    // room for every block the data region can grow to
+    size_t blocks = params->block_count_limit > params->max_block_count
+                        ? params->block_count_limit
+                        : params->max_block_count;
+    dd->block_size = params->block_size;
+    dd->slot_count = 1;
+    while (dd->slot_count < 2 * blocks) {
+        dd->slot_count *= 2;
+    }
+    dd->slots = malloc(dd->slot_count * sizeof(dedup_slot_t));
+    dd->spare_slots = malloc(dd->slot_count * sizeof(dedup_slot_t));
+    if (dd->slots == NULL || dd->spare_slots == NULL) {
+        free(dd->slots);
+        free(dd->spare_slots);
+        free(dd);
+        return -1;
+    }
+    for (size_t i = 0; i < dd->slot_count; i++) {
+        dd->slots[i].block = -1;
+    }
+    pthread_mutex_init(&dd->pass_lock, NULL);
+
+    DEDUP = dd;
+    dd->interval_ms = params->dedup_interval_ms;
+    if (dd->interval_ms == 0) {
+        return 0; // tfs_dedup only
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dd->deduper_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&dd->deduper_lock, NULL);
+
+    dd->deduper_stop = false;
+    if (pthread_create(&dd->deduper, NULL, dedup_worker, tfs_current) != 0) {
+        DEDUP = NULL;
+        pthread_cond_destroy(&dd->deduper_cond);
+        pthread_mutex_destroy(&dd->deduper_lock);
+        pthread_mutex_destroy(&dd->pass_lock);
+        free(dd->slots);
+        free(dd->spare_slots);
+        free(dd);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stop the background pass and release the index's blocks.
+ */
+void dedup_destroy(void) {
+    struct dedup *dd = DEDUP;
+    if (dd == NULL) {
+        return;
+    }
+
+    if (dd->interval_ms > 0) {
+        pthread_mutex_lock(&dd->deduper_lock);
+        dd->deduper_stop = true;
+        pthread_cond_signal(&dd->deduper_cond);
+        pthread_mutex_unlock(&dd->deduper_lock);
+        pthread_join(dd->deduper, NULL);
+        pthread_cond_destroy(&dd->deduper_cond);
+        pthread_mutex_destroy(&dd->deduper_lock);
+    }
+
+    for (size_t i = 0; i < dd->slot_count; i++) {
+        if (dd->slots[i].block != -1) {
+            data_block_free(dd->slots[i].block);
+        }
+    }
+    pthread_mutex_destroy(&dd->pass_lock);
+    free(dd->slots);
+    free(dd->spare_slots);
+    free(dd);
+    DEDUP = NULL;
+}
+
+bool dedup_enabled(void) { return DEDUP != NULL; }
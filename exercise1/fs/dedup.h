@@ -0,0 +1,15 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "operations.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+int dedup_init(tfs_params const *params);
+void dedup_destroy(void);
+bool dedup_enabled(void);
+
+size_t dedup_pass(void);
+
+#endif // DEDUP_H
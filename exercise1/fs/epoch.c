@@ -0,0 +1,179 @@
+#include "epoch.h"
+#include "config.h"
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/*
+ * Epoch-based reclamation.
+ *
+ * Readers announce the global epoch in a slot of their own (one cache line
+ * per thread) for the duration of a read-side section, so they never write to
+ * memory shared with other readers. Writers unlink an object, then retire it:
+ * it is freed once the global epoch moved two steps past the epoch it was
+ * retired in, which can only happen after every reader that could have seen
+ * it left its section.
+ *
+ * The domain is shared by every instance (a thread's slot serves whichever
+ * one it reads), and set up and torn down with the first and last of them.
+ */
+
+typedef struct {
+    // (epoch << 1) | 1 while inside a section, 0 outside
+    alignas(CACHE_LINE_SIZE) atomic_ulong state;
+    atomic_bool in_use;
+} epoch_slot_t;
+
+static epoch_slot_t slots[EPOCH_MAX_THREADS];
+static _Thread_local epoch_slot_t *my_slot;
+static _Thread_local bool my_slot_tried;
+
+// readers that found no free slot: while any is inside, the epoch stays put
+static atomic_ulong overflow_readers;
+
+static atomic_ulong global_epoch;
+
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static epoch_entry_t *retired;
+static size_t users; // instances, protected by retired_lock
+
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slot_key;
+
+static void slot_release(void *slot) {
+    atomic_store(&((epoch_slot_t *)slot)->in_use, false);
+}
+
+static void slot_key_create(void) {
+    pthread_key_create(&slot_key, slot_release);
+}
+
+/**
+ * Find the calling thread's slot, claiming a free one on first use.
+ *
+ * Returns the slot, or NULL if every slot is taken.
+ */
+static epoch_slot_t *get_slot(void) {
+    if (my_slot != NULL || my_slot_tried) {
+        return my_slot;
+    }
+    my_slot_tried = true;
+
+    pthread_once(&slot_key_once, slot_key_create);
+    for (size_t i = 0; i < EPOCH_MAX_THREADS; i++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&slots[i].in_use, &expected,
+                                           true)) {
+            // released when the thread exits
+            pthread_setspecific(slot_key, &slots[i]);
+            my_slot = &slots[i];
+            break;
+        }
+    }
+    return my_slot;
+}
+
+void epoch_init(void) {
+    pthread_mutex_lock(&retired_lock);
+    if (users++ == 0) {
+        atomic_store(&global_epoch, 1);
+        atomic_store(&overflow_readers, 0);
+    }
+    pthread_mutex_unlock(&retired_lock);
+}
+
+/**
+ * Free every retired object once the last instance is gone. There must be
+ * no readers left.
+ */
+void epoch_destroy(void) {
+    pthread_mutex_lock(&retired_lock);
+    if (--users > 0) {
+        pthread_mutex_unlock(&retired_lock);
+        return;
+    }
+    while (retired != NULL) {
+        epoch_entry_t *entry = retired;
+        retired = entry->next;
+        free(entry);
+    }
+    pthread_mutex_unlock(&retired_lock);
+}
+
+/**
+ * Start a read-side section: objects loaded from now on stay valid until
+ * epoch_exit. Sections do not nest.
+ */
+void epoch_enter(void) {
+    epoch_slot_t *slot = get_slot();
+    if (slot == NULL) {
+        atomic_fetch_add(&overflow_readers, 1);
+        return;
+    }
+    atomic_store(&slot->state, (atomic_load(&global_epoch) << 1) | 1);
+}
+
+/**
+ * End a read-side section.
+ */
+void epoch_exit(void) {
+    epoch_slot_t *slot = get_slot();
+    if (slot == NULL) {
+        atomic_fetch_sub(&overflow_readers, 1);
+        return;
+    }
+    atomic_store_explicit(&slot->state, 0, memory_order_release);
+}
+
+/**
+ * Advance the global epoch if every reader inside a section already saw the
+ * current one. Must be called with retired_lock held.
+ */
+static void try_advance(void) {
+    if (atomic_load(&overflow_readers) != 0) {
+        return;
+    }
+
+    unsigned long epoch = atomic_load(&global_epoch);
+    for (size_t i = 0; i < EPOCH_MAX_THREADS; i++) {
+        unsigned long state = atomic_load(&slots[i].state);
+        if ((state & 1) != 0 && (state >> 1) != epoch) {
+            return; // a reader is still in an older epoch
+        }
+    }
+    atomic_store(&global_epoch, epoch + 1);
+}
+
+/**
+ * Hand an object that was just unlinked over to be freed once no reader can
+ * reach it any more.
+ *
+ * Input:
+ *   - entry: header (first member) of the unlinked, malloc'ed object
+ */
+void epoch_retire(epoch_entry_t *entry) {
+    pthread_mutex_lock(&retired_lock);
+
+    entry->epoch = atomic_load(&global_epoch);
+    entry->next = retired;
+    retired = entry;
+
+    try_advance();
+
+    unsigned long epoch = atomic_load(&global_epoch);
+    epoch_entry_t **link = &retired;
+    while (*link != NULL) {
+        epoch_entry_t *old = *link;
+        if (old->epoch + 2 <= epoch) {
+            *link = old->next;
+            free(old);
+        } else {
+            link = &old->next;
+        }
+    }
+
+    pthread_mutex_unlock(&retired_lock);
+}
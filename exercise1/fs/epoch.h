@@ -0,0 +1,21 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/**
+ * Header of an object retired with epoch_retire. Must be the first member of
+ * a malloc'ed object, which is freed once no reader can still see it.
+ */
+typedef struct epoch_entry {
+    struct epoch_entry *next;
+    unsigned long epoch;
+} epoch_entry_t;
+
+void epoch_init(void);
+void epoch_destroy(void);
+
+void epoch_enter(void);
+void epoch_exit(void);
+
+void epoch_retire(epoch_entry_t *entry);
+
+#endif // EPOCH_H
@@ -0,0 +1,24 @@
+#include "instance.h"
+
+/*
+ * The instance of tfs_init and of the tfs_* functions without one.
+ */
+static tfs_t default_instance = {.rwlock = PTHREAD_RWLOCK_INITIALIZER};
+
+_Thread_local tfs_t *tfs_current = &default_instance;
+
+/**
+ * Make an instance the calling thread's current one.
+ *
+ * Returns the previous one, to be given to instance_leave.
+ */
+tfs_t *instance_enter(tfs_t *fs) {
+    tfs_t *outer = tfs_current;
+    tfs_current = fs;
+    return outer;
+}
+
+/**
+ * Return to the instance that was current before instance_enter.
+ */
+void instance_leave(tfs_t *outer) { tfs_current = outer; }
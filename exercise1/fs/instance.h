@@ -0,0 +1,32 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "operations.h"
+
+#include <pthread.h>
+
+/*
+ * A TécnicoFS instance: the state of each module (each one private to its
+ * module) and the locks of operations.c.
+ *
+ * Internal functions act on the calling thread's current instance,
+ * tfs_current. It is the default instance (the one of tfs_init) unless a
+ * tfs_*_in function switched it for the length of the call, or the thread is
+ * a background thread of another instance.
+ */
+struct tfs {
+    struct state *state;
+    struct wb *wb;
+    struct compress *compress;
+    struct dedup *dedup;
+    struct scrub *scrub;
+    struct shm *shm;
+    pthread_rwlock_t rwlock; // file offsets (see operations.c)
+};
+
+extern _Thread_local tfs_t *tfs_current;
+
+tfs_t *instance_enter(tfs_t *fs);
+void instance_leave(tfs_t *outer);
+
+#endif // INSTANCE_H
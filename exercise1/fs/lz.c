@@ -0,0 +1,220 @@
+#include "lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * LZ77 codec in the style of LZ4, for compressing data blocks.
+ *
+ * The output is a series of sequences, each a token byte (number of literal
+ * bytes in the high 4 bits, match length minus LZ_MIN_MATCH in the low 4),
+ * the literals, and a 2-byte little-endian offset back to the match. A
+ * length field of 15 continues in the following bytes, each added to it,
+ * until one below 255. The last sequence has only literals.
+ *
+ * Matches are found through a hash table of the positions of the last
+ * 4-byte strings seen, without searching any further, which favours speed
+ * over ratio.
+ */
+
+#define LZ_MIN_MATCH (4)
+#define LZ_MAX_OFFSET (65535)
+#define LZ_HASH_BITS (10)
+
+static uint32_t read32(unsigned char const *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static size_t hash4(uint32_t sequence) {
+    return (size_t)((sequence * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+/**
+ * Append a length field continuation (see the format above).
+ *
+ * Returns the new output position, or NULL if the output is full.
+ */
+static unsigned char *put_length(unsigned char *op, unsigned char *oend,
+                                 size_t length) {
+    for (; length >= 255; length -= 255) {
+        if (op == oend) {
+            return NULL;
+        }
+        *op++ = 255;
+    }
+    if (op == oend) {
+        return NULL;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+/**
+ * Append a sequence: literals, then a match (unless match_len is 0).
+ *
+ * Returns the new output position, or NULL if the output is full.
+ */
+static unsigned char *put_sequence(unsigned char *op, unsigned char *oend,
+                                   unsigned char const *literals,
+                                   size_t literal_len, size_t offset,
+                                   size_t match_len) {
+    if (op == oend) {
+        return NULL;
+    }
+    unsigned char *token = op++;
+    size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+    *token = (unsigned char)(((literal_len < 15 ? literal_len : 15) << 4) |
+                             (match_code < 15 ? match_code : 15));
+
+    if (literal_len >= 15 &&
+        (op = put_length(op, oend, literal_len - 15)) == NULL) {
+        return NULL;
+    }
+    if ((size_t)(oend - op) < literal_len) {
+        return NULL;
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    if (match_len == 0) {
+        return op;
+    }
+    if (oend - op < 2) {
+        return NULL;
+    }
+    *op++ = (unsigned char)(offset & 0xff);
+    *op++ = (unsigned char)(offset >> 8);
+    if (match_code >= 15) {
+        op = put_length(op, oend, match_code - 15);
+    }
+    return op;
+}
+
+/**
+ * Compress a buffer.
+ *
+ * Input:
+ *   - src, len: the data
+ *   - dst, capacity: where to put the compressed data
+ *
+ * Returns the compressed size, or 0 if it would exceed capacity.
+ */
+size_t lz_compress(void const *src, size_t len, void *dst, size_t capacity) {
+    unsigned char const *in = src;
+    unsigned char *op = dst;
+    unsigned char *oend = op + capacity;
+    // position + 1 of the last string with each hash, 0 if none
+    uint32_t table[1 << LZ_HASH_BITS] = {0};
+
+    size_t anchor = 0; // first byte not yet emitted
+    size_t pos = 0;
+    while (len >= LZ_MIN_MATCH && pos <= len - LZ_MIN_MATCH) {
+        uint32_t sequence = read32(in + pos);
+        size_t h = hash4(sequence);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)(pos + 1);
+        if (candidate == 0 || pos - (candidate - 1) > LZ_MAX_OFFSET ||
+            read32(in + candidate - 1) != sequence) {
+            pos++;
+            continue;
+        }
+
+        size_t ref = candidate - 1;
+        size_t match_len = LZ_MIN_MATCH;
+        while (pos + match_len < len &&
+               in[ref + match_len] == in[pos + match_len]) {
+            match_len++;
+        }
+        op = put_sequence(op, oend, in + anchor, pos - anchor, pos - ref,
+                          match_len);
+        if (op == NULL) {
+            return 0;
+        }
+        pos += match_len;
+        anchor = pos;
+    }
+
+    op = put_sequence(op, oend, in + anchor, len - anchor, 0, 0);
+    if (op == NULL) {
+        return 0;
+    }
+    return (size_t)(op - (unsigned char *)dst);
+}
+
+/**
+ * Read a length field continuation (see the format above).
+ *
+ * Returns the new input position, or NULL if the input ended.
+ */
+static unsigned char const *get_length(unsigned char const *ip,
+                                       unsigned char const *iend,
+                                       size_t *length) {
+    unsigned char byte;
+    do {
+        if (ip == iend) {
+            return NULL;
+        }
+        byte = *ip++;
+        *length += byte;
+    } while (byte == 255);
+    return ip;
+}
+
+/**
+ * Decompress a buffer produced by lz_compress.
+ *
+ * Input:
+ *   - src, len: the compressed data
+ *   - dst, capacity: where to put the data
+ *
+ * Returns the decompressed size, or 0 if the input is malformed or the data
+ * would exceed capacity.
+ */
+size_t lz_decompress(void const *src, size_t len, void *dst, size_t capacity) {
+    unsigned char const *ip = src;
+    unsigned char const *iend = ip + len;
+    unsigned char *out = dst;
+    size_t pos = 0;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 &&
+            (ip = get_length(ip, iend, &literal_len)) == NULL) {
+            return 0;
+        }
+        if ((size_t)(iend - ip) < literal_len ||
+            capacity - pos < literal_len) {
+            return 0;
+        }
+        memcpy(out + pos, ip, literal_len);
+        ip += literal_len;
+        pos += literal_len;
+        if (ip == iend) {
+            break; // the last sequence has no match
+        }
+
+        if (iend - ip < 2) {
+            return 0;
+        }
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 &&
+            (ip = get_length(ip, iend, &match_len)) == NULL) {
+            return 0;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > pos || capacity - pos < match_len) {
+            return 0;
+        }
+        // byte by byte: the match may overlap the bytes it produces
+        for (size_t i = 0; i < match_len; i++, pos++) {
+            out[pos] = out[pos - offset];
+        }
+    }
+    return pos;
+}
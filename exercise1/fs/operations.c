@@ -1,6 +1,12 @@
 #include "operations.h"
+#include "compress.h"
 #include "config.h"
+#include "dedup.h"
+#include "instance.h"
+#include "scrub.h"
+#include "shm.h"
 #include "state.h"
+#include "writeback.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,17 +17,36 @@
 #include <errno.h>
 #include <dirent.h>
 #include <pthread.h>
+#include <stdint.h>
 
 #include "betterassert.h"
 
-pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+// Guards file offsets (see instance.h)
+#define RWLOCK (&tfs_current->rwlock)
 
 tfs_params tfs_default_params() {
     tfs_params params = {
         .max_inode_count = 64,
         .max_block_count = 1024,
         .max_open_files_count = 16,
+        .inode_count_limit = 0,
+        .block_count_limit = 0,
+        .open_files_count_limit = 0,
         .block_size = 1024,
+        .max_file_blocks = 1,
+        .write_back = false,
+        .max_dirty_bytes = 64 * 1024,
+        .flush_interval_ms = 100,
+        .append_flush_threshold = 0,
+        .append_flush_deadline_ms = 10,
+        .huge_pages = false,
+        .compress = false,
+        .compress_cache_blocks = 64,
+        .dedup = false,
+        .dedup_interval_ms = 1000,
+        .checksums = false,
+        .scrub_blocks_per_sec = 0,
+        .shm_name = NULL,
     };
     return params;
 }
@@ -34,13 +59,50 @@ int tfs_init(tfs_params const *params_ptr) {
         params = tfs_default_params();
     }
 
-    if (state_init(params) != 0) {
+    if (tfs_current->state != NULL) {
+        return -1; // already initialized
+    }
+
+    if (params.shm_name != NULL &&
+        (params.write_back || params.dedup ||
+         params.append_flush_threshold > 0)) {
+        return -1; // (see tfs_params.shm_name)
+    }
+
+    if (compress_init(&params) != 0) {
+        return -1;
+    }
+
+    int attached = state_init(params);
+    if (attached == -1) {
+        compress_destroy();
+        return -1;
+    }
+
+    // (from here on, a failure tears down whatever was set up, in reverse
+    // order: tfs_destroy skips the parts that were not)
+    if (!attached) {
+        // create root inode
+        int root = inode_create(T_DIRECTORY);
+        if (root != ROOT_DIR_INUM) {
+            tfs_destroy();
+            return -1;
+        }
+        shm_ready(); // other processes may now attach (shared volumes)
+    }
+
+    if (wb_init(&params) != 0) {
+        tfs_destroy();
+        return -1;
+    }
+
+    if (dedup_init(&params) != 0) {
+        tfs_destroy();
         return -1;
     }
 
-    // create root inode
-    int root = inode_create(T_DIRECTORY);
-    if (root != ROOT_DIR_INUM) {
+    if (scrub_init(&params) != 0) {
+        tfs_destroy();
         return -1;
     }
 
@@ -48,12 +110,65 @@ int tfs_init(tfs_params const *params_ptr) {
 }
 
 int tfs_destroy() {
+    scrub_destroy();
+    dedup_destroy();
+    wb_destroy();
+    compress_destroy();
+
     if (state_destroy() != 0) {
         return -1;
     }
     return 0;
 }
 
+tfs_t *tfs_instance_create(tfs_params const *params) {
+    tfs_t *fs = calloc(1, sizeof(tfs_t));
+    if (fs == NULL) {
+        return NULL;
+    }
+    pthread_rwlock_init(&fs->rwlock, NULL);
+
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_init(params); // (which tears down what it set up if it fails)
+    instance_leave(outer);
+
+    if (ret != 0) {
+        pthread_rwlock_destroy(&fs->rwlock);
+        free(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+int tfs_instance_destroy(tfs_t *fs) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_destroy();
+    instance_leave(outer);
+
+    pthread_rwlock_destroy(&fs->rwlock);
+    free(fs);
+    return ret;
+}
+
+int tfs_get_stats(tfs_stats *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+    if (state_get_stats(stats) != 0) {
+        return -1;
+    }
+    compress_get_stats(stats);
+    scrub_get_stats(stats);
+    return 0;
+}
+
+int tfs_statfs(tfs_statfs_info *info) {
+    if (info == NULL) {
+        return -1;
+    }
+    return state_statfs(info);
+}
+
 static bool valid_pathname(char const *name) {
     return name != NULL && strlen(name) > 1 && name[0] == '/';
 }
@@ -92,37 +207,27 @@ int tfs_open(char const *pathname, tfs_file_mode_t mode) {
     ALWAYS_ASSERT(root_dir_inode != NULL,
                   "tfs_open: root dir inode must exist");
     int inum = tfs_lookup(pathname, root_dir_inode); // confirmar se é pathname ou name
-    size_t offset;
 
     if (inum >= 0) {
         // The file already exists
         inode_t *inode = inode_get(inum);
         ALWAYS_ASSERT(inode != NULL,
                       "tfs_open: directory files must have an inode");
+        if (inode_verify(inum) == -1) {
+            return -1; // the inode failed its checksum
+        }
+        inode_meta_t meta = inode_meta_get(inode);
 
-        if(inode->i_node_type == T_SYMLINK){
-            void *block;
-            if((block = data_block_get(inode->i_data_block)) == NULL){
+        if(meta.type == T_SYMLINK){
+            char const *block;
+            if((block = data_block_read_begin(meta.root_block)) == NULL){
                 return -1;
             }
             strcpy(name, block);
+            data_block_read_end(meta.root_block);
 
             return tfs_open(name, mode);
         }
-
-        // Truncate (if requested)
-        if (mode & TFS_O_TRUNC) {
-            if (inode->i_size > 0) {
-                data_block_free(inode->i_data_block);
-                inode->i_size = 0;
-            }
-        }
-        // Determine initial offset
-        if (mode & TFS_O_APPEND) {
-            offset = inode->i_size;
-        } else {
-            offset = 0;
-        }
     } else if (mode & TFS_O_CREAT) {
         // The file does not exist; the mode specified that it should be created
         // Create inode
@@ -134,18 +239,46 @@ int tfs_open(char const *pathname, tfs_file_mode_t mode) {
         // Add entry in the root directory
         if (add_dir_entry(root_dir_inode, name + 1, inum) == -1) {
             inode_delete(inum);
+            if (tfs_lookup(pathname, root_dir_inode) != -1) {
+                // another open created it meanwhile: open that one
+                return tfs_open(pathname, mode);
+            }
             return -1; // no space in directory
         }
-
-        offset = 0;
     } else {
         return -1;
     }
 
-    // Finally, add entry to the open file table and return the corresponding
-    // handle
+    // Add entry to the open file table, which keeps the inode from being
+    // deleted (and reused) from now on
+    int fhandle = add_to_open_file_table(inum, 0, mode);
+    if (fhandle == -1) {
+        if (inode_meta_get(inode_get(inum)).links == 0) {
+            // unlinked, or renamed over, since it was looked up: look again
+            return tfs_open(pathname, mode);
+        }
+        return -1;
+    }
+    if (tfs_lookup(pathname, root_dir_inode) != inum) {
+        // the name was moved to another file before the inode was pinned
+        // (which may even have been deleted and reused by another file)
+        tfs_close(fhandle);
+        return tfs_open(pathname, mode);
+    }
 
-    return add_to_open_file_table(inum, offset);
+    // Only now is it known to be the named file: truncate (if requested)
+    inode_t *inode = inode_get(inum);
+    if (mode & TFS_O_TRUNC) {
+        if (wb_enabled()) {
+            wb_drop(inum);
+        }
+        inode_truncate(inode, fhandle);
+    }
+    // Determine initial offset
+    if (mode & (TFS_O_APPEND | TFS_O_APPEND_ATOMIC)) {
+        get_open_file_entry(fhandle)->of_offset = inode_meta_get(inode).size;
+    }
+    return fhandle;
 
     // Note: for simplification, if file was created with TFS_O_CREAT and there
     // is an error adding an entry to the open file table, the file is not
@@ -178,10 +311,13 @@ int tfs_sym_link(char const *target, char const *link_name) {
         return -1; // no space
     }
 
-    inode_soft->i_data_block = data_alloc;
-    void *block = data_block_get(inode_soft->i_data_block);
+    inode_meta_write_begin(inode_soft);
+    inode_soft->i_data_blocks[0] = data_alloc;
+    inode_meta_write_end(inode_soft);
+    void *block = data_block_write_begin(data_alloc);
 
-    memcpy(block, target, strlen(target));
+    memcpy(block, target, strlen(target) + 1);
+    data_block_write_end(data_alloc);
 
     int symlink = add_dir_entry(root_dir_inode, link_name + 1, inum_soft);
     if(symlink == -1){
@@ -210,7 +346,7 @@ int tfs_link(char const *target, char const *link_name) {
     
     /* Create the hard link, while updating the right constants */
 
-    if(target_inode->i_node_type == T_SYMLINK){
+    if(inode_meta_get(target_inode).type == T_SYMLINK){
         return -1;
     }
 
@@ -219,22 +355,100 @@ int tfs_link(char const *target, char const *link_name) {
         return -1;
     }
 
+    inode_meta_write_begin(target_inode);
     target_inode->hardlinks_counter++;
+    inode_meta_write_end(target_inode);
     
     return 0;
 }
 
+/**
+ * Delete a file left without links or handles (see inode_drop_link).
+ */
+static void release_inode(int inumber) {
+    if (wb_enabled()) {
+        wb_drop(inumber);
+    }
+    inode_delete(inumber);
+}
+
 int tfs_close(int fhandle) {
     open_file_entry_t *file = get_open_file_entry(fhandle);
     if (file == NULL) {
         return -1; // invalid fd
     }
 
-    remove_from_open_file_table(fhandle);
+    // Locks taken with tfs_lock_range go away with the handle
+    inode_t *inode = inode_get(file->of_inumber);
+    if (inode != NULL) {
+        range_unlock_all(&inode->i_range_lock, fhandle);
+    }
+
+    int inumber = file->of_inumber;
+    if (remove_from_open_file_table(fhandle)) {
+        release_inode(inumber); // unlinked while open
+    }
 
     return 0;
 }
 
+/**
+ * Write to a file at a given offset, holding the written byte range locked.
+ *
+ * Input:
+ *   - fhandle: file handle doing the write
+ *   - inumber, inode: the file
+ *   - buffer: contents to write
+ *   - to_write: number of bytes
+ *   - offset: where to write
+ *
+ * Returns the number of bytes written (lower than to_write if the maximum file
+ * size is exceeded), or -1 in case of error.
+ */
+static ssize_t write_at(int fhandle, int inumber, inode_t *inode,
+                        void const *buffer, size_t to_write, size_t offset) {
+    if (inode->i_frozen) {
+        return -1; // snapshot files are read-only
+    }
+
+    // Determine how many bytes to write
+    size_t max_size = state_max_file_size();
+    if (offset >= max_size) {
+        to_write = 0;
+    } else if (to_write > max_size - offset) {
+        to_write = max_size - offset;
+    }
+    if (to_write == 0) {
+        return 0;
+    }
+
+    // A write past the tail reserves the bytes up to its end, like an atomic
+    // append, so that the size grows in order with pending appends
+    size_t end = offset + to_write;
+    size_t tail = inode_size_reserve(inode, end);
+
+    range_t range;
+    range_lock(&inode->i_range_lock, &range, fhandle, offset, end);
+
+    // Perform the actual write (possibly buffered by the write-back cache, in
+    // which case blocks are only allocated on flush)
+    ssize_t written;
+    if (wb_enabled()) {
+        written = wb_write(inumber, offset, buffer, to_write);
+    } else {
+        written = inode_write_data(inode, offset, buffer, to_write);
+    }
+
+    range_unlock(&inode->i_range_lock, &range);
+
+    // (after the unlock: earlier appends may still need to write)
+    if (tail < end) {
+        size_t done = written > 0 ? offset + (size_t)written : offset;
+        inode_size_commit(inode, tail, end, done > tail ? done : tail);
+    }
+    return written;
+}
+
 ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
     open_file_entry_t *file = get_open_file_entry(fhandle);
     if (file == NULL) {
@@ -245,40 +459,111 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
     inode_t *inode = inode_get(file->of_inumber);
     ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
 
-    // Determine how many bytes to write
-    size_t block_size = state_block_size();
-    if (to_write + file->of_offset > block_size) {
-        to_write = block_size - file->of_offset;
+    if (file->of_mode & TFS_O_APPEND_ATOMIC) {
+        // Concurrent appenders only synchronize to commit, in order (if out
+        // of space, the unwritten part is given back or left as a gap)
+        size_t start;
+        size_t end = inode_append_reserve(inode, to_write, &start);
+        ssize_t written = 0;
+        if (start != end) {
+            written = write_at(fhandle, file->of_inumber, inode, buffer,
+                               end - start, start);
+        }
+        size_t done = written > 0 ? start + (size_t)written : start;
+        file->of_offset = inode_size_commit(inode, start, end, done);
+        return written;
     }
 
-    if (to_write > 0) {
-        if (inode->i_size == 0) {
-            // If empty file, allocate new block
-            int bnum = data_block_alloc();
-            if (bnum == -1) {
-                return -1; // no space
-            }
+    pthread_rwlock_wrlock(RWLOCK);
+    ssize_t written = write_at(fhandle, file->of_inumber, inode, buffer,
+                               to_write, file->of_offset);
+    if (written > 0) {
+        // The offset associated with the file handle is incremented
+        // accordingly
+        file->of_offset += (size_t)written;
+    }
+    pthread_rwlock_unlock(RWLOCK);
 
-            inode->i_data_block = bnum;
-        }
+    return written;
+}
 
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_write: data block deleted mid-write");
+ssize_t tfs_pwrite(int fhandle, void const *buffer, size_t to_write,
+                   size_t offset) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
 
-        // Perform the actual write
-        
-        pthread_rwlock_wrlock(&rwlock);
-        memcpy(block + file->of_offset, buffer, to_write);
+    inode_t *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_pwrite: inode of open file deleted");
 
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_write;
-        if (file->of_offset > inode->i_size) {
-            inode->i_size = file->of_offset;
-        }
+    // Only the byte range is locked, so writes to disjoint ranges run in
+    // parallel
+    return write_at(fhandle, file->of_inumber, inode, buffer, to_write,
+                    offset);
+}
+
+int tfs_lock_range(int fhandle, size_t offset, size_t len) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL || len > SIZE_MAX - offset) {
+        return -1;
+    }
+
+    inode_t *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_lock_range: inode of open file deleted");
+
+    return range_lock_owned(&inode->i_range_lock, fhandle, offset,
+                            offset + len);
+}
+
+int tfs_unlock_range(int fhandle, size_t offset, size_t len) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL || len > SIZE_MAX - offset) {
+        return -1;
+    }
+
+    inode_t *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL,
+                  "tfs_unlock_range: inode of open file deleted");
+
+    return range_unlock_owned(&inode->i_range_lock, fhandle, offset,
+                              offset + len);
+}
+
+int tfs_fallocate(int fhandle, size_t offset, size_t len) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    inode_t const *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_fallocate: inode of open file deleted");
+    size_t max_size = state_max_file_size();
+    if (inode->i_frozen || offset > max_size || len > max_size - offset) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
     }
-    pthread_rwlock_unlock(&rwlock);
 
-    return (ssize_t)to_write;
+    return inode_preallocate(file->of_inumber, offset, len, fhandle,
+                             wb_enabled() ? wb_flush : NULL);
+}
+
+int tfs_ftruncate(int fhandle, size_t length) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    inode_t const *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "tfs_ftruncate: inode of open file deleted");
+    if (inode->i_frozen || length > state_max_file_size()) {
+        return -1;
+    }
+
+    return inode_resize(file->of_inumber, length, fhandle,
+                        wb_enabled() ? wb_flush : NULL);
 }
 
 ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
@@ -288,31 +573,101 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
     }
 
     // From the open file table entry, we get the inode
-    inode_t const *inode = inode_get(file->of_inumber);
+    inode_t *inode = inode_get(file->of_inumber);
     ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
 
-    // Determine how many bytes to read
-    size_t to_read = inode->i_size - file->of_offset;
-    if (to_read > len) {
-        to_read = len;
-    }
+    // Reads only exclude the handle's writes and seeks: concurrent reads of
+    // the same handle each claim the range they read from its offset
+    pthread_rwlock_rdlock(RWLOCK);
 
-    pthread_rwlock_wrlock(&rwlock);
-    if (to_read > 0) {
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_read: data block deleted mid-read");
+    // Determine how many bytes to read
+    size_t offset = atomic_load(&file->of_offset);
+    size_t claimed;
+    do {
+        size_t size = inode_meta_get(inode).size;
+        claimed = size > offset ? size - offset : 0;
+        if (claimed > len) {
+            claimed = len;
+        }
+    } while (claimed > 0 &&
+             !atomic_compare_exchange_weak(&file->of_offset, &offset,
+                                           offset + claimed));
+
+    size_t to_read = claimed;
+    int read = 0;
+    if (claimed > 0) {
+        // Truncations, which free the blocks, wait for the read; one that
+        // came first may have shrunk the file meanwhile
+        range_t range;
+        range_lock_shared(&inode->i_range_lock, &range, fhandle, offset,
+                          offset + claimed);
+        size_t size = inode_meta_get(inode).size;
+        if (size < offset + to_read) {
+            to_read = size > offset ? size - offset : 0;
+        }
 
         // Perform the actual read
-        
-        memcpy(buffer, block + file->of_offset, to_read);
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_read;
+        if (to_read > 0 && wb_enabled()) {
+            read = wb_read(file->of_inumber, offset, buffer, to_read);
+        } else if (to_read > 0) {
+            read = inode_read_data(inode, offset, buffer, to_read);
+        }
+        range_unlock(&inode->i_range_lock, &range);
+        if (read == -1) {
+            to_read = 0;
+        }
+
+        // Give back what was not read, unless a later read claimed past it
+        size_t end = offset + claimed;
+        if (to_read < claimed) {
+            atomic_compare_exchange_strong(&file->of_offset, &end,
+                                           offset + to_read);
+        }
     }
-    pthread_rwlock_unlock(&rwlock);
+    pthread_rwlock_unlock(RWLOCK);
 
+    if (read == -1) {
+        return -1; // a block failed its checksum
+    }
     return (ssize_t)to_read;
 }
 
+/**
+ * Move the current offset of an open file to the next data or hole (see
+ * inode_seek).
+ */
+static ssize_t seek_to(int fhandle, size_t offset, bool data) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    inode_t const *inode = inode_get(file->of_inumber);
+    ALWAYS_ASSERT(inode != NULL, "seek_to: inode of open file deleted");
+
+    // Buffered writes only get their blocks on flush
+    if (wb_enabled()) {
+        wb_flush(file->of_inumber);
+    }
+
+    pthread_rwlock_wrlock(RWLOCK);
+    ssize_t found = inode_seek(inode, offset, data);
+    if (found != -1) {
+        file->of_offset = (size_t)found;
+    }
+    pthread_rwlock_unlock(RWLOCK);
+
+    return found;
+}
+
+ssize_t tfs_seek_data(int fhandle, size_t offset) {
+    return seek_to(fhandle, offset, true);
+}
+
+ssize_t tfs_seek_hole(int fhandle, size_t offset) {
+    return seek_to(fhandle, offset, false);
+}
+
 int tfs_unlink(char const *target) {
     /* Check is target exiists in TFS */
 
@@ -323,33 +678,140 @@ int tfs_unlink(char const *target) {
     }
     tfs_close(outputFd);
 
-    /* Get the inode that corresponds to target file */
+    /* Verifications and elimination */
 
+    // The entry goes first, so no one finds the inode once it is deleted; the
+    // link dropped is the one of the inode the entry pointed to when it was
+    // cleared (a rename may have replaced it since the check above)
     inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
-    int target_inum = tfs_lookup(target, root_dir_inode);
-    inode_t *inode_target = inode_get(target_inum);
+    int target_inum;
+    int clear_hard = clear_dir_entry(root_dir_inode, target + 1, &target_inum);
+    if(clear_hard == -1){
+        return -1;
+    }
+    if (inode_drop_link(target_inum)) {
+        release_inode(target_inum);
+    }
 
-    /* Verifications and elimination */
+    return 0;
+}
 
-    if(inode_target->hardlinks_counter > 1){
-        int clear_hard = clear_dir_entry(root_dir_inode, target + 1);
-        if(clear_hard == -1){
-            return -1;
-        }
-        inode_target->hardlinks_counter--;
+int tfs_rename(char const *old_name, char const *new_name) {
+    if (!valid_pathname(old_name) || !valid_pathname(new_name)) {
+        return -1;
     }
 
-    else if(inode_target->hardlinks_counter == 1){
-        inode_delete(target_inum);
-        int clear_hard = clear_dir_entry(root_dir_inode, target + 1);
-        if(clear_hard == -1){
-            return -1;
-        }
+    // A single change of the directory: the file is never missing, and a
+    // replaced one is only released after its entry is gone
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    int replaced;
+    if (rename_dir_entry(root_dir_inode, old_name + 1, new_name + 1,
+                         &replaced) == -1) {
+        return -1;
+    }
+    if (replaced != -1 && inode_drop_link(replaced)) {
+        release_inode(replaced);
+    }
+    return 0;
+}
+
+ssize_t tfs_list(tfs_file_info *entries, size_t max) {
+    if (entries == NULL && max > 0) {
+        return -1;
+    }
+
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    ALWAYS_ASSERT(root_dir_inode != NULL,
+                  "tfs_list: root dir inode must exist");
+
+    return list_dir(root_dir_inode, entries, max);
+}
+
+int tfs_clone(char const *source, char const *dest) {
+    if (!valid_pathname(dest)) {
+        return -1;
+    }
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    ALWAYS_ASSERT(root_dir_inode != NULL,
+                  "tfs_clone: root dir inode must exist");
+    if (tfs_lookup(dest, root_dir_inode) != -1) {
+        return -1; // the clone must be a new file
+    }
+
+    // Opening the source follows symbolic links to the actual file
+    int fhandle = tfs_open(source, 0);
+    if (fhandle == -1) {
+        return -1;
+    }
+    int source_inum = get_open_file_entry(fhandle)->of_inumber;
+    tfs_close(fhandle);
+
+    int inum = inode_clone(source_inum, wb_enabled() ? wb_flush : NULL);
+    if (inum == -1) {
+        return -1; // no space in inode table
+    }
+    if (add_dir_entry(root_dir_inode, dest + 1, inum) == -1) {
+        inode_delete(inum);
+        return -1; // no space in directory, or dest was created meanwhile
     }
-    
     return 0;
 }
 
+static void flush_all(void) {
+    if (wb_enabled()) {
+        wb_flush_all();
+    }
+}
+
+int tfs_snapshot(void) { return snapshot_create(flush_all); }
+
+int tfs_snapshot_open(int snapshot, char const *name) {
+    if (!valid_pathname(name)) {
+        return -1;
+    }
+
+    // (the snapshot is kept from being deleted until the file is open)
+    int inum = snapshot_lookup(snapshot, name + 1);
+    if (inum == -1) {
+        return -1;
+    }
+
+    if (inode_verify(inum) == -1) {
+        snapshot_lookup_end();
+        return -1; // the inode failed its checksum
+    }
+
+    // Symbolic links are followed inside the snapshot
+    inode_t *inode = inode_get(inum);
+    inode_meta_t meta = inode_meta_get(inode);
+    if (meta.type == T_SYMLINK) {
+        char target[MAX_FILE_NAME];
+        char const *block = data_block_read_begin(meta.root_block);
+        if (block == NULL) {
+            snapshot_lookup_end();
+            return -1; // the target failed its checksum
+        }
+        strncpy(target, block, MAX_FILE_NAME - 1);
+        target[MAX_FILE_NAME - 1] = '\0';
+        data_block_read_end(meta.root_block);
+        snapshot_lookup_end();
+        return tfs_snapshot_open(snapshot, target);
+    }
+
+    int fhandle = add_to_open_file_table(inum, 0, 0);
+    snapshot_lookup_end();
+    return fhandle;
+}
+
+int tfs_snapshot_delete(int snapshot) { return snapshot_delete(snapshot); }
+
+ssize_t tfs_dedup(void) {
+    if (!dedup_enabled()) {
+        return -1;
+    }
+    return (ssize_t)dedup_pass();
+}
+
 int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
     
     size_t BUFFER_SIZE = 1024;
@@ -400,3 +862,178 @@ int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
 
     return 0;
 }
+
+/*
+ * Explicit instances: each tfs_*_in function runs its tfs_* counterpart with
+ * the given instance as the calling thread's current one (see instance.h).
+ */
+
+int tfs_get_stats_in(tfs_t *fs, tfs_stats *stats) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_get_stats(stats);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_statfs_in(tfs_t *fs, tfs_statfs_info *info) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_statfs(info);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_open_in(tfs_t *fs, char const *name, tfs_file_mode_t mode) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_open(name, mode);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_sym_link_in(tfs_t *fs, char const *target, char const *link_name) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_sym_link(target, link_name);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_link_in(tfs_t *fs, char const *target_file, char const *link_name) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_link(target_file, link_name);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_close_in(tfs_t *fs, int fhandle) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_close(fhandle);
+    instance_leave(outer);
+    return ret;
+}
+
+ssize_t tfs_write_in(tfs_t *fs, int fhandle, void const *buffer, size_t len) {
+    tfs_t *outer = instance_enter(fs);
+    ssize_t ret = tfs_write(fhandle, buffer, len);
+    instance_leave(outer);
+    return ret;
+}
+
+ssize_t tfs_pwrite_in(tfs_t *fs, int fhandle, void const *buffer, size_t len,
+                      size_t offset) {
+    tfs_t *outer = instance_enter(fs);
+    ssize_t ret = tfs_pwrite(fhandle, buffer, len, offset);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_lock_range_in(tfs_t *fs, int fhandle, size_t offset, size_t len) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_lock_range(fhandle, offset, len);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_unlock_range_in(tfs_t *fs, int fhandle, size_t offset, size_t len) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_unlock_range(fhandle, offset, len);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_fallocate_in(tfs_t *fs, int fhandle, size_t offset, size_t len) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_fallocate(fhandle, offset, len);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_ftruncate_in(tfs_t *fs, int fhandle, size_t length) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_ftruncate(fhandle, length);
+    instance_leave(outer);
+    return ret;
+}
+
+ssize_t tfs_read_in(tfs_t *fs, int fhandle, void *buffer, size_t len) {
+    tfs_t *outer = instance_enter(fs);
+    ssize_t ret = tfs_read(fhandle, buffer, len);
+    instance_leave(outer);
+    return ret;
+}
+
+ssize_t tfs_seek_data_in(tfs_t *fs, int fhandle, size_t offset) {
+    tfs_t *outer = instance_enter(fs);
+    ssize_t ret = tfs_seek_data(fhandle, offset);
+    instance_leave(outer);
+    return ret;
+}
+
+ssize_t tfs_seek_hole_in(tfs_t *fs, int fhandle, size_t offset) {
+    tfs_t *outer = instance_enter(fs);
+    ssize_t ret = tfs_seek_hole(fhandle, offset);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_unlink_in(tfs_t *fs, char const *target) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_unlink(target);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_rename_in(tfs_t *fs, char const *old_name, char const *new_name) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_rename(old_name, new_name);
+    instance_leave(outer);
+    return ret;
+}
+
+ssize_t tfs_list_in(tfs_t *fs, tfs_file_info *entries, size_t max) {
+    tfs_t *outer = instance_enter(fs);
+    ssize_t ret = tfs_list(entries, max);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_clone_in(tfs_t *fs, char const *source, char const *dest) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_clone(source, dest);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_snapshot_in(tfs_t *fs) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_snapshot();
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_snapshot_open_in(tfs_t *fs, int snapshot, char const *name) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_snapshot_open(snapshot, name);
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_snapshot_delete_in(tfs_t *fs, int snapshot) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_snapshot_delete(snapshot);
+    instance_leave(outer);
+    return ret;
+}
+
+ssize_t tfs_dedup_in(tfs_t *fs) {
+    tfs_t *outer = instance_enter(fs);
+    ssize_t ret = tfs_dedup();
+    instance_leave(outer);
+    return ret;
+}
+
+int tfs_copy_from_external_fs_in(tfs_t *fs, char const *source_path,
+                                 char const *dest_path) {
+    tfs_t *outer = instance_enter(fs);
+    int ret = tfs_copy_from_external_fs(source_path, dest_path);
+    instance_leave(outer);
+    return ret;
+}
@@ -2,6 +2,8 @@
 #define OPERATIONS_H
 
 #include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 /**
@@ -12,7 +14,57 @@ typedef struct {
     size_t max_block_count;
     size_t max_open_files_count;
 
+    // online growth: the tables above start at the max_*_count sizes and are
+    // grown in place, when full, up to these limits (0 = no growth)
+    size_t inode_count_limit;
+    size_t block_count_limit;
+    size_t open_files_count_limit;
+
     size_t block_size;
+    size_t max_file_blocks; // at most MAX_BLOCKS_PER_FILE
+
+    // write-back mode: buffer writes in memory and allocate blocks on flush
+    bool write_back;
+    size_t max_dirty_bytes;          // flush synchronously above this
+    unsigned int flush_interval_ms; // max age of buffered data
+
+    // small-append coalescing (without write_back): appends shorter than
+    // append_flush_threshold are buffered until that many bytes are pending
+    // or append_flush_deadline_ms elapsed; a threshold of 0 disables it
+    size_t append_flush_threshold;
+    unsigned int append_flush_deadline_ms;
+
+    // compressed storage (needs write_back): file blocks are compressed as
+    // they are written back and packed together; reads decompress into a
+    // cache of compress_cache_blocks blocks
+    bool compress;
+    size_t compress_cache_blocks;
+
+    // block deduplication: identical full blocks of files that are not open
+    // are made to share one block, by a background pass every
+    // dedup_interval_ms (0 = only when tfs_dedup is called)
+    bool dedup;
+    unsigned int dedup_interval_ms;
+
+    // checksums: a CRC32C per data block and per chunk of INODE_CHUNK_SIZE
+    // inodes, verified when read (inodes: when opened); a background scrubber
+    // verifies scrub_blocks_per_sec blocks and inode chunks per second
+    // (0 = no scrubber)
+    bool checksums;
+    size_t scrub_blocks_per_sec;
+
+    // back the data region and the inode table with huge pages (explicit
+    // ones if the system has them reserved, transparent ones otherwise),
+    // falling back to regular pages
+    bool huge_pages;
+
+    // shared volume: keep the FS in the POSIX shared memory object of this
+    // name ("/name"), which other processes can then use at the same time by
+    // initializing with the same name; the first one creates and formats it
+    // (the others get its parameters), the last one to destroy it removes it.
+    // Not with write_back, dedup or append coalescing, whose buffers would be
+    // private to each process, nor huge pages. NULL: private memory
+    char const *shm_name;
 } tfs_params;
 
 /**
@@ -32,6 +84,97 @@ int tfs_init(tfs_params const *params);
  */
 int tfs_destroy();
 
+/**
+ * A TécnicoFS instance. The tfs_* functions act on the default instance, the
+ * one tfs_init sets up; each has a tfs_*_in counterpart (at the end of this
+ * file) that acts on a given instance instead. Instances share no tables,
+ * locks, caches or background threads, so a process can run one per tenant.
+ */
+typedef struct tfs tfs_t;
+
+/**
+ * Create a TécnicoFS instance, optionally with a given configuration.
+ * Returns the instance, or NULL if it could not be initialized.
+ */
+tfs_t *tfs_instance_create(tfs_params const *params);
+
+/**
+ * Destroy an instance created with tfs_instance_create.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_instance_destroy(tfs_t *fs);
+
+/**
+ * TécnicoFS statistics.
+ */
+typedef struct {
+    size_t data_page_size;  // page size backing the data region
+    size_t inode_page_size; // page size backing the inode table
+
+    // current sizes of the (growable) tables
+    size_t inode_capacity;
+    size_t block_capacity;
+    size_t open_file_capacity;
+
+    // compressed storage (see tfs_params.compress): the ratio is
+    // compress_bytes_in / compress_bytes_out
+    size_t compress_bytes_in;  // file data written back
+    size_t compress_bytes_out; // space it took (whole blocks if left raw)
+    uint64_t compress_ns;      // time spent compressing
+    uint64_t decompress_ns;    // time spent decompressing
+    size_t decompress_cache_hits;
+    size_t decompress_cache_misses;
+
+    // checksums (see tfs_params.checksums)
+    size_t checksum_errors; // mismatches found, by reads and by the scrubber
+    size_t scrubbed_blocks; // blocks and inode chunks the scrubber verified
+
+    // shared volumes (see tfs_params.shm_name): locks taken over from
+    // processes that died holding them, and inodes they left mid-change
+    size_t recovered_locks;
+    size_t repaired_inodes;
+} tfs_stats;
+
+/**
+ * Obtain statistics about tecnicofs.
+ *
+ * Input:
+ *   - stats: destination
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_get_stats(tfs_stats *stats);
+
+/**
+ * TécnicoFS space usage. Totals are the current sizes of the tables, which
+ * can grow up to the maximums (see tfs_params.*_limit).
+ */
+typedef struct {
+    size_t block_size;
+
+    size_t blocks;      // data blocks
+    size_t blocks_free; // not in use by any file or directory
+    size_t blocks_max;
+
+    size_t inodes;
+    size_t inodes_free;
+    size_t inodes_max;
+
+    size_t open_files;
+    size_t open_files_free;
+    size_t open_files_max;
+} tfs_statfs_info;
+
+/**
+ * Obtain how full tecnicofs is, in constant time (no tables are scanned).
+ *
+ * Input:
+ *   - info: destination
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_statfs(tfs_statfs_info *info);
+
 /**
  * TécnicoFS file opening modes.
  */
@@ -39,6 +182,7 @@ typedef enum {
     TFS_O_CREAT = 0b001,
     TFS_O_TRUNC = 0b010,
     TFS_O_APPEND = 0b100,
+    TFS_O_APPEND_ATOMIC = 0b1000,
 } tfs_file_mode_t;
 
 /**
@@ -48,6 +192,10 @@ typedef enum {
  *   - name: absolute path name
  *   - mode: can be a combination (with bitwise or) of the following flags:
  *     - append mode (TFS_O_APPEND)
+ *     - atomic append mode (TFS_O_APPEND_ATOMIC): every write is appended at
+ *       the end of the file, without serializing concurrent writers; readers
+ *       only ever see fully written appends. Do not mix it with other writes
+ *       to the same file.
  *     - truncate file contents (TFS_O_TRUNC)
  *     - create file if it does not exist (TFS_O_CREAT)
  *
@@ -100,6 +248,87 @@ int tfs_close(int fhandle);
  */
 ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
 
+/**
+ * Write to an open file at a given offset, without moving the current offset.
+ *
+ * Writes to disjoint byte ranges of the same file run in parallel; writes to
+ * overlapping ranges are serialized.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - buffer: buffer containing the contents to write
+ *   - len: length of the buffer contents (in bytes)
+ *   - offset: file offset to write at
+ *
+ * Returns the number of bytes that were written (can be lower than 'len' if the
+ * maximum file size is exceeded), or -1 in case of error.
+ */
+ssize_t tfs_pwrite(int fhandle, void const *buffer, size_t len, size_t offset);
+
+/**
+ * Lock a byte range of an open file, waiting while another file handle holds
+ * an overlapping range.
+ *
+ * The lock is advisory: it excludes overlapping tfs_lock_range calls and
+ * writes through other file handles, but not those through 'fhandle' itself
+ * (its own locked ranges may overlap, each unlocked on its own).
+ * It is released by tfs_unlock_range or when 'fhandle' is closed.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - offset: start of the range
+ *   - len: length of the range (in bytes), must not be 0
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_lock_range(int fhandle, size_t offset, size_t len);
+
+/**
+ * Unlock a byte range locked with tfs_lock_range (with the same offset and
+ * length).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_unlock_range(int fhandle, size_t offset, size_t len);
+
+/**
+ * Allocate the blocks of a byte range of an open file ahead of writes to it
+ * (as one contiguous run, if possible), so that they cannot fail for lack of
+ * space. The range reads as zeros where nothing was written yet; the file
+ * size does not change, so the blocks can be filled by appends.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - offset: start of the range
+ *   - len: length of the range (in bytes)
+ *
+ * Returns 0 if successful, -1 otherwise (nothing is allocated then).
+ *
+ * Possible errors:
+ *   - The range ends past the maximum file size.
+ *   - Not enough free data blocks.
+ *   - The file is part of a snapshot (read-only).
+ */
+int tfs_fallocate(int fhandle, size_t offset, size_t len);
+
+/**
+ * Set the size of an open file. Shrinking it frees every block past the new
+ * end at once (preallocated ones included); growing it adds a gap that reads
+ * as zeros. The current offsets of file handles are left as they are.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - length: the new size (in bytes)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - 'length' exceeds the maximum file size.
+ *   - Atomic appends (TFS_O_APPEND_ATOMIC) to the file are in progress.
+ *   - The file is part of a snapshot (read-only).
+ */
+int tfs_ftruncate(int fhandle, size_t length);
+
 /**
  * Read from an open file, starting at the current offset.
  *
@@ -113,6 +342,33 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  */
 ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
+/**
+ * Move the current offset of an open file to the start of the next data,
+ * skipping holes (ranges never written, which read as zeros and take no
+ * space), like lseek with SEEK_DATA. Holes are tracked per block.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - offset: where to start looking
+ *
+ * Returns the new offset, or -1 if there is no data from 'offset' to the
+ * end of the file (the offset is then left as is).
+ */
+ssize_t tfs_seek_data(int fhandle, size_t offset);
+
+/**
+ * Move the current offset of an open file to the start of the next hole,
+ * like lseek with SEEK_HOLE; the end of the file counts as a hole.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - offset: where to start looking
+ *
+ * Returns the new offset, or -1 if 'offset' is not within the file (the
+ * offset is then left as is).
+ */
+ssize_t tfs_seek_hole(int fhandle, size_t offset);
+
 /**
  * Delete a link, or a file if the number of hard links reaches 0, that
  * exists in TécnicoFS.
@@ -124,6 +380,105 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
  */
 int tfs_unlink(char const *target);
 
+/**
+ * Rename a file (or link), replacing the file that already has the new name
+ * as tfs_unlink would. The change is atomic: lookups find either the old
+ * name or the new one, and the new name always refers to a file. No data is
+ * copied, and file handles open on the file stay valid.
+ *
+ * Input:
+ *   - old_name: current path name of the file (in TécnicoFS)
+ *   - new_name: path name it gets
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - There is no file named 'old_name'.
+ *   - 'new_name' is not a valid path name.
+ */
+int tfs_rename(char const *old_name, char const *new_name);
+
+/**
+ * File information returned by tfs_list.
+ */
+typedef struct {
+    char name[MAX_FILE_NAME]; // without the leading '/'
+    size_t size;
+} tfs_file_info;
+
+/**
+ * List the files in TécnicoFS, with their sizes.
+ *
+ * Input:
+ *   - entries: destination array
+ *   - max: capacity of 'entries'
+ *
+ * Returns the number of files (only the first 'max' are stored, so a larger
+ * value means 'entries' was too small), or -1 in case of error.
+ */
+ssize_t tfs_list(tfs_file_info *entries, size_t max);
+
+/**
+ * Clone a file: create a new file with the same contents, without copying
+ * them. The clone shares the source's data blocks, and whichever of the two
+ * files changes a shared block first gets its own copy (copy-on-write), so
+ * the files are independent from then on.
+ *
+ * Input:
+ *   - source: absolute path name of the file to clone (symbolic links are
+ *     followed)
+ *   - dest: absolute path name of the clone, which must not exist
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_clone(char const *source, char const *dest);
+
+/**
+ * Take a snapshot of TécnicoFS: a point-in-time view of every file, which
+ * later changes to the files do not affect.
+ *
+ * Only inodes are copied: the snapshot shares its data blocks with the live
+ * files, which copy a block the first time they change it after the
+ * snapshot (copy-on-write).
+ *
+ * Returns the snapshot's number (for tfs_snapshot_open and
+ * tfs_snapshot_delete), or -1 in case of error.
+ */
+int tfs_snapshot(void);
+
+/**
+ * Open a file as it was when a snapshot was taken. The handle is read-only:
+ * writes to it fail.
+ *
+ * Input:
+ *   - snapshot: the snapshot's number
+ *   - name: absolute path name of the file
+ *
+ * Returns the file handle if successful, -1 otherwise.
+ */
+int tfs_snapshot_open(int snapshot, char const *name);
+
+/**
+ * Delete a snapshot, freeing the blocks only it still uses.
+ *
+ * Input:
+ *   - snapshot: the snapshot's number (none of its files may be open)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_snapshot_delete(int snapshot);
+
+/**
+ * Run a deduplication pass now (see tfs_params.dedup): the full blocks of
+ * every file that is not open are fingerprinted, and a block identical to
+ * one already seen is replaced by it. The files then share that block until
+ * one of them changes it (copy-on-write).
+ *
+ * Returns the number of blocks that were replaced, or -1 if deduplication
+ * is not enabled.
+ */
+ssize_t tfs_dedup(void);
+
 /**
  * Copy the contents of a file that exists in the OS' file system tree
  * (outside TécnicoFS) to the TécnicoFS.
@@ -137,4 +492,35 @@ int tfs_unlink(char const *target);
  */
 int tfs_copy_from_external_fs(char const *source_path, char const *dest_path);
 
+/*
+ * Counterparts of the functions above that act on a given instance (see
+ * tfs_t). File handles belong to the instance that opened them.
+ */
+int tfs_get_stats_in(tfs_t *fs, tfs_stats *stats);
+int tfs_statfs_in(tfs_t *fs, tfs_statfs_info *info);
+int tfs_open_in(tfs_t *fs, char const *name, tfs_file_mode_t mode);
+int tfs_sym_link_in(tfs_t *fs, char const *target, char const *link_name);
+int tfs_link_in(tfs_t *fs, char const *target_file, char const *link_name);
+int tfs_close_in(tfs_t *fs, int fhandle);
+ssize_t tfs_write_in(tfs_t *fs, int fhandle, void const *buffer, size_t len);
+ssize_t tfs_pwrite_in(tfs_t *fs, int fhandle, void const *buffer, size_t len,
+                      size_t offset);
+int tfs_lock_range_in(tfs_t *fs, int fhandle, size_t offset, size_t len);
+int tfs_unlock_range_in(tfs_t *fs, int fhandle, size_t offset, size_t len);
+int tfs_fallocate_in(tfs_t *fs, int fhandle, size_t offset, size_t len);
+int tfs_ftruncate_in(tfs_t *fs, int fhandle, size_t length);
+ssize_t tfs_read_in(tfs_t *fs, int fhandle, void *buffer, size_t len);
+ssize_t tfs_seek_data_in(tfs_t *fs, int fhandle, size_t offset);
+ssize_t tfs_seek_hole_in(tfs_t *fs, int fhandle, size_t offset);
+int tfs_unlink_in(tfs_t *fs, char const *target);
+int tfs_rename_in(tfs_t *fs, char const *old_name, char const *new_name);
+ssize_t tfs_list_in(tfs_t *fs, tfs_file_info *entries, size_t max);
+int tfs_clone_in(tfs_t *fs, char const *source, char const *dest);
+int tfs_snapshot_in(tfs_t *fs);
+int tfs_snapshot_open_in(tfs_t *fs, int snapshot, char const *name);
+int tfs_snapshot_delete_in(tfs_t *fs, int snapshot);
+ssize_t tfs_dedup_in(tfs_t *fs);
+int tfs_copy_from_external_fs_in(tfs_t *fs, char const *source_path,
+                                 char const *dest_path);
+
 #endif // OPERATIONS_H
@@ -0,0 +1,220 @@
+#include "rangelock.h"
+#include "betterassert.h"
+#include "shm.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Byte-range locks.
+ *
+ * Each file keeps the ranges currently held in a short list; a new range
+ * waits only while it overlaps one of them, so writes to disjoint parts of a
+ * file proceed in parallel. Ranges taken by writes exclude each other, as do
+ * ranges taken with tfs_lock_range through different handles, but a write
+ * through a file handle is not blocked by a range that same handle locked
+ * explicitly, nor is another tfs_lock_range of that handle. Reads take shared
+ * ranges, which only exclude writes (including truncations, which free the
+ * blocks under them).
+ *
+ * In a shared volume the lists are read by other processes, so ranges are
+ * kept in the volume (see shm_malloc) rather than in the caller's memory.
+ */
+
+void range_lock_init(range_lock_t *rl) {
+    shm_mutex_init(&rl->lock);
+    shm_cond_init(&rl->released);
+    rl->held = NULL;
+}
+
+/**
+ * Release the resources of a range lock, including ranges still held with
+ * range_lock_owned.
+ */
+void range_lock_destroy(range_lock_t *rl) {
+    while (rl->held != NULL) {
+        range_t *range = rl->held;
+        rl->held = range->next;
+        ALWAYS_ASSERT(!range->internal,
+                      "range_lock_destroy: range still locked by a write");
+        shm_free(range);
+    }
+    pthread_mutex_destroy(&rl->lock);
+    pthread_cond_destroy(&rl->released);
+}
+
+static bool conflicts(range_t const *a, range_t const *b) {
+    if (a->start >= b->end || b->start >= a->end) {
+        return false; // disjoint
+    }
+    if (a->shared || b->shared) {
+        return a->internal && b->internal && !(a->shared && b->shared);
+    }
+    // a handle's writes go through the ranges it locked itself, and its own
+    // explicit ranges may overlap (only its writes exclude each other)
+    return a->owner != b->owner || (a->internal && b->internal);
+}
+
+static bool can_lock(range_lock_t const *rl, range_t const *range) {
+    for (range_t const *held = rl->held; held != NULL; held = held->next) {
+        if (conflicts(held, range)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Wait until [range->start, range->end) can be locked, and lock it.
+ * Must be called with rl->lock held.
+ */
+static void lock_locked(range_lock_t *rl, range_t *range) {
+    while (!can_lock(rl, range)) {
+        shm_cond_wait(&rl->released, &rl->lock);
+    }
+    range->next = rl->held;
+    rl->held = range;
+}
+
+static void lock_internal(range_lock_t *rl, range_t *range, int owner,
+                          size_t start, size_t end, bool shared) {
+    range->start = start;
+    range->end = end;
+    range->owner = owner;
+    range->internal = true;
+    range->shared = shared;
+    range->node = range;
+    if (shm_enabled()) {
+        // (if the volume has no room left, waits for ranges to be released)
+        struct timespec wait = {.tv_sec = 0, .tv_nsec = 1000 * 1000};
+        while ((range->node = shm_malloc(sizeof(range_t))) == NULL) {
+            nanosleep(&wait, NULL);
+        }
+        *range->node = *range;
+    }
+
+    shm_mutex_lock(&rl->lock);
+    lock_locked(rl, range->node);
+    pthread_mutex_unlock(&rl->lock);
+}
+
+/**
+ * Lock a byte range for a write.
+ *
+ * Input:
+ *   - rl: the file's range lock
+ *   - range: storage for the range, valid until range_unlock
+ *   - owner: file handle doing the write
+ *   - start, end: the range [start, end)
+ */
+void range_lock(range_lock_t *rl, range_t *range, int owner, size_t start,
+                size_t end) {
+    lock_internal(rl, range, owner, start, end, false);
+}
+
+/**
+ * Lock a byte range for a read: it waits for the writes to the range, but
+ * not for other reads nor for ranges locked with tfs_lock_range.
+ *
+ * Input: as for range_lock, with owner the file handle doing the read.
+ */
+void range_lock_shared(range_lock_t *rl, range_t *range, int owner,
+                       size_t start, size_t end) {
+    lock_internal(rl, range, owner, start, end, true);
+}
+
+/**
+ * Unlink a held range and wake up the waiters.
+ * Must be called with rl->lock held.
+ */
+static void unlock_locked(range_lock_t *rl, range_t *range) {
+    range_t **link = &rl->held;
+    while (*link != range) {
+        ALWAYS_ASSERT(*link != NULL, "unlock_locked: range is not locked");
+        link = &(*link)->next;
+    }
+    *link = range->next;
+    pthread_cond_broadcast(&rl->released);
+}
+
+/**
+ * Unlock a range locked with range_lock.
+ */
+void range_unlock(range_lock_t *rl, range_t *range) {
+    shm_mutex_lock(&rl->lock);
+    unlock_locked(rl, range->node);
+    pthread_mutex_unlock(&rl->lock);
+    if (range->node != range) {
+        shm_free(range->node);
+    }
+}
+
+/**
+ * Lock a byte range on behalf of a file handle (see tfs_lock_range).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Empty range.
+ *   - malloc failure.
+ */
+int range_lock_owned(range_lock_t *rl, int owner, size_t start, size_t end) {
+    if (start >= end) {
+        return -1;
+    }
+
+    range_t *range = shm_malloc(sizeof(range_t));
+    if (range == NULL) {
+        return -1;
+    }
+    range->start = start;
+    range->end = end;
+    range->owner = owner;
+    range->internal = false;
+    range->shared = false;
+
+    shm_mutex_lock(&rl->lock);
+    lock_locked(rl, range);
+    pthread_mutex_unlock(&rl->lock);
+    return 0;
+}
+
+/**
+ * Unlock a byte range locked by range_lock_owned.
+ *
+ * Returns 0 if successful, -1 if the handle holds no such range.
+ */
+int range_unlock_owned(range_lock_t *rl, int owner, size_t start, size_t end) {
+    shm_mutex_lock(&rl->lock);
+    for (range_t *range = rl->held; range != NULL; range = range->next) {
+        if (!range->internal && range->owner == owner &&
+            range->start == start && range->end == end) {
+            unlock_locked(rl, range);
+            pthread_mutex_unlock(&rl->lock);
+            shm_free(range);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&rl->lock);
+    return -1;
+}
+
+/**
+ * Unlock every range a file handle locked with range_lock_owned (the handle
+ * is being closed).
+ */
+void range_unlock_all(range_lock_t *rl, int owner) {
+    shm_mutex_lock(&rl->lock);
+    range_t **link = &rl->held;
+    while (*link != NULL) {
+        range_t *range = *link;
+        if (!range->internal && range->owner == owner) {
+            *link = range->next;
+            shm_free(range);
+        } else {
+            link = &range->next;
+        }
+    }
+    pthread_cond_broadcast(&rl->released);
+    pthread_mutex_unlock(&rl->lock);
+}
@@ -0,0 +1,43 @@
+#ifndef RANGELOCK_H
+#define RANGELOCK_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A locked byte range [start, end).
+ */
+typedef struct range {
+    size_t start;
+    size_t end;
+    int owner;     // file handle that took the lock
+    bool internal; // taken by a write (as opposed to tfs_lock_range)
+    bool shared;   // taken by a read (internal too)
+    struct range *next;
+    struct range *node; // the one in the list in place of this one, if any
+} range_t;
+
+/**
+ * Byte-range lock: the set of ranges currently held on one file.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    range_t *held;
+} range_lock_t;
+
+void range_lock_init(range_lock_t *rl);
+void range_lock_destroy(range_lock_t *rl);
+
+void range_lock(range_lock_t *rl, range_t *range, int owner, size_t start,
+                size_t end);
+void range_lock_shared(range_lock_t *rl, range_t *range, int owner,
+                       size_t start, size_t end);
+void range_unlock(range_lock_t *rl, range_t *range);
+
+int range_lock_owned(range_lock_t *rl, int owner, size_t start, size_t end);
+int range_unlock_owned(range_lock_t *rl, int owner, size_t start, size_t end);
+void range_unlock_all(range_lock_t *rl, int owner);
+
+#endif // RANGELOCK_H
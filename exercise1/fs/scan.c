@@ -0,0 +1,101 @@
+#include "scan.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+/*
+ * Search of a dense array of 32-bit values (directory name hashes), with
+ * SSE2/AVX2 versions picked at run time according to the CPU.
+ */
+
+typedef size_t (*scan_fn)(uint32_t const *, size_t, uint32_t, size_t);
+
+static size_t scan_scalar(uint32_t const *values, size_t count, uint32_t key,
+                          size_t from) {
+    for (size_t i = from; i < count; i++) {
+        if (values[i] == key) {
+            return i;
+        }
+    }
+    return count;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2"))) static size_t
+scan_sse2(uint32_t const *values, size_t count, uint32_t key, size_t from) {
+    __m128i needle = _mm_set1_epi32((int)key);
+    size_t i = from;
+    for (; i + 4 <= count; i += 4) {
+        __m128i chunk = _mm_loadu_si128((__m128i const *)(values + i));
+        int mask = _mm_movemask_ps(
+            _mm_castsi128_ps(_mm_cmpeq_epi32(chunk, needle)));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz((unsigned int)mask);
+        }
+    }
+    return scan_scalar(values, count, key, i);
+}
+
+__attribute__((target("avx2"))) static size_t
+scan_avx2(uint32_t const *values, size_t count, uint32_t key, size_t from) {
+    __m256i needle = _mm256_set1_epi32((int)key);
+    size_t i = from;
+    for (; i + 8 <= count; i += 8) {
+        __m256i chunk = _mm256_loadu_si256((__m256i const *)(values + i));
+        int mask = _mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(chunk, needle)));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz((unsigned int)mask);
+        }
+    }
+    return scan_sse2(values, count, key, i);
+}
+#endif
+
+static scan_fn scan_impl = scan_scalar;
+static char const *scan_name = "scalar";
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+static void scan_select(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan_impl = scan_avx2;
+        scan_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        scan_impl = scan_sse2;
+        scan_name = "sse2";
+    }
+#endif
+}
+
+/**
+ * Pick the fastest implementation the CPU supports. Safe to call repeatedly.
+ */
+void scan_init(void) { pthread_once(&scan_once, scan_select); }
+
+/**
+ * Name of the implementation in use ("avx2", "sse2" or "scalar").
+ */
+char const *scan_impl_name(void) { return scan_name; }
+
+/**
+ * Find the first occurrence of a value in an array.
+ *
+ * Input:
+ *   - values: the array
+ *   - count: number of values
+ *   - key: value to look for
+ *   - from: index to start at
+ *
+ * Returns the index of the first value equal to key at or after from, or
+ * count if there is none.
+ */
+size_t scan_u32(uint32_t const *values, size_t count, uint32_t key,
+                size_t from) {
+    return scan_impl(values, count, key, from);
+}
@@ -0,0 +1,13 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void scan_init(void);
+char const *scan_impl_name(void);
+
+size_t scan_u32(uint32_t const *values, size_t count, uint32_t key,
+                size_t from);
+
+#endif // SCAN_H
@@ -0,0 +1,165 @@
+#include "scrub.h"
+#include "config.h"
+#include "instance.h"
+#include "state.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Background scrubber.
+ *
+ * Corruption in blocks that are not read would otherwise go unnoticed, so a
+ * thread goes over the data blocks and the inode table chunks in turn,
+ * verifying their checksums (see data_block_verify and inode_verify). It
+ * wakes up every SCRUB_INTERVAL_MS and verifies a batch sized to keep to
+ * scrub_blocks_per_sec, so it takes a bounded share of the storage
+ * bandwidth. Mismatches are counted in tfs_stats.checksum_errors.
+ */
+
+// Scrubber of an instance (see instance.h), if enabled
+struct scrub {
+    size_t batch; // blocks (or inode chunks) per wake-up
+    size_t next_block;
+    size_t next_chunk;
+    atomic_size_t scrubbed;
+
+    pthread_t scrubber;
+    pthread_mutex_t scrubber_lock;
+    pthread_cond_t scrubber_cond;
+    bool scrubber_stop;
+};
+
+#define SCRUB (tfs_current->scrub)
+
+/**
+ * Verify the next batch, carrying on from where the previous one stopped.
+ */
+static void scrub_batch(void) {
+    struct scrub *sc = SCRUB;
+    tfs_statfs_info info;
+    if (state_statfs(&info) != 0) {
+        return;
+    }
+    size_t chunks = (info.inodes + INODE_CHUNK_SIZE - 1) / INODE_CHUNK_SIZE;
+
+    for (size_t n = 0; n < sc->batch; n++) {
+        // blocks first, then inode chunks, then over again
+        if (sc->next_block < info.blocks) {
+            data_block_verify((int)sc->next_block++);
+        } else if (sc->next_chunk < chunks) {
+            inode_verify((int)(sc->next_chunk++ * INODE_CHUNK_SIZE));
+        } else {
+            sc->next_block = sc->next_chunk = 0;
+            continue;
+        }
+        atomic_fetch_add(&sc->scrubbed, 1);
+    }
+}
+
+/**
+ * Background scrubber: verifies a batch every SCRUB_INTERVAL_MS.
+ */
+static void *scrub_worker(void *arg) {
+    instance_enter(arg); // the instance that started it
+    struct scrub *sc = SCRUB;
+
+    pthread_mutex_lock(&sc->scrubber_lock);
+    while (!sc->scrubber_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += (long)SCRUB_INTERVAL_MS * 1000000L;
+        while (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&sc->scrubber_cond, &sc->scrubber_lock,
+                               &deadline);
+        if (sc->scrubber_stop) {
+            break;
+        }
+
+        pthread_mutex_unlock(&sc->scrubber_lock);
+        scrub_batch();
+        pthread_mutex_lock(&sc->scrubber_lock);
+    }
+    pthread_mutex_unlock(&sc->scrubber_lock);
+
+    return NULL;
+}
+
+/**
+ * Start the scrubber (a no-op unless params->checksums is set and
+ * params->scrub_blocks_per_sec is not 0).
+ *
+ * Input:
+ *   - params: TécnicoFS parameters
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - thread creation failure.
+ */
+int scrub_init(tfs_params const *params) {
+    if (!params->checksums || params->scrub_blocks_per_sec == 0) {
+        return 0;
+    }
+
+    struct scrub *sc = calloc(1, sizeof(struct scrub));
+    if (sc == NULL) {
+        return -1;
+    }
+    sc->batch = params->scrub_blocks_per_sec * SCRUB_INTERVAL_MS / 1000;
+    if (sc->batch == 0) {
+        sc->batch = 1;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sc->scrubber_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&sc->scrubber_lock, NULL);
+
+    SCRUB = sc;
+    sc->scrubber_stop = false;
+    if (pthread_create(&sc->scrubber, NULL, scrub_worker, tfs_current) != 0) {
+        SCRUB = NULL;
+        pthread_cond_destroy(&sc->scrubber_cond);
+        pthread_mutex_destroy(&sc->scrubber_lock);
+        free(sc);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stop the scrubber.
+ */
+void scrub_destroy(void) {
+    struct scrub *sc = SCRUB;
+    if (sc == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&sc->scrubber_lock);
+    sc->scrubber_stop = true;
+    pthread_cond_signal(&sc->scrubber_cond);
+    pthread_mutex_unlock(&sc->scrubber_lock);
+    pthread_join(sc->scrubber, NULL);
+
+    pthread_cond_destroy(&sc->scrubber_cond);
+    pthread_mutex_destroy(&sc->scrubber_lock);
+    free(sc);
+    SCRUB = NULL;
+}
+
+void scrub_get_stats(tfs_stats *stats) {
+    struct scrub *sc = SCRUB;
+    stats->scrubbed_blocks = sc == NULL ? 0 : atomic_load(&sc->scrubbed);
+}
@@ -0,0 +1,10 @@
+#ifndef SCRUB_H
+#define SCRUB_H
+
+#include "operations.h"
+
+int scrub_init(tfs_params const *params);
+void scrub_destroy(void);
+void scrub_get_stats(tfs_stats *stats);
+
+#endif // SCRUB_H
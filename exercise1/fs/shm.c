@@ -0,0 +1,403 @@
+#define _DEFAULT_SOURCE // MAP_NORESERVE, MAP_FIXED_NOREPLACE
+
+#include "shm.h"
+#include "betterassert.h"
+#include "config.h"
+#include "instance.h"
+
+#include <fcntl.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Shared volumes.
+ *
+ * With tfs_params.shm_name set, the FS state lives in a POSIX shared memory
+ * object that every process using the volume maps at the same address, so
+ * the pointers inside it are valid in all of them. The first process creates
+ * and formats it; the others find it ready and attach.
+ *
+ * The segment starts with a header, followed by an arena that the state
+ * allocates its tables and its objects from (shm_malloc). Large allocations
+ * are carved off the end of the arena and never reused; small ones are
+ * rounded up to a power of two and go back to a free list of their size
+ * when freed. A fresh arena is zero-filled, and only backed by memory where
+ * it is written.
+ *
+ * Locks in the segment are process-shared, and mutexes are robust: when a
+ * process dies holding one, the next one to lock it takes it over (see
+ * shm_recover). Read-write locks have no such recovery.
+ */
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0 // only a hint then (see attach)
+#endif
+
+#define SHM_MAGIC (UINT64_C(0x7466737368766f6c)) // "tfsshvol"
+
+// Size classes: 64 << c bytes, headers included
+#define SHM_CLASSES (16)
+
+/**
+ * Header of every arena allocation, just before the memory handed out.
+ */
+typedef struct shm_block {
+    alignas(CACHE_LINE_SIZE) size_t class; // SHM_CLASSES if never reused
+    struct shm_block *next;                // in its free list, when free
+} shm_block_t;
+
+typedef struct {
+    _Atomic uint64_t magic; // set once the volume is formatted
+    uintptr_t base;         // where every process maps the segment
+    size_t size;
+
+    pthread_mutex_t lock; // protects the fields below
+    size_t attached;      // processes using the volume
+    size_t next;          // offset of the free part of the arena
+    shm_block_t *free[SHM_CLASSES];
+
+    void *root; // the FS state
+    atomic_size_t recovered_locks;
+} shm_header_t;
+
+// Shared volume of an instance (see instance.h), if any
+struct shm {
+    shm_header_t *header; // at the start of the mapping
+    char *name;
+};
+
+#define SHM (tfs_current->shm)
+
+static size_t round_up(size_t size, size_t unit) {
+    return (size + unit - 1) / unit * unit;
+}
+
+/**
+ * Size class of an allocation of 'total' bytes (header included), or
+ * SHM_CLASSES if it is too large for any.
+ */
+static size_t size_class(size_t total) {
+    size_t c = 0;
+    while (c < SHM_CLASSES && ((size_t)CACHE_LINE_SIZE << c) < total) {
+        c++;
+    }
+    return c;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec wait = {.tv_sec = 0, .tv_nsec = ms * 1000 * 1000};
+    nanosleep(&wait, NULL);
+}
+
+/**
+ * Map an existing volume, once its creator has formatted it.
+ *
+ * Returns the header, or NULL if the volume did not become ready within
+ * SHM_ATTACH_TIMEOUT_MS or could not be mapped at its address.
+ */
+static shm_header_t *attach(int fd) {
+    shm_header_t const *peek = NULL;
+    for (int waited = 0; waited < SHM_ATTACH_TIMEOUT_MS; waited++) {
+        struct stat info;
+        if (peek == NULL && fstat(fd, &info) == 0 &&
+            (size_t)info.st_size >= sizeof(shm_header_t)) {
+            void *map = mmap(NULL, sizeof(shm_header_t), PROT_READ,
+                             MAP_SHARED, fd, 0);
+            peek = map == MAP_FAILED ? NULL : map;
+        }
+        if (peek != NULL && atomic_load(&peek->magic) == SHM_MAGIC) {
+            break;
+        }
+        sleep_ms(1);
+    }
+    if (peek == NULL || atomic_load(&peek->magic) != SHM_MAGIC) {
+        if (peek != NULL) {
+            munmap((void *)peek, sizeof(shm_header_t));
+        }
+        return NULL; // not ready (its creator may have died)
+    }
+    void *base = (void *)peek->base;
+    size_t size = peek->size;
+    munmap((void *)peek, sizeof(shm_header_t));
+
+    void *map = mmap(base, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_NORESERVE | MAP_FIXED_NOREPLACE, fd, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    if (map != base) {
+        munmap(map, size);
+        return NULL; // the address is taken in this process
+    }
+
+    shm_header_t *header = map;
+    shm_mutex_lock(&header->lock);
+    header->attached++;
+    pthread_mutex_unlock(&header->lock);
+    return header;
+}
+
+/**
+ * Create a volume of 'size' bytes, unformatted.
+ *
+ * Returns the header, or NULL on failure.
+ */
+static shm_header_t *create(int fd, size_t size) {
+    size = round_up(sizeof(shm_header_t), CACHE_LINE_SIZE) + size;
+    if (ftruncate(fd, (off_t)size) == -1) {
+        return NULL;
+    }
+    void *map = mmap((void *)(uintptr_t)SHM_ADDRESS_HINT, size,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd,
+                     0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    shm_header_t *header = map;
+    header->base = (uintptr_t)map;
+    header->size = size;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    header->attached = 1;
+    header->next = round_up(sizeof(shm_header_t), CACHE_LINE_SIZE);
+    return header;
+}
+
+/**
+ * Create a shared volume, or attach to an existing one.
+ *
+ * Input:
+ *   - name: POSIX shared memory object name ("/name")
+ *   - size: arena size, if creating it
+ *
+ * Returns 1 if the volume was created (and must be formatted, then marked
+ * ready with shm_ready), 0 if it was attached, -1 otherwise.
+ *
+ * Possible errors:
+ *   - The object could not be created or opened.
+ *   - An existing volume was not ready in time, or its address is taken in
+ *     this process.
+ *   - malloc failure.
+ */
+int shm_init(char const *name, size_t size) {
+    struct shm *shm = calloc(1, sizeof(struct shm));
+    char *copy = malloc(strlen(name) + 1);
+    if (shm == NULL || copy == NULL) {
+        free(shm);
+        free(copy);
+        return -1;
+    }
+    strcpy(copy, name);
+    shm->name = copy;
+
+    int created = 1;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1 && errno == EEXIST) {
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0);
+    }
+    if (fd != -1) {
+        shm->header = created ? create(fd, size) : attach(fd);
+        close(fd); // the mapping stays
+    }
+    if (shm->header == NULL) {
+        if (fd != -1 && created) {
+            shm_unlink(name);
+        }
+        free(shm->name);
+        free(shm);
+        return -1;
+    }
+
+    SHM = shm;
+    return created;
+}
+
+/**
+ * Let other processes attach to a volume this one created and formatted.
+ */
+void shm_ready(void) {
+    struct shm *shm = SHM;
+    if (shm != NULL) {
+        atomic_store(&shm->header->magic, SHM_MAGIC);
+    }
+}
+
+/**
+ * Detach from the volume. The last process to do so removes it.
+ */
+void shm_destroy(void) {
+    struct shm *shm = SHM;
+    if (shm == NULL) {
+        return;
+    }
+    shm_header_t *header = shm->header;
+    shm_mutex_lock(&header->lock);
+    bool last = --header->attached == 0;
+    pthread_mutex_unlock(&header->lock);
+    if (last) {
+        shm_unlink(shm->name);
+    }
+    munmap(header, header->size);
+    free(shm->name);
+    free(shm);
+    SHM = NULL;
+}
+
+bool shm_enabled(void) { return SHM != NULL; }
+
+/**
+ * The object the creator registered with shm_set_root (the FS state).
+ */
+void *shm_root(void) { return SHM->header->root; }
+
+void shm_set_root(void *root) { SHM->header->root = root; }
+
+/**
+ * Arena space taken by an allocation of 'size' bytes, for sizing volumes.
+ */
+size_t shm_footprint(size_t size) {
+    size_t total = sizeof(shm_block_t) + size;
+    size_t c = size_class(total);
+    return c < SHM_CLASSES ? (size_t)CACHE_LINE_SIZE << c
+                           : round_up(total, CACHE_LINE_SIZE);
+}
+
+/**
+ * Allocate memory aligned to CACHE_LINE_SIZE: from the arena of the shared
+ * volume, if any, and with aligned_alloc otherwise.
+ *
+ * Memory that was never allocated before is zero-filled; reused memory is
+ * not.
+ *
+ * Returns the memory, or NULL if there is not enough.
+ */
+void *shm_malloc(size_t size) {
+    struct shm *shm = SHM;
+    if (shm == NULL) {
+        return aligned_alloc(CACHE_LINE_SIZE, round_up(size, CACHE_LINE_SIZE));
+    }
+
+    shm_header_t *header = shm->header;
+    size_t c = size_class(sizeof(shm_block_t) + size);
+    size_t footprint = shm_footprint(size);
+    shm_block_t *block = NULL;
+
+    shm_mutex_lock(&header->lock);
+    if (c < SHM_CLASSES && header->free[c] != NULL) {
+        block = header->free[c];
+        header->free[c] = block->next;
+    } else if (header->next + footprint <= header->size) {
+        block = (shm_block_t *)((char *)header + header->next);
+        header->next += footprint;
+        block->class = c;
+    }
+    pthread_mutex_unlock(&header->lock);
+
+    return block == NULL ? NULL : block + 1;
+}
+
+/**
+ * Free memory allocated with shm_malloc (large allocations in a shared
+ * volume are not reused).
+ */
+void shm_free(void *ptr) {
+    struct shm *shm = SHM;
+    if (shm == NULL || ptr == NULL) {
+        free(ptr);
+        return;
+    }
+
+    shm_header_t *header = shm->header;
+    shm_block_t *block = (shm_block_t *)ptr - 1;
+    if (block->class == SHM_CLASSES) {
+        return;
+    }
+    shm_mutex_lock(&header->lock);
+    block->next = header->free[block->class];
+    header->free[block->class] = block;
+    pthread_mutex_unlock(&header->lock);
+}
+
+/**
+ * Initialize a mutex: process-shared and robust in a shared volume, with the
+ * default attributes otherwise.
+ */
+void shm_mutex_init(pthread_mutex_t *mutex) {
+    if (!shm_enabled()) {
+        pthread_mutex_init(mutex, NULL);
+        return;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/**
+ * Initialize a condition variable, process-shared in a shared volume.
+ */
+void shm_cond_init(pthread_cond_t *cond) {
+    if (!shm_enabled()) {
+        pthread_cond_init(cond, NULL);
+        return;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * Initialize a read-write lock, process-shared in a shared volume.
+ */
+void shm_rwlock_init(pthread_rwlock_t *rwlock) {
+    if (!shm_enabled()) {
+        pthread_rwlock_init(rwlock, NULL);
+        return;
+    }
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_rwlock_init(rwlock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+/**
+ * Take over a mutex whose owner died holding it (pthread_mutex_lock returned
+ * EOWNERDEAD, and the caller now holds it).
+ *
+ * What the mutex protects is left as the dead process left it. Callers whose
+ * structures can be left unusable repair them after this (an inode's
+ * metadata sequence, see inode_commit_recover); elsewhere, at worst an entry
+ * or a block stays taken by no one. Read-write locks are not robust: a
+ * process that dies holding one still blocks the others.
+ */
+void shm_recover(pthread_mutex_t *mutex) {
+    ALWAYS_ASSERT(pthread_mutex_consistent(mutex) == 0,
+                  "shm_recover: mutex cannot be recovered");
+    struct shm *shm = SHM;
+    if (shm != NULL) {
+        atomic_fetch_add(&shm->header->recovered_locks, 1);
+    }
+}
+
+size_t shm_recovered_locks(void) {
+    struct shm *shm = SHM;
+    return shm == NULL ? 0 : atomic_load(&shm->header->recovered_locks);
+}
@@ -0,0 +1,48 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+int shm_init(char const *name, size_t size);
+void shm_ready(void);
+void shm_destroy(void);
+bool shm_enabled(void);
+
+void *shm_root(void);
+void shm_set_root(void *root);
+
+size_t shm_footprint(size_t size);
+void *shm_malloc(size_t size);
+void shm_free(void *ptr);
+
+void shm_mutex_init(pthread_mutex_t *mutex);
+void shm_cond_init(pthread_cond_t *cond);
+void shm_rwlock_init(pthread_rwlock_t *rwlock);
+void shm_recover(pthread_mutex_t *mutex);
+size_t shm_recovered_locks(void);
+
+/**
+ * Lock a mutex initialized with shm_mutex_init, taking it over if its owner
+ * died holding it (see shm_recover).
+ */
+static inline void shm_mutex_lock(pthread_mutex_t *mutex) {
+    if (pthread_mutex_lock(mutex) == EOWNERDEAD) {
+        shm_recover(mutex);
+    }
+}
+
+/**
+ * Wait on a condition variable, like pthread_cond_wait, with a mutex
+ * initialized with shm_mutex_init.
+ */
+static inline void shm_cond_wait(pthread_cond_t *cond,
+                                 pthread_mutex_t *mutex) {
+    if (pthread_cond_wait(cond, mutex) == EOWNERDEAD) {
+        shm_recover(mutex);
+    }
+}
+
+#endif // SHM_H
@@ -1,57 +1,138 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
 #include "state.h"
 #include "betterassert.h"
+#include "compress.h"
+#include "crc32c.h"
+#include "instance.h"
+#include "scan.h"
+#include "shm.h"
 
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <pthread.h>
 
-pthread_rwlock_t rwlock_a = PTHREAD_RWLOCK_INITIALIZER; // for inodes
-pthread_rwlock_t rwlock_b = PTHREAD_RWLOCK_INITIALIZER; // for data blocks
-
-/*
- * Persistent FS state
- * (in reality, it should be maintained in secondary memory;
- * for simplicity, this project maintains it in primary memory).
- */
-static tfs_params fs_params;
-
-// Inode table
-static inode_t *inode_table;
-static allocation_state_t *freeinode_ts;
-
-// Data blocks
-static char *fs_data; // # blocks * block size
-static allocation_state_t *free_blocks;
-
 /*
- * Volatile FS state
+ * FS state of an instance (see instance.h). The functions below act on the
+ * calling thread's current instance, through a local st = STATE.
+ *
+ * In a shared volume (tfs_params.shm_name), the state and its tables live in
+ * shared memory instead (see shm.c), and every process using the volume
+ * sees the same ones.
  */
-static open_file_entry_t *open_file_table;
-static allocation_state_t *free_open_file_entries;
+struct state {
+    pthread_rwlock_t rwlock_a; // open file table
+    pthread_rwlock_t rwlock_b; // directory entries
+
+    /*
+     * Persistent FS state
+     * (in reality, it should be maintained in secondary memory;
+     * for simplicity, this project maintains it in primary memory).
+     */
+    tfs_params fs_params;
+
+    // Inode table
+    inode_t *inode_table;
+    allocation_state_t *freeinode_ts;
+
+    // Metadata columns: copies of each inode's type, size and link count in
+    // dense arrays (indexed by inumber), so that scans over every inode read
+    // one or two arrays instead of whole inodes. Updated together with the
+    // metadata sequence lock; a scan sees each value as of some recent write.
+    inode_type *inode_types;
+    size_t *inode_sizes;
+    int *inode_links;
+
+    // Data blocks
+    char *fs_data; // # blocks * block size
+
+    // Mapped sizes of the tables that may be backed by huge pages
+    size_t inode_table_mapped;
+    size_t fs_data_mapped;
+    allocation_state_t *free_blocks;
+    // owners of each block besides the first (snapshots and clones share
+    // blocks with the live files until either side changes them)
+    atomic_uint *block_shares;
+    pthread_mutex_t block_map_lock;
+
+    // Checksums (tfs_params.checksums): CRC32C of each data block and of each
+    // chunk of INODE_CHUNK_SIZE inodes, with CHECKSUM_VALID set once computed
+    // (blocks lose it when freed)
+    _Atomic uint64_t *block_checksums;
+    _Atomic uint64_t *inode_checksums;
+    // writers of a block (or inode chunk) and the ones verifying it take the
+    // lock of its stripe
+    pthread_mutex_t block_locks[CHECKSUM_LOCK_STRIPES];
+    pthread_mutex_t chunk_locks[CHECKSUM_LOCK_STRIPES];
+    atomic_size_t checksum_errors;
+    // inodes left mid-change by a process that died (see inode_commit_recover)
+    atomic_size_t repaired_inodes;
+
+    /*
+     * Volatile FS state
+     */
+    open_file_entry_t *open_file_table;
+    allocation_state_t *free_open_file_entries;
+
+    // Snapshots: inumber of each one's (frozen) root directory, -1 if unused
+    int snapshots[MAX_SNAPSHOTS];
+    pthread_mutex_t snapshots_lock;
+
+    // Allocators of inodes (over freeinode_ts) and data blocks (over
+    // free_blocks)
+    alloc_pool_t inode_pool;
+    alloc_pool_t block_pool;
+
+    // Table sizes in use: they start at the max_*_count parameters and only
+    // grow (the inode and block pools grow themselves, see grow_open_files),
+    // up to the limits below, for which address space is reserved upfront so
+    // tables never move
+    atomic_size_t open_file_count;
+    size_t open_file_used; // protected by rwlock_a
+    size_t inode_limit;
+    size_t block_limit;
+    size_t open_file_limit;
+};
+
+#define STATE (tfs_current->state)
+
+#define CHECKSUM_VALID (UINT64_C(1) << 32)
+// retries of inode_meta_get between checks for a dead writer
+#define META_CHECK_RETRIES (1u << 16)
 
 // Convenience macros
-#define INODE_TABLE_SIZE (fs_params.max_inode_count)
-#define DATA_BLOCKS (fs_params.max_block_count)
-#define MAX_OPEN_FILES (fs_params.max_open_files_count)
-#define BLOCK_SIZE (fs_params.block_size)
+#define INODE_TABLE_SIZE (atomic_load(&st->inode_pool.count))
+#define DATA_BLOCKS (atomic_load(&st->block_pool.count))
+#define MAX_OPEN_FILES (atomic_load(&st->open_file_count))
+#define BLOCK_SIZE (st->fs_params.block_size)
 #define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
+#define MAX_FILE_BLOCKS (st->fs_params.max_file_blocks)
 
 static inline bool valid_inumber(int inumber) {
+    struct state *st = STATE;
     return inumber >= 0 && inumber < INODE_TABLE_SIZE;
 }
 
 static inline bool valid_block_number(int block_number) {
+    struct state *st = STATE;
     return block_number >= 0 && block_number < DATA_BLOCKS;
 }
 
 static inline bool valid_file_handle(int file_handle) {
+    struct state *st = STATE;
     return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
 }
 
-size_t state_block_size(void) { return BLOCK_SIZE; }
+size_t state_block_size(void) { return STATE->fs_params.block_size; }
+
+size_t state_max_file_size(void) {
+    return STATE->fs_params.max_file_blocks * STATE->fs_params.block_size;
+}
 
 /**
  * Do nothing, while preventing the compiler from performing any optimizations.
@@ -84,50 +165,318 @@ static void insert_delay(void) {
     }
 }
 
+/**
+ * Map zero-filled memory for a table.
+ *
+ * Pages are only backed by memory once they are first written, so a table
+ * costs neither time nor memory until it is used. Every table is laid out so
+ * that all-zero means empty (FREE is 0).
+ *
+ * Returns the mapping (page aligned), or NULL on failure.
+ */
+static void *table_map(size_t size) {
+    if (shm_enabled()) {
+        return shm_malloc(size); // (tables are allocated first: zero-filled)
+    }
+    void *table = mmap(NULL, size > 0 ? size : 1, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return table == MAP_FAILED ? NULL : table;
+}
+
+static void table_unmap(void *table, size_t size) {
+    if (table != NULL && !shm_enabled()) {
+        munmap(table, size > 0 ? size : 1);
+    }
+}
+
+/**
+ * Map zero-filled memory for a table, backed by huge pages if possible.
+ *
+ * Explicit huge pages (MAP_HUGETLB) are used when the system has them
+ * reserved. Otherwise the mapping is aligned to a huge page boundary and
+ * marked for transparent huge pages (MADV_HUGEPAGE), which the kernel may or
+ * may not honour; if that is not supported either, it keeps regular pages.
+ *
+ * Input:
+ *   - size: table size
+ *   - mapped: output, the size to pass to table_unmap
+ *
+ * Returns the mapping, or NULL on failure.
+ */
+static void *table_map_huge(size_t size, size_t *mapped) {
+    size_t rounded = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE *
+                     HUGE_PAGE_SIZE;
+
+#ifdef MAP_HUGETLB
+    // (no MAP_NORESERVE here: without a reservation, running out of huge
+    // pages would be a SIGBUS on first touch instead of a fallback)
+    void *table = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (table != MAP_FAILED) {
+        *mapped = rounded;
+        return table;
+    }
+#endif
+
+    // Over-map, then trim to a huge page aligned range
+    char *raw = table_map(rounded + HUGE_PAGE_SIZE);
+    if (raw == NULL) {
+        return NULL;
+    }
+    uintptr_t start = ((uintptr_t)raw + HUGE_PAGE_SIZE - 1) /
+                      HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    char *aligned = (char *)start;
+    size_t head = (size_t)(aligned - raw);
+    if (head > 0) {
+        munmap(raw, head);
+    }
+    munmap(aligned + rounded, HUGE_PAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, rounded, MADV_HUGEPAGE); // only a hint
+#endif
+    *mapped = rounded;
+    return aligned;
+}
+
+/**
+ * Number of inode chunks (see inode_checksums) covering a number of inodes.
+ */
+static size_t inode_chunks(size_t inodes) {
+    return (inodes + INODE_CHUNK_SIZE - 1) / INODE_CHUNK_SIZE;
+}
+
+/**
+ * Unmap every table (those that were mapped).
+ */
+static void tables_unmap(void) {
+    struct state *st = STATE;
+    table_unmap(st->inode_table, st->inode_table_mapped);
+    table_unmap(st->freeinode_ts, st->inode_limit * sizeof(allocation_state_t));
+    table_unmap(st->inode_types, st->inode_limit * sizeof(inode_type));
+    table_unmap(st->inode_sizes, st->inode_limit * sizeof(size_t));
+    table_unmap(st->inode_links, st->inode_limit * sizeof(int));
+    table_unmap(st->fs_data, st->fs_data_mapped);
+    table_unmap(st->free_blocks, st->block_limit * sizeof(allocation_state_t));
+    table_unmap(st->block_shares, st->block_limit * sizeof(atomic_uint));
+    table_unmap(st->block_checksums, st->block_limit * sizeof(uint64_t));
+    table_unmap(st->inode_checksums,
+                inode_chunks(st->inode_limit) * sizeof(uint64_t));
+    table_unmap(st->open_file_table,
+                st->open_file_limit * sizeof(open_file_entry_t));
+    table_unmap(st->free_open_file_entries,
+                st->open_file_limit * sizeof(allocation_state_t));
+
+    st->inode_table = NULL;
+    st->freeinode_ts = NULL;
+    st->inode_types = NULL;
+    st->inode_sizes = NULL;
+    st->inode_links = NULL;
+    st->fs_data = NULL;
+    st->free_blocks = NULL;
+    st->block_shares = NULL;
+    st->block_checksums = NULL;
+    st->inode_checksums = NULL;
+    st->open_file_table = NULL;
+    st->free_open_file_entries = NULL;
+}
+
+/**
+ * Size a table may grow to: its limit, or its initial size if larger.
+ */
+static size_t limit_of(size_t count, size_t limit) {
+    return limit > count ? limit : count;
+}
+
+/**
+ * Space a shared volume needs: the state and its tables, and room for the
+ * objects allocated as it is used, that is, a copy of the entries of every
+ * inode (should all be directories) and SHM_RANGES byte ranges.
+ */
+static size_t shared_size(tfs_params const *params) {
+    size_t inodes =
+        limit_of(params->max_inode_count, params->inode_count_limit);
+    size_t blocks =
+        limit_of(params->max_block_count, params->block_count_limit);
+    size_t open_files =
+        limit_of(params->max_open_files_count, params->open_files_count_limit);
+    size_t dir_entries = params->block_size / sizeof(dir_entry_t);
+
+    size_t sizes[] = {
+        sizeof(struct state),
+        inodes * sizeof(inode_t),
+        inodes * sizeof(allocation_state_t),
+        inodes * sizeof(inode_type),
+        inodes * sizeof(size_t),
+        inodes * sizeof(int),
+        inode_chunks(inodes) * sizeof(uint64_t),
+        blocks * params->block_size,
+        blocks * sizeof(allocation_state_t),
+        blocks * sizeof(atomic_uint),
+        blocks * sizeof(uint64_t),
+        open_files * sizeof(open_file_entry_t),
+        open_files * sizeof(allocation_state_t),
+        (ALLOC_GROUPS + 1) * sizeof(alloc_group_t), // inode pool
+        (ALLOC_GROUPS + 1) * sizeof(alloc_group_t), // block pool
+    };
+    size_t size = 0;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size += shm_footprint(sizes[i]);
+    }
+    size += inodes * shm_footprint(sizeof(dir_snapshot_t) +
+                                   dir_entries * sizeof(uint32_t) +
+                                   dir_entries * sizeof(dir_entry_t));
+    size += SHM_RANGES * shm_footprint(sizeof(range_t));
+    return size;
+}
+
+/**
+ * Release the state itself (tables_unmap releases its tables).
+ */
+static void state_free(struct state *st) {
+    if (shm_enabled()) {
+        shm_destroy(); // only this process was using it
+    } else {
+        free(st);
+    }
+    STATE = NULL;
+}
+
 /**
  * Initialize FS state.
  *
+ * Takes constant time: the tables are mapped lazily and start out all FREE
+ * (inodes are initialized by inode_create).
+ *
+ * With params.shm_name set, the state is created in a shared volume, or, if
+ * another process created that volume already, taken from it as it is.
+ *
  * Input:
  *   - params: TécnicoFS parameters
  *
- * Returns 0 if successful, -1 otherwise.
+ * Returns 0 if successful (1 if an existing shared volume was attached),
+ * -1 otherwise.
  *
  * Possible errors:
  *   - TFS already initialized.
- *   - malloc failure when allocating TFS structures.
+ *   - max_file_blocks out of range (0 or > MAX_BLOCKS_PER_FILE).
+ *   - mmap failure when allocating TFS structures.
+ *   - The shared volume could not be created or attached (see shm_init).
  */
 int state_init(tfs_params params) {
-    fs_params = params;
-
-    if (inode_table != NULL) {
+    if (STATE != NULL) {
         return -1; // already initialized
     }
 
-    inode_table = malloc(INODE_TABLE_SIZE * sizeof(inode_t));
-    freeinode_ts = malloc(INODE_TABLE_SIZE * sizeof(allocation_state_t));
-    fs_data = malloc(DATA_BLOCKS * BLOCK_SIZE);
-    free_blocks = malloc(DATA_BLOCKS * sizeof(allocation_state_t));
-    open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
-    free_open_file_entries =
-        malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
+    if (params.max_file_blocks == 0 ||
+        params.max_file_blocks > MAX_BLOCKS_PER_FILE) {
+        return -1; // block map cannot hold that many blocks
+    }
 
-    if (!inode_table || !freeinode_ts || !fs_data || !free_blocks ||
-        !open_file_table || !free_open_file_entries) {
+    struct state *st;
+    if (params.shm_name != NULL) {
+        int created = shm_init(params.shm_name, shared_size(&params));
+        if (created == -1) {
+            return -1;
+        }
+        if (!created) {
+            // Formatted by the process that created it (with its params)
+            STATE = shm_root();
+            epoch_init();
+            scan_init();
+            crc32c_init();
+            return 1;
+        }
+        st = shm_malloc(sizeof(struct state)); // (zero-filled)
+        if (st == NULL) {
+            shm_destroy();
+            return -1;
+        }
+        shm_set_root(st);
+    } else {
+        st = calloc(1, sizeof(struct state));
+        if (st == NULL) {
+            return -1;
+        }
+    }
+    STATE = st;
+    st->fs_params = params;
+
+    atomic_store(&st->open_file_count, params.max_open_files_count);
+    st->open_file_used = 0;
+    st->inode_limit =
+        limit_of(params.max_inode_count, params.inode_count_limit);
+    st->block_limit =
+        limit_of(params.max_block_count, params.block_count_limit);
+    st->open_file_limit =
+        limit_of(params.max_open_files_count, params.open_files_count_limit);
+
+    // Map the tables at their limits (address space only)
+    st->inode_table_mapped = st->inode_limit * sizeof(inode_t);
+    st->fs_data_mapped = st->block_limit * BLOCK_SIZE;
+    if (params.huge_pages && params.shm_name == NULL) {
+        st->inode_table =
+            table_map_huge(st->inode_table_mapped, &st->inode_table_mapped);
+        st->fs_data = table_map_huge(st->fs_data_mapped, &st->fs_data_mapped);
+    } else {
+        st->inode_table = table_map(st->inode_table_mapped);
+        st->fs_data = table_map(st->fs_data_mapped);
+    }
+    st->freeinode_ts = table_map(st->inode_limit * sizeof(allocation_state_t));
+    st->inode_types = table_map(st->inode_limit * sizeof(inode_type));
+    st->inode_sizes = table_map(st->inode_limit * sizeof(size_t));
+    st->inode_links = table_map(st->inode_limit * sizeof(int));
+    st->free_blocks = table_map(st->block_limit * sizeof(allocation_state_t));
+    st->block_shares = table_map(st->block_limit * sizeof(atomic_uint));
+    st->block_checksums = table_map(st->block_limit * sizeof(uint64_t));
+    st->inode_checksums =
+        table_map(inode_chunks(st->inode_limit) * sizeof(uint64_t));
+    st->open_file_table =
+        table_map(st->open_file_limit * sizeof(open_file_entry_t));
+    st->free_open_file_entries =
+        table_map(st->open_file_limit * sizeof(allocation_state_t));
+
+    if (!st->inode_table || !st->freeinode_ts || !st->inode_types ||
+        !st->inode_sizes || !st->inode_links || !st->fs_data ||
+        !st->free_blocks || !st->block_shares || !st->block_checksums ||
+        !st->inode_checksums || !st->open_file_table ||
+        !st->free_open_file_entries) {
+        tables_unmap();
+        state_free(st);
         return -1; // allocation failed
     }
 
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        freeinode_ts[i] = FREE;
+    if (alloc_pool_init(&st->inode_pool, st->freeinode_ts,
+                        params.max_inode_count, st->inode_limit) == -1) {
+        tables_unmap();
+        state_free(st);
+        return -1;
+    }
+    if (alloc_pool_init(&st->block_pool, st->free_blocks,
+                        params.max_block_count, st->block_limit) == -1) {
+        alloc_pool_destroy(&st->inode_pool);
+        tables_unmap();
+        state_free(st);
+        return -1;
     }
 
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
+    for (size_t i = 0; i < MAX_SNAPSHOTS; i++) {
+        st->snapshots[i] = -1;
     }
 
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        free_open_file_entries[i] = FREE;
+    shm_rwlock_init(&st->rwlock_a);
+    shm_rwlock_init(&st->rwlock_b);
+    shm_mutex_init(&st->block_map_lock);
+    shm_mutex_init(&st->snapshots_lock);
+    for (size_t i = 0; i < CHECKSUM_LOCK_STRIPES; i++) {
+        shm_mutex_init(&st->block_locks[i]);
+        shm_mutex_init(&st->chunk_locks[i]);
     }
 
+    epoch_init();
+    scan_init();
+    crc32c_init();
+
     return 0;
 }
 
@@ -137,20 +486,157 @@ int state_init(tfs_params params) {
  * Returns 0 if succesful, -1 otherwise.
  */
 int state_destroy(void) {
-    free(inode_table);
-    free(freeinode_ts);
-    free(fs_data);
-    free(free_blocks);
-    free(open_file_table);
-    free(free_open_file_entries);
-
-    inode_table = NULL;
-    freeinode_ts = NULL;
-    fs_data = NULL;
-    free_blocks = NULL;
-    open_file_table = NULL;
-    free_open_file_entries = NULL;
+    struct state *st = STATE;
+    if (st == NULL) {
+        return -1; // not initialized
+    }
+
+    if (shm_enabled()) {
+        // Other processes may still be using the volume: only detach from it
+        // (the last one to do so removes it)
+        epoch_destroy();
+        shm_destroy();
+        STATE = NULL;
+        return 0;
+    }
+
+    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (st->freeinode_ts[i] == TAKEN) {
+            shm_free(atomic_load(&st->inode_table[i].i_dir_snapshot));
+        }
+    }
+    epoch_destroy();
+
+    pthread_rwlock_destroy(&st->rwlock_a);
+    pthread_rwlock_destroy(&st->rwlock_b);
+    pthread_mutex_destroy(&st->block_map_lock);
+    pthread_mutex_destroy(&st->snapshots_lock);
+    for (size_t i = 0; i < CHECKSUM_LOCK_STRIPES; i++) {
+        pthread_mutex_destroy(&st->block_locks[i]);
+        pthread_mutex_destroy(&st->chunk_locks[i]);
+    }
+    alloc_pool_destroy(&st->inode_pool);
+    alloc_pool_destroy(&st->block_pool);
+    tables_unmap();
+    state_free(st);
+
+    return 0;
+}
+
+/**
+ * Grow the open file table in place.
+ * Must be called with rwlock_a held for writing.
+ *
+ * Returns 0 if the table grew, -1 if it is at its limit.
+ */
+static int grow_open_files(void) {
+    struct state *st = STATE;
+    size_t size = MAX_OPEN_FILES;
+    if (size >= st->open_file_limit) {
+        return -1;
+    }
+    atomic_store(&st->open_file_count,
+                 alloc_grown_size(size, 1, st->open_file_limit));
+    return 0;
+}
+
+/**
+ * Find the size of the pages backing a table, as reported by the kernel in
+ * /proc/self/smaps (huge pages, explicit or transparent, or regular pages).
+ *
+ * Input:
+ *   - table: start of the table
+ *
+ * Returns the page size; the regular page size if it cannot be determined.
+ */
+static size_t table_page_size(void const *table) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL) {
+        return page_size;
+    }
+
+    char line[256];
+    bool in_table = false;
+    while (fgets(line, sizeof(line), smaps) != NULL) {
+        uintptr_t start, end;
+        size_t kb;
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) == 2 &&
+            strchr(line, ':') == strrchr(line, ':')) {
+            // header line of a mapping ("start-end perms offset dev inode")
+            if (in_table) {
+                break;
+            }
+            in_table = start <= (uintptr_t)table && (uintptr_t)table < end;
+        } else if (in_table &&
+                   sscanf(line, "KernelPageSize: %zu kB", &kb) == 1) {
+            if (kb * 1024 > page_size) {
+                page_size = kb * 1024; // explicit huge pages
+            }
+        } else if (in_table &&
+                   sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            if (kb > 0 && HUGE_PAGE_SIZE > page_size) {
+                page_size = HUGE_PAGE_SIZE; // transparent huge pages
+            }
+        }
+    }
+    fclose(smaps);
+    return page_size;
+}
+
+/**
+ * Fill in FS statistics.
+ *
+ * Returns 0 if successful, -1 if the FS is not initialized.
+ */
+int state_get_stats(tfs_stats *stats) {
+    struct state *st = STATE;
+    if (st == NULL) {
+        return -1;
+    }
+
+    stats->data_page_size = table_page_size(st->fs_data);
+    stats->inode_page_size = table_page_size(st->inode_table);
+    stats->inode_capacity = INODE_TABLE_SIZE;
+    stats->block_capacity = DATA_BLOCKS;
+    stats->open_file_capacity = MAX_OPEN_FILES;
+    stats->checksum_errors = atomic_load(&st->checksum_errors);
+    stats->recovered_locks = shm_recovered_locks();
+    stats->repaired_inodes = atomic_load(&st->repaired_inodes);
+    return 0;
+}
+
+/**
+ * Fill in how full the FS is, from counters kept up to date by the
+ * allocators.
+ *
+ * Returns 0 if successful, -1 if the FS is not initialized.
+ */
+int state_statfs(tfs_statfs_info *info) {
+    struct state *st = STATE;
+    if (st == NULL) {
+        return -1;
+    }
 
+    info->block_size = BLOCK_SIZE;
+
+    // (a table can grow between reading its size and its usage)
+    size_t used = alloc_pool_used(&st->block_pool);
+    info->blocks = DATA_BLOCKS;
+    info->blocks_free = info->blocks > used ? info->blocks - used : 0;
+    info->blocks_max = st->block_limit;
+
+    used = alloc_pool_used(&st->inode_pool);
+    info->inodes = INODE_TABLE_SIZE;
+    info->inodes_free = info->inodes > used ? info->inodes - used : 0;
+    info->inodes_max = st->inode_limit;
+
+    pthread_rwlock_rdlock(&st->rwlock_a);
+    info->open_files = MAX_OPEN_FILES;
+    info->open_files_free = info->open_files - st->open_file_used;
+    pthread_rwlock_unlock(&st->rwlock_a);
+    info->open_files_max = st->open_file_limit;
     return 0;
 }
 
@@ -164,31 +650,362 @@ int state_destroy(void) {
  *   - No free slots in inode table.
  */
 static int inode_alloc(void) {
-    for (size_t inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
-            insert_delay(); // simulate storage access delay (to freeinode_ts)
-        }
+    struct state *st = STATE;
+    insert_delay(); // simulate storage access delay (to freeinode_ts)
+
+    // mostly served from the thread's magazine (the table grows if full)
+    return alloc_pool_get(&st->inode_pool);
+}
+
+/**
+ * Compute the checksum of a chunk of inodes, over the fields that would be
+ * persisted (not locks, nor the in-memory directory copies).
+ */
+static uint32_t inode_chunk_checksum(size_t chunk) {
+    struct state *st = STATE;
+    uint32_t crc = 0;
+    size_t first = chunk * INODE_CHUNK_SIZE;
+    for (size_t i = first; i < first + INODE_CHUNK_SIZE && i < st->inode_limit;
+         i++) {
+        inode_t const *inode = &st->inode_table[i];
+        crc = crc32c(crc, &inode->i_node_type, sizeof(inode->i_node_type));
+        crc = crc32c(crc, &inode->i_size, sizeof(inode->i_size));
+        crc = crc32c(crc, &inode->hardlinks_counter,
+                     sizeof(inode->hardlinks_counter));
+        crc = crc32c(crc, inode->i_data_blocks, sizeof(inode->i_data_blocks));
+        crc = crc32c(crc, inode->i_block_extents,
+                     sizeof(inode->i_block_extents));
+    }
+    return crc;
+}
+
+static void meta_seq_begin(inode_t *inode) {
+    atomic_fetch_add_explicit(&inode->i_meta_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void meta_seq_end(inode_t *inode) {
+    struct state *st = STATE;
+    // mirror the new values in the metadata columns
+    size_t inumber = (size_t)(inode - st->inode_table);
+    st->inode_types[inumber] = inode->i_node_type;
+    st->inode_sizes[inumber] = inode->i_size;
+    st->inode_links[inumber] = inode->hardlinks_counter;
+
+    // (before the sequence ends, see inode_verify)
+    if (st->fs_params.checksums) {
+        size_t chunk = inumber / INODE_CHUNK_SIZE;
+        pthread_mutex_t *lock = &st->chunk_locks[chunk % CHECKSUM_LOCK_STRIPES];
+        shm_mutex_lock(lock);
+        atomic_store(&st->inode_checksums[chunk],
+                     CHECKSUM_VALID | inode_chunk_checksum(chunk));
+        pthread_mutex_unlock(lock);
+    }
+
+    atomic_fetch_add_explicit(&inode->i_meta_seq, 1, memory_order_release);
+}
+
+/**
+ * Repair an inode whose commit lock was just taken over from a process that
+ * died holding it (shared volumes, see shm_recover). A holder that died
+ * between inode_meta_write_begin and inode_meta_write_end left the metadata
+ * sequence odd, which would keep inode_meta_get retrying forever in every
+ * process: the change is ended as far as it got, and the inode is counted in
+ * tfs_stats.repaired_inodes (its size or block map may be half updated).
+ */
+static void inode_commit_recover(inode_t *inode) {
+    struct state *st = STATE;
+    shm_recover(&inode->i_commit_lock);
+    if ((atomic_load(&inode->i_meta_seq) & 1) != 0) {
+        meta_seq_end(inode);
+        atomic_fetch_add(&st->repaired_inodes, 1);
+    }
+}
+
+static void inode_commit_lock(inode_t *inode) {
+    if (pthread_mutex_lock(&inode->i_commit_lock) == EOWNERDEAD) {
+        inode_commit_recover(inode);
+    }
+}
+
+static void inode_commit_wait(inode_t *inode) {
+    if (pthread_cond_wait(&inode->i_commit_cond, &inode->i_commit_lock) ==
+        EOWNERDEAD) {
+        inode_commit_recover(inode);
+    }
+}
 
-        // Finds first free entry in inode table
-        if (freeinode_ts[inumber] == FREE) {
-            //  Found a free entry, so takes it for the new inode
-            freeinode_ts[inumber] = TAKEN;
+/**
+ * Repair an inode if the holder of its commit lock died, without waiting for
+ * a live one.
+ */
+static void inode_commit_check(inode_t const *inode) {
+    // (the lock and the sequence are the only fields changed)
+    inode_t *writable = (inode_t *)inode;
+    int ret = pthread_mutex_trylock(&writable->i_commit_lock);
+    if (ret == EOWNERDEAD) {
+        inode_commit_recover(writable);
+        ret = 0;
+    }
+    if (ret == 0) {
+        pthread_mutex_unlock(&writable->i_commit_lock);
+    }
+}
 
-            return (int)inumber;
+/**
+ * Take a consistent snapshot of an inode's metadata, without locking.
+ *
+ * Retries while a writer is between inode_meta_write_begin and
+ * inode_meta_write_end, so the fields read always belong to the same version.
+ * In a shared volume, a writer that keeps the inode mid-change for long is
+ * checked for having died (see inode_commit_check).
+ *
+ * Input:
+ *   - inode: the inode
+ *
+ * Returns the snapshot.
+ */
+inode_meta_t inode_meta_get(inode_t const *inode) {
+    inode_meta_t meta;
+    unsigned int seq;
+    unsigned int retries = 0;
+    do {
+        if (++retries % META_CHECK_RETRIES == 0 && shm_enabled()) {
+            inode_commit_check(inode);
         }
+        seq = atomic_load_explicit(&inode->i_meta_seq, memory_order_acquire);
+        meta.type = inode->i_node_type;
+        meta.size = inode->i_size;
+        meta.links = inode->hardlinks_counter;
+        meta.root_block = inode->i_data_blocks[0];
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) != 0 ||
+             seq != atomic_load_explicit(&inode->i_meta_seq,
+                                         memory_order_relaxed));
+    return meta;
+}
+
+/**
+ * Start changing an inode's type, size, link count or block map.
+ *
+ * Writers are serialized by the inode's commit lock, which is held until
+ * inode_meta_write_end.
+ */
+void inode_meta_write_begin(inode_t *inode) {
+    inode_commit_lock(inode);
+    meta_seq_begin(inode);
+}
+
+/**
+ * Publish the changes made since inode_meta_write_begin.
+ */
+void inode_meta_write_end(inode_t *inode) {
+    meta_seq_end(inode);
+    pthread_mutex_unlock(&inode->i_commit_lock);
+}
+
+/**
+ * Verify the checksum of the inode table chunk holding an inode (a no-op
+ * unless tfs_params.checksums is set). A chunk with an inode being changed
+ * is taken as valid: its checksum is about to be computed again.
+ *
+ * Input:
+ *   - inumber: the inode
+ *
+ * Returns 0 if the checksum matches, -1 otherwise.
+ */
+int inode_verify(int inumber) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_verify: invalid inumber");
+    if (!st->fs_params.checksums) {
+        return 0;
+    }
+
+    size_t chunk = (size_t)inumber / INODE_CHUNK_SIZE;
+    size_t first = chunk * INODE_CHUNK_SIZE;
+    size_t last = first + INODE_CHUNK_SIZE < st->inode_limit
+                      ? first + INODE_CHUNK_SIZE
+                      : st->inode_limit;
+    pthread_mutex_t *lock = &st->chunk_locks[chunk % CHECKSUM_LOCK_STRIPES];
+    shm_mutex_lock(lock);
+
+    // Like inode_meta_get: only a stable chunk is compared
+    unsigned int seqs[INODE_CHUNK_SIZE];
+    bool stable = true;
+    for (size_t i = first; i < last; i++) {
+        seqs[i - first] = atomic_load_explicit(
+            &st->inode_table[i].i_meta_seq, memory_order_acquire);
+        stable = stable && (seqs[i - first] & 1) == 0;
+    }
+    uint64_t stored = atomic_load(&st->inode_checksums[chunk]);
+    uint32_t crc = inode_chunk_checksum(chunk);
+    atomic_thread_fence(memory_order_acquire);
+    for (size_t i = first; i < last; i++) {
+        stable = stable &&
+                 seqs[i - first] ==
+                     atomic_load_explicit(&st->inode_table[i].i_meta_seq,
+                                          memory_order_relaxed);
     }
+    pthread_mutex_unlock(lock);
 
-    // no free inodes
+    if (!stable || (stored & CHECKSUM_VALID) == 0 ||
+        (uint32_t)stored == crc) {
+        return 0;
+    }
+    atomic_fetch_add(&st->checksum_errors, 1);
     return -1;
 }
 
+/**
+ * Free the data blocks referenced by an inode's block map from a given
+ * index on, in one batch.
+ * Must be called between inode_meta_write_begin and inode_meta_write_end.
+ *
+ * Input:
+ *   - inode: the inode whose blocks are released (its size is left as is)
+ *   - first: index of the first block map entry to release
+ */
+static void inode_blocks_free(inode_t *inode, size_t first) {
+    int blocks[MAX_BLOCKS_PER_FILE];
+    size_t count = 0;
+    for (size_t i = first; i < MAX_BLOCKS_PER_FILE; i++) {
+        if (inode->i_data_blocks[i] != -1) {
+            blocks[count++] = inode->i_data_blocks[i];
+            inode->i_data_blocks[i] = -1;
+            inode->i_block_extents[i].length = 0;
+        }
+    }
+    data_block_free_many(blocks, count);
+}
+
+/**
+ * Hash of a file name, never 0 (which marks free directory entries).
+ */
+static uint32_t name_hash(char const *name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < MAX_FILE_NAME && name[i] != '\0'; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/**
+ * Allocate an (uninitialized) copy of a directory's entries.
+ *
+ * Returns the copy, or NULL on malloc failure (or if a shared volume is
+ * out of room).
+ */
+static dir_snapshot_t *dir_snapshot_alloc(void) {
+    struct state *st = STATE;
+    dir_snapshot_t *snapshot =
+        shm_malloc(sizeof(dir_snapshot_t) + MAX_DIR_ENTRIES * sizeof(uint32_t) +
+               MAX_DIR_ENTRIES * sizeof(dir_entry_t));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    snapshot->hashes = (uint32_t *)(snapshot + 1);
+    snapshot->entries = (dir_entry_t *)(snapshot->hashes + MAX_DIR_ENTRIES);
+    return snapshot;
+}
+
+/**
+ * Fill a copy of a directory's entries from its block.
+ *
+ * Input:
+ *   - snapshot: copy allocated by dir_snapshot_alloc
+ *   - block: the directory's entries
+ */
+static void dir_snapshot_fill(dir_snapshot_t *snapshot,
+                              dir_entry_t const *block) {
+    struct state *st = STATE;
+    memcpy(snapshot->entries, block, MAX_DIR_ENTRIES * sizeof(dir_entry_t));
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        snapshot->hashes[i] =
+            block[i].d_inumber == -1 ? 0 : name_hash(block[i].d_name);
+    }
+}
+
+/**
+ * Free a copy of a directory's entries that was just unpublished, once the
+ * lookups that may still be reading it are done (see dir_read_begin): right
+ * away in a shared volume, where the caller must hold rwlock_b for writing.
+ */
+static void dir_snapshot_retire(dir_snapshot_t *snapshot) {
+    if (shm_enabled()) {
+        shm_free(snapshot);
+    } else {
+        epoch_retire(&snapshot->retired);
+    }
+}
+
+/**
+ * Start reading the published entries of directories, which stay valid
+ * until dir_read_end: an epoch section, or, in a shared volume (epochs only
+ * see the threads of this process), rwlock_b held for reading.
+ */
+static void dir_read_begin(void) {
+    if (shm_enabled()) {
+        pthread_rwlock_rdlock(&STATE->rwlock_b);
+    } else {
+        epoch_enter();
+    }
+}
+
+static void dir_read_end(void) {
+    if (shm_enabled()) {
+        pthread_rwlock_unlock(&STATE->rwlock_b);
+    } else {
+        epoch_exit();
+    }
+}
+
+/**
+ * Replace the published entries of a directory with a copy of its block.
+ * Must be called with rwlock_b held for writing.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - snapshot: copy allocated by dir_snapshot_alloc
+ *   - block: the directory's entries
+ */
+static void dir_snapshot_publish(inode_t *inode, dir_snapshot_t *snapshot,
+                                 dir_entry_t const *block) {
+    dir_snapshot_fill(snapshot, block);
+    dir_snapshot_t *old = atomic_exchange(&inode->i_dir_snapshot, snapshot);
+    dir_snapshot_retire(old);
+}
+
+/**
+ * Find the entry of a directory copy with a given name.
+ *
+ * Only the entries whose name hash matches are compared by name.
+ *
+ * Returns the index of the entry, or MAX_DIR_ENTRIES if there is none.
+ */
+static size_t dir_snapshot_find(dir_snapshot_t const *snapshot,
+                                char const *sub_name) {
+    struct state *st = STATE;
+    uint32_t hash = name_hash(sub_name);
+    for (size_t i = scan_u32(snapshot->hashes, MAX_DIR_ENTRIES, hash, 0);
+         i < MAX_DIR_ENTRIES;
+         i = scan_u32(snapshot->hashes, MAX_DIR_ENTRIES, hash, i + 1)) {
+        if (strncmp(snapshot->entries[i].d_name, sub_name, MAX_FILE_NAME) ==
+            0) {
+            return i;
+        }
+    }
+    return MAX_DIR_ENTRIES;
+}
+
 /**
  * Create a new inode in the inode table.
  *
  * Allocates and initializes a new inode.
  * Directories will have their data block allocated and initialized, with i_size
  * set to BLOCK_SIZE. Regular files will not have their data block allocated
- * (i_size will be set to 0, i_data_block to -1).
+ * (i_size will be set to 0, every block map entry to -1).
  *
  * Input:
  *   - i_type: the type of the node (file or directory)
@@ -200,39 +1017,56 @@ static int inode_alloc(void) {
  *   - (if creating a directory) No free data blocks.
  */
 int inode_create(inode_type i_type) {
-   pthread_rwlock_wrlock(&rwlock_a);
-   pthread_rwlock_wrlock(&rwlock_b);
-
+    struct state *st = STATE;
+    // The allocator hands the inode to this thread alone: it is only visible
+    // to others once added to a directory, so no further locking is needed
     int inumber = inode_alloc();
     if (inumber == -1) {
-        pthread_rwlock_unlock(&rwlock_a);
         return -1; // no free slots in inode table
     }
 
-    inode_t *inode = &inode_table[inumber];
+    inode_t *inode = &st->inode_table[inumber];
     insert_delay(); // simulate storage access delay (to inode)
 
+    atomic_store(&inode->i_tail, 0);
+    shm_mutex_init(&inode->i_commit_lock);
+    shm_cond_init(&inode->i_commit_cond);
+    range_lock_init(&inode->i_range_lock);
+    atomic_store(&inode->i_dir_snapshot, NULL);
+    inode->i_frozen = false;
+
+    inode_meta_write_begin(inode);
     inode->i_node_type = i_type;
+    memset(inode->i_block_extents, 0, sizeof(inode->i_block_extents));
     switch (i_type) {
     case T_DIRECTORY: {
         // Initializes directory (filling its block with empty entries, labeled
         // with inumber==-1)
         int b = data_block_alloc();
-        if (b == -1) {
+        dir_snapshot_t *snapshot = b == -1 ? NULL : dir_snapshot_alloc();
+        if (snapshot == NULL) {
+            if (b != -1) {
+                data_block_free(b);
+            }
             // ensure fields are initialized
             inode->i_size = 0;
-            inode->i_data_block = -1;
+            for (size_t i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+                inode->i_data_blocks[i] = -1;
+            }
             inode->hardlinks_counter = 1;
+            inode_meta_write_end(inode);
 
             // run regular deletion process
-            inode_delete(inumber);           
-            pthread_rwlock_unlock(&rwlock_b);
+            inode_delete(inumber);
             return -1;
         }
 
-        inode_table[inumber].i_size = BLOCK_SIZE;
-        inode_table[inumber].i_data_block = b;
-        inode_table[inumber].hardlinks_counter = 1;
+        st->inode_table[inumber].i_size = BLOCK_SIZE;
+        st->inode_table[inumber].i_data_blocks[0] = b;
+        for (size_t i = 1; i < MAX_BLOCKS_PER_FILE; i++) {
+            st->inode_table[inumber].i_data_blocks[i] = -1;
+        }
+        st->inode_table[inumber].hardlinks_counter = 1;
 
         dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
         ALWAYS_ASSERT(dir_entry != NULL,
@@ -241,28 +1075,36 @@ int inode_create(inode_type i_type) {
         for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
             dir_entry[i].d_inumber = -1;
         }
+        data_block_seal(b);
+
+        // Publish the entries for lookups
+        dir_snapshot_fill(snapshot, dir_entry);
+        atomic_store(&inode->i_dir_snapshot, snapshot);
     } break;
     case T_FILE:
         // In case of a new file, simply sets its size to 0
-        inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
-        inode_table[inumber].hardlinks_counter = 1;
+        st->inode_table[inumber].i_size = 0;
+        for (size_t i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+            st->inode_table[inumber].i_data_blocks[i] = -1;
+        }
+        st->inode_table[inumber].hardlinks_counter = 1;
         
         break;
 
     case T_SYMLINK:
-        inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
-        inode_table[inumber].hardlinks_counter = 1;
+        st->inode_table[inumber].i_size = 0;
+        for (size_t i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+            st->inode_table[inumber].i_data_blocks[i] = -1;
+        }
+        st->inode_table[inumber].hardlinks_counter = 1;
         
         break;
     
     default:
         PANIC("inode_create: unknown file type");
     }
-    
-    pthread_rwlock_unlock(&rwlock_a);
-    pthread_rwlock_unlock(&rwlock_b);
+    inode_meta_write_end(inode);
+
     return inumber;
 }
 
@@ -273,23 +1115,36 @@ int inode_create(inode_type i_type) {
  *   - inumber: inode's number
  */
 void inode_delete(int inumber) {
+    struct state *st = STATE;
     // simulate storage access delay (to inode and freeinode_ts)
     insert_delay();
     insert_delay();
-    pthread_rwlock_wrlock(&rwlock_a);
 
     ALWAYS_ASSERT(valid_inumber(inumber), "inode_delete: invalid inumber");
 
-    ALWAYS_ASSERT(freeinode_ts[inumber] == TAKEN,
+    ALWAYS_ASSERT(st->freeinode_ts[inumber] == TAKEN,
                   "inode_delete: inode already freed");
 
-    if (inode_table[inumber].i_size > 0) {
-        data_block_free(inode_table[inumber].i_data_block);
+    inode_meta_write_begin(&st->inode_table[inumber]);
+    inode_blocks_free(&st->inode_table[inumber], 0);
+    inode_meta_write_end(&st->inode_table[inumber]);
+    dir_snapshot_t *snapshot =
+        atomic_exchange(&st->inode_table[inumber].i_dir_snapshot, NULL);
+    if (snapshot != NULL) {
+        bool shared = shm_enabled();
+        if (shared) {
+            pthread_rwlock_wrlock(&st->rwlock_b); // see dir_snapshot_retire
+        }
+        dir_snapshot_retire(snapshot);
+        if (shared) {
+            pthread_rwlock_unlock(&st->rwlock_b);
+        }
     }
+    pthread_mutex_destroy(&st->inode_table[inumber].i_commit_lock);
+    pthread_cond_destroy(&st->inode_table[inumber].i_commit_cond);
+    range_lock_destroy(&st->inode_table[inumber].i_range_lock);
 
-    freeinode_ts[inumber] = FREE;
-
-    pthread_rwlock_unlock(&rwlock_a);
+    alloc_pool_put(&st->inode_pool, inumber);
 }
 
 /**
@@ -301,50 +1156,619 @@ void inode_delete(int inumber) {
  * Returns pointer to inode.
  */
 inode_t *inode_get(int inumber) {
+    struct state *st = STATE;
     ALWAYS_ASSERT(valid_inumber(inumber), "inode_get: invalid inumber");
 
     insert_delay(); // simulate storage access delay to inode
-    return &inode_table[inumber];
+    return &st->inode_table[inumber];
 }
 
 /**
- * Clear the directory entry associated with a sub file.
+ * Collect the inumbers and sizes of every inode of a given type, reading only
+ * the metadata columns.
  *
  * Input:
- *   - inode: directory inode
- *   - sub_name: sub file name
- *
- * Returns 0 if successful, -1 otherwise.
+ *   - type: the type of inode to look for
+ *   - inumbers: output, the inumbers found (may be NULL if max is 0)
+ *   - sizes: output, their sizes (may be NULL)
+ *   - max: capacity of the output arrays
  *
- * Possible errors:
- *   - inode is not a directory inode.
- *   - Directory does not contain an entry for sub_name.
+ * Returns the number of inodes of that type, which can be larger than max
+ * (only the first max are stored).
  */
-int clear_dir_entry(inode_t *inode, char const *sub_name) {
-    insert_delay();
-    pthread_rwlock_wrlock(&rwlock_a);
-    if (inode->i_node_type != T_DIRECTORY) {
-        pthread_rwlock_unlock(&rwlock_a);
-        return -1; // not a directory
+size_t inode_scan(inode_type type, int *inumbers, size_t *sizes, size_t max) {
+    struct state *st = STATE;
+    size_t found = 0;
+    size_t count = INODE_TABLE_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        if (st->freeinode_ts[i] == TAKEN && st->inode_types[i] == type) {
+            if (found < max) {
+                inumbers[found] = (int)i;
+                if (sizes != NULL) {
+                    sizes[found] = st->inode_sizes[i];
+                }
+            }
+            found++;
+        }
     }
-    pthread_rwlock_wrlock(&rwlock_a);
+    return found;
+}
 
-    // Locates the block containing the entries of the directory
-    pthread_rwlock_wrlock(&rwlock_b);
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
+/**
+ * Add up the sizes of every inode of a given type, reading only the metadata
+ * columns (the loop has no branches, so it vectorizes).
+ *
+ * Input:
+ *   - type: the type of inode to count
+ *
+ * Returns the total size in bytes.
+ */
+size_t inode_total_size(inode_type type) {
+    struct state *st = STATE;
+    size_t total = 0;
+    size_t count = INODE_TABLE_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        size_t match =
+            (st->freeinode_ts[i] == TAKEN) & (st->inode_types[i] == type);
+        total += st->inode_sizes[i] & -match;
+    }
+    return total;
+}
+
+/**
+ * Obtain the size of an inode from the metadata columns.
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+size_t inode_size_of(int inumber) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_size_of: invalid inumber");
+    return st->inode_sizes[inumber];
+}
+
+/**
+ * Release the contents of a file, leaving it empty.
+ *
+ * Input:
+ *   - inode: the inode to truncate
+ *   - owner: file handle on whose behalf the file is locked (see
+ *     tfs_lock_range), or -1
+ */
+void inode_truncate(inode_t *inode, int owner) {
+    // (the range lock keeps snapshots from sharing blocks being freed)
+    range_t range;
+    while (true) {
+        // Pending appends wait for i_size to reach their offset: let them
+        // commit first (they need their range unlocked to finish writing)
+        inode_commit_lock(inode);
+        while (inode->i_size != atomic_load(&inode->i_tail)) {
+            inode_commit_wait(inode);
+        }
+        pthread_mutex_unlock(&inode->i_commit_lock);
+
+        range_lock(&inode->i_range_lock, &range, owner, 0, SIZE_MAX);
+        inode_meta_write_begin(inode);
+        size_t tail = inode->i_size;
+        if (atomic_compare_exchange_strong(&inode->i_tail, &tail, 0)) {
+            break; // later appends start at 0
+        }
+        inode_meta_write_end(inode);
+        range_unlock(&inode->i_range_lock, &range);
+    }
+    inode_blocks_free(inode, 0);
+    inode->i_size = 0;
+    inode_meta_write_end(inode);
+    range_unlock(&inode->i_range_lock, &range);
+}
+
+/**
+ * Give an inode a private copy of one of its blocks, if the block is shared
+ * with a snapshot or a clone, or compressed (the copy is not).
+ * Must be called with block_map_lock held.
+ */
+static int block_unshare_locked(inode_t *inode, size_t index, bool reserved) {
+    int bnum = inode->i_data_blocks[index];
+    bool compressed = inode->i_block_extents[index].length != 0;
+    if (bnum == -1 || (!compressed && !data_block_shared(bnum))) {
+        if (reserved) {
+            data_block_unreserve(1);
+        }
+        return bnum;
+    }
+
+    int copy;
+    if (data_block_alloc_run(1, reserved, &copy) == -1) {
+        return -1; // no space
+    }
+    if (inode_read_block(inode, index, data_block_get(copy)) == -1) {
+        data_block_free(copy);
+        return -1; // corrupted
+    }
+    data_block_seal(copy);
+    inode_meta_write_begin(inode);
+    inode->i_data_blocks[index] = copy;
+    inode->i_block_extents[index].length = 0;
+    inode_meta_write_end(inode);
+    data_block_free(bnum); // only drops this inode's share
+    return copy;
+}
+
+/**
+ * Make one of an inode's blocks safe to write to: a block still shared with
+ * a snapshot or a clone is copied first (copy-on-write), and so is a
+ * compressed one (decompressed); the copy replaces it in the block map.
+ *
+ * Input:
+ *   - inode: the inode
+ *   - index: index in its block map
+ *   - reserved: whether a block was set aside for the copy with
+ *     data_block_reserve (the reservation is consumed, copy or not)
+ *
+ * Returns the block to write to (-1 if the entry is unmapped), or -1 if
+ * there was no space for the copy.
+ */
+int inode_block_unshare(inode_t *inode, size_t index, bool reserved) {
+    struct state *st = STATE;
+    shm_mutex_lock(&st->block_map_lock);
+    int bnum = block_unshare_locked(inode, index, reserved);
+    pthread_mutex_unlock(&st->block_map_lock);
+    return bnum;
+}
+
+/**
+ * Write into the data blocks of an inode, allocating missing blocks.
+ *
+ * Input:
+ *   - inode: the target inode
+ *   - offset: byte offset in the file
+ *   - buffer: contents to write
+ *   - len: number of bytes (offset + len must not exceed the max file size)
+ *
+ * Returns the number of bytes written (lower than len if the data region
+ * filled up), or -1 if nothing could be written.
+ */
+ssize_t inode_write_data(inode_t *inode, size_t offset, void const *buffer,
+                         size_t len) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(offset + len <= state_max_file_size(),
+                  "inode_write_data: write past the maximum file size");
+
+    size_t written = 0;
+    while (written < len) {
+        size_t pos = offset + written;
+        size_t index = pos / BLOCK_SIZE;
+        size_t block_offset = pos % BLOCK_SIZE;
+        size_t chunk = BLOCK_SIZE - block_offset;
+        if (chunk > len - written) {
+            chunk = len - written;
+        }
+
+        // Writers of disjoint ranges (atomic appends) may race to map the
+        // same block
+        shm_mutex_lock(&st->block_map_lock);
+        if (inode->i_data_blocks[index] == -1) {
+            int allocated = data_block_alloc();
+            if (allocated != -1 && chunk < BLOCK_SIZE) {
+                // the rest of the block is still a hole: it reads as zeros
+                memset(data_block_get(allocated), 0, BLOCK_SIZE);
+                data_block_seal(allocated);
+            }
+            inode_meta_write_begin(inode);
+            inode->i_data_blocks[index] = allocated;
+            inode_meta_write_end(inode);
+        }
+        int bnum = block_unshare_locked(inode, index, false);
+        pthread_mutex_unlock(&st->block_map_lock);
+        if (bnum == -1) {
+            break; // no space
+        }
+
+        char *block = data_block_write_begin(bnum);
+        ALWAYS_ASSERT(block != NULL,
+                      "inode_write_data: data block deleted mid-write");
+        memcpy(block + block_offset, (char const *)buffer + written, chunk);
+        data_block_write_end(bnum);
+        written += chunk;
+    }
+
+    if (written == 0 && len > 0) {
+        return -1;
+    }
+    return (ssize_t)written;
+}
+
+/**
+ * Reserve the bytes of a file up to 'end' for a write that may extend it:
+ * i_tail grows to 'end' if it is lower (it never shrinks here, so ranges
+ * reserved by atomic appends stay reserved).
+ *
+ * Input:
+ *   - inode: the inode
+ *   - end: offset just past the write
+ *
+ * Returns the previous tail. If it is lower than 'end', [tail, end) was
+ * reserved and must be committed with inode_size_commit.
+ */
+size_t inode_size_reserve(inode_t *inode, size_t end) {
+    size_t tail = atomic_load(&inode->i_tail);
+    while (tail < end &&
+           !atomic_compare_exchange_weak(&inode->i_tail, &tail, end)) {
+    }
+    return tail;
+}
+
+/**
+ * Commit a range reserved at the tail of a file (by inode_size_reserve or an
+ * atomic append): once every earlier reservation was committed, i_size
+ * advances past it, so the file never grows past a range still being
+ * written.
+ *
+ * Input:
+ *   - inode: the inode
+ *   - start, end: the reserved range
+ *   - done: offset up to which it was written (start <= done <= end); if
+ *     lower than 'end', the rest is given back when nobody reserved past it,
+ *     and otherwise left as a gap
+ *
+ * Returns the new size.
+ */
+size_t inode_size_commit(inode_t *inode, size_t start, size_t end,
+                         size_t done) {
+    inode_commit_lock(inode);
+    while (inode->i_size != start) {
+        inode_commit_wait(inode);
+    }
+    if (done != end) {
+        size_t expected = end;
+        if (atomic_compare_exchange_strong(&inode->i_tail, &expected, done)) {
+            end = done;
+        }
+    }
+    meta_seq_begin(inode);
+    inode->i_size = end;
+    meta_seq_end(inode);
+    pthread_cond_broadcast(&inode->i_commit_cond);
+    pthread_mutex_unlock(&inode->i_commit_lock);
+    return end;
+}
+
+/**
+ * Grow the size of an inode to at least 'size' bytes, in order with the
+ * ranges already reserved at its tail (see inode_size_commit).
+ */
+void inode_extend_size(inode_t *inode, size_t size) {
+    size_t tail = inode_size_reserve(inode, size);
+    if (tail < size) {
+        inode_size_commit(inode, tail, size, size);
+    }
+}
+
+/**
+ * Allocate the missing blocks of a byte range of a file ahead of writes to
+ * it, as one contiguous run if possible. The new blocks read as zeros; the
+ * file size is left as is, so appends land in them.
+ *
+ * Input:
+ *   - inumber: the file
+ *   - offset: byte offset of the range
+ *   - len: length of the range (offset + len must not exceed the max file
+ *     size)
+ *   - owner: file handle on whose behalf the file is locked (see
+ *     tfs_lock_range), or -1
+ *   - flush: called once writes to the file are held off, to write back its
+ *     buffered data (may be NULL)
+ *
+ * Returns 0 if successful, -1 otherwise (nothing is allocated on failure).
+ *
+ * Possible errors:
+ *   - Not enough free data blocks.
+ */
+int inode_preallocate(int inumber, size_t offset, size_t len, int owner,
+                      void (*flush)(int)) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_preallocate: invalid inumber");
+    ALWAYS_ASSERT(offset + len <= state_max_file_size(),
+                  "inode_preallocate: range past the maximum file size");
+    inode_t *inode = &st->inode_table[inumber];
+
+    // (with every write held off, and buffered ones flushed, the block map
+    // stays as is until the new blocks are mapped)
+    range_t range;
+    range_lock(&inode->i_range_lock, &range, owner, 0, SIZE_MAX);
+    if (flush != NULL) {
+        flush(inumber);
+    }
+
+    size_t first = offset / BLOCK_SIZE;
+    size_t end = (offset + len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t count = 0;
+    for (size_t i = first; i < end; i++) {
+        count += inode->i_data_blocks[i] == -1;
+    }
+
+    int blocks[MAX_BLOCKS_PER_FILE];
+    if (count > 0 && data_block_alloc_run(count, false, blocks) == -1) {
+        range_unlock(&inode->i_range_lock, &range);
+        return -1; // no space
+    }
+    for (size_t k = 0; k < count; k++) {
+        memset(data_block_get(blocks[k]), 0, BLOCK_SIZE);
+        data_block_seal(blocks[k]);
+    }
+
+    inode_meta_write_begin(inode);
+    size_t k = 0;
+    for (size_t i = first; i < end; i++) {
+        if (inode->i_data_blocks[i] == -1) {
+            inode->i_data_blocks[i] = blocks[k++];
+        }
+    }
+    inode_meta_write_end(inode);
+
+    range_unlock(&inode->i_range_lock, &range);
+    return 0;
+}
+
+/**
+ * Zero the bytes of a block from a byte offset of the file on.
+ */
+static void block_zero_from(int bnum, size_t pos) {
+    struct state *st = STATE;
+    size_t block_offset = pos % BLOCK_SIZE;
+    char *block = data_block_write_begin(bnum);
+    memset(block + block_offset, 0, BLOCK_SIZE - block_offset);
+    data_block_write_end(bnum);
+}
+
+/**
+ * Change the size of a file. Shrinking it frees the blocks past the new end
+ * (preallocated ones included) in one batch; growing it adds a gap that
+ * reads as zeros.
+ *
+ * Input:
+ *   - inumber: the file
+ *   - size: the new size (must not exceed the max file size)
+ *   - owner: file handle on whose behalf the file is locked (see
+ *     tfs_lock_range), or -1
+ *   - flush: called once writes to the file are held off, to write back its
+ *     buffered data (may be NULL)
+ *
+ * Returns 0 if successful, -1 otherwise (the file is left as is).
+ *
+ * Possible errors:
+ *   - Atomic appends to the file are in progress.
+ *   - No free data block for a private copy of the last block, shared with
+ *     a snapshot or a clone (or compressed).
+ */
+int inode_resize(int inumber, size_t size, int owner, void (*flush)(int)) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_resize: invalid inumber");
+    ALWAYS_ASSERT(size <= state_max_file_size(),
+                  "inode_resize: size past the maximum file size");
+    inode_t *inode = &st->inode_table[inumber];
+
+    range_t range;
+    range_lock(&inode->i_range_lock, &range, owner, 0, SIZE_MAX);
+    if (flush != NULL) {
+        flush(inumber);
+    }
+
+    // The bytes past the end of the file in its last block must read as
+    // zeros if it grows again, so that block needs a private copy
+    size_t old_size = inode_meta_get(inode).size;
+    size_t cut = size < old_size ? size : old_size;
+    int bnum = -1;
+    if (cut % BLOCK_SIZE != 0) {
+        bnum = inode_block_unshare(inode, cut / BLOCK_SIZE, false);
+        if (bnum == -1 && inode->i_data_blocks[cut / BLOCK_SIZE] != -1) {
+            range_unlock(&inode->i_range_lock, &range);
+            return -1; // no space
+        }
+    }
+    if (bnum != -1 && size > old_size) {
+        block_zero_from(bnum, cut); // before the gap becomes visible
+    }
+
+    // Appends reserve past i_tail: the new size only takes effect if none is
+    // pending (they would otherwise wait for i_size to reach their offset)
+    inode_meta_write_begin(inode);
+    size_t tail = old_size;
+    if (inode->i_size != old_size ||
+        !atomic_compare_exchange_strong(&inode->i_tail, &tail, size)) {
+        inode_meta_write_end(inode);
+        range_unlock(&inode->i_range_lock, &range);
+        return -1;
+    }
+    if (size < old_size) {
+        inode_blocks_free(inode, (size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    }
+    inode->i_size = size;
+    inode_meta_write_end(inode);
+
+    if (bnum != -1 && size < old_size) {
+        block_zero_from(bnum, cut);
+    }
+
+    range_unlock(&inode->i_range_lock, &range);
+    return 0;
+}
+
+/**
+ * Reserve the range at the tail of a file for an append that does not
+ * serialize against other appenders.
+ *
+ * Each appender gets a range of its own, to fill in parallel with the others,
+ * and then commits it with inode_size_commit: i_size only advances past it
+ * once every earlier reservation was committed, so readers bounded by i_size
+ * never see a partially written range.
+ *
+ * Input:
+ *   - inode: the target inode
+ *   - len: number of bytes to append
+ *   - start: output, the start of the range
+ *
+ * Returns the end of the range (closer than len if the maximum file size is
+ * reached, start itself if it was already).
+ */
+size_t inode_append_reserve(inode_t *inode, size_t len, size_t *start) {
+    size_t max_size = state_max_file_size();
+    size_t tail = atomic_load(&inode->i_tail);
+    size_t end;
+    do {
+        end = tail;
+        if (tail < max_size) {
+            end += len < max_size - tail ? len : max_size - tail;
+        }
+    } while (tail != end &&
+             !atomic_compare_exchange_weak(&inode->i_tail, &tail, end));
+    *start = tail;
+    return end;
+}
+
+/**
+ * Read from the data blocks of an inode.
+ *
+ * Unallocated blocks read as zeros.
+ *
+ * Input:
+ *   - inode: the source inode
+ *   - offset: byte offset in the file
+ *   - buffer: destination buffer
+ *   - len: number of bytes (must be within the file size)
+ *
+ * Returns 0 if successful, -1 if a block failed its checksum.
+ */
+int inode_read_data(inode_t const *inode, size_t offset, void *buffer,
+                    size_t len) {
+    struct state *st = STATE;
+    size_t done = 0;
+    while (done < len) {
+        size_t pos = offset + done;
+        size_t index = pos / BLOCK_SIZE;
+        size_t block_offset = pos % BLOCK_SIZE;
+        size_t chunk = BLOCK_SIZE - block_offset;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+
+        // (read once: a concurrent copy-on-write may remap it)
+        int bnum = inode->i_data_blocks[index];
+        block_extent_t extent = inode->i_block_extents[index];
+        if (bnum == -1) {
+            memset((char *)buffer + done, 0, chunk);
+        } else if (extent.length != 0) {
+            if (compress_read(bnum, extent.offset, extent.length, block_offset,
+                              (char *)buffer + done, chunk) == -1) {
+                return -1;
+            }
+        } else {
+            char const *block = data_block_read_begin(bnum);
+            if (block == NULL) {
+                return -1; // corrupted
+            }
+            memcpy((char *)buffer + done, block + block_offset, chunk);
+            data_block_read_end(bnum);
+        }
+        done += chunk;
+    }
+    return 0;
+}
+
+/**
+ * Read a whole block of a file (zeros if it is not mapped).
+ *
+ * Input:
+ *   - inode: the inode
+ *   - index: index in its block map
+ *   - page: destination (one block)
+ *
+ * Returns 0 if successful, -1 if the block failed its checksum.
+ */
+int inode_read_block(inode_t const *inode, size_t index, void *page) {
+    struct state *st = STATE;
+    return inode_read_data(inode, index * BLOCK_SIZE, page, BLOCK_SIZE);
+}
+
+/**
+ * Find where the next data or hole of a file starts, from a byte offset on.
+ * Data is whatever lies in a mapped block (preallocated ones included); the
+ * end of the file counts as a hole.
+ *
+ * Input:
+ *   - inode: the inode
+ *   - offset: byte offset to search from
+ *   - data: whether to look for data (otherwise, for a hole)
+ *
+ * Returns the offset found, or -1 if 'offset' is past the end of the file or
+ * there is no data after it.
+ */
+ssize_t inode_seek(inode_t const *inode, size_t offset, bool data) {
+    struct state *st = STATE;
+    size_t size = inode_meta_get(inode).size;
+    if (offset >= size) {
+        return -1;
+    }
+
+    for (size_t index = offset / BLOCK_SIZE; index * BLOCK_SIZE < size;
+         index++) {
+        if ((inode->i_data_blocks[index] != -1) == data) {
+            size_t start = index * BLOCK_SIZE;
+            return (ssize_t)(start > offset ? start : offset);
+        }
+    }
+    return data ? -1 : (ssize_t)size;
+}
+
+/**
+ * Clear the directory entry associated with a sub file.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *   - cleared: output, the inumber the entry pointed to (whose link count
+ *     is left to the caller)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - Directory does not contain an entry for sub_name.
+ */
+int clear_dir_entry(inode_t *inode, char const *sub_name, int *cleared) {
+    struct state *st = STATE;
+    insert_delay();
+    inode_meta_t meta = inode_meta_get(inode);
+    if (meta.type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    dir_snapshot_t *snapshot = dir_snapshot_alloc();
+    if (snapshot == NULL) {
+        return -1;
+    }
+
+    // Locates the block containing the entries of the directory
+    pthread_rwlock_wrlock(&st->rwlock_b);
+    dir_entry_t *dir_entry = data_block_write_begin(meta.root_block);
     ALWAYS_ASSERT(dir_entry != NULL,
                   "clear_dir_entry: directory must have a data block");
 
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (!strcmp(dir_entry[i].d_name, sub_name)) {
-            dir_entry[i].d_inumber = -1;
-            pthread_rwlock_unlock(&rwlock_b);
-            memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
-            return 0;
-        }
+    // The published copy matches the block while rwlock_b is held
+    size_t i = dir_snapshot_find(atomic_load(&inode->i_dir_snapshot), sub_name);
+    if (i == MAX_DIR_ENTRIES) {
+        data_block_write_end(meta.root_block);
+        pthread_rwlock_unlock(&st->rwlock_b);
+        shm_free(snapshot);
+        return -1; // sub_name not found
     }
-    pthread_rwlock_unlock(&rwlock_b);
-    return -1; // sub_name not found
+    *cleared = dir_entry[i].d_inumber;
+    dir_entry[i].d_inumber = -1;
+    memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
+    data_block_write_end(meta.root_block);
+    dir_snapshot_publish(inode, snapshot, dir_entry);
+    pthread_rwlock_unlock(&st->rwlock_b);
+    return 0;
 }
 
 /**
@@ -360,40 +1784,128 @@ int clear_dir_entry(inode_t *inode, char const *sub_name) {
  * Possible errors:
  *   - inode is not a directory inode.
  *   - sub_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
+ *   - Directory already has an entry named sub_name.
  *   - Directory is already full of entries.
  */
 int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
+    struct state *st = STATE;
     if (strlen(sub_name) == 0 || strlen(sub_name) > MAX_FILE_NAME - 1) {
         return -1; // invalid sub_name
     }
    
-    pthread_rwlock_rdlock(&rwlock_a);
     insert_delay(); // simulate storage access delay to inode with inumber
-    if (inode->i_node_type != T_DIRECTORY) {
-        pthread_rwlock_unlock(&rwlock_a);
+    inode_meta_t meta = inode_meta_get(inode);
+    if (meta.type != T_DIRECTORY) {
         return -1; // not a directory
     }
-    pthread_rwlock_unlock(&rwlock_a);
-    
+
+    dir_snapshot_t *snapshot = dir_snapshot_alloc();
+    if (snapshot == NULL) {
+        return -1;
+    }
+
     // Locates the block containing the entries of the directory
-    pthread_rwlock_wrlock(&rwlock_b);
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
+    pthread_rwlock_wrlock(&st->rwlock_b);
+    dir_entry_t *dir_entry = data_block_write_begin(meta.root_block);
     ALWAYS_ASSERT(dir_entry != NULL,
                   "add_dir_entry: directory must have a data block");
     
 
-    // Finds and fills the first empty entry
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dir_entry[i].d_inumber == -1) {
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
-            pthread_rwlock_unlock(&rwlock_b);
-            return 0;
-        }
+    // Finds and fills the first empty entry (hash 0 in the published copy,
+    // which matches the block while rwlock_b is held), unless another entry
+    // got the name since the caller looked it up
+    dir_snapshot_t const *current = atomic_load(&inode->i_dir_snapshot);
+    if (dir_snapshot_find(current, sub_name) != MAX_DIR_ENTRIES) {
+        data_block_write_end(meta.root_block);
+        pthread_rwlock_unlock(&st->rwlock_b);
+        shm_free(snapshot);
+        return -1; // name already in use
+    }
+    size_t i = scan_u32(current->hashes, MAX_DIR_ENTRIES, 0, 0);
+    if (i == MAX_DIR_ENTRIES) {
+        data_block_write_end(meta.root_block);
+        pthread_rwlock_unlock(&st->rwlock_b);
+        shm_free(snapshot);
+        return -1; // no space for entry
+    }
+    dir_entry[i].d_inumber = sub_inumber;
+    strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
+    dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
+    data_block_write_end(meta.root_block);
+    dir_snapshot_publish(inode, snapshot, dir_entry);
+    pthread_rwlock_unlock(&st->rwlock_b);
+    return 0;
+}
+
+/**
+ * Rename an entry of a directory, replacing the entry that already has the
+ * new name, if any. Lookups see either the old entries or the new ones: the
+ * change is published as a single copy of the directory.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - old_name: current name of the entry
+ *   - new_name: name it gets
+ *   - replaced: output, the inumber the replaced entry pointed to (whose
+ *     link count is left to the caller), or -1 if there was none
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - new_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
+ *   - Directory does not contain a file named old_name.
+ */
+int rename_dir_entry(inode_t *inode, char const *old_name,
+                     char const *new_name, int *replaced) {
+    struct state *st = STATE;
+    *replaced = -1;
+    if (strlen(new_name) == 0 || strlen(new_name) > MAX_FILE_NAME - 1) {
+        return -1; // invalid new_name
+    }
+
+    insert_delay(); // simulate storage access delay to inode with inumber
+    inode_meta_t meta = inode_meta_get(inode);
+    if (meta.type != T_DIRECTORY) {
+        return -1; // not a directory
     }
-    pthread_rwlock_unlock(&rwlock_b);
-    return -1; // no space for entry
+
+    dir_snapshot_t *snapshot = dir_snapshot_alloc();
+    if (snapshot == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&st->rwlock_b);
+    dir_entry_t *dir_entry = data_block_write_begin(meta.root_block);
+    ALWAYS_ASSERT(dir_entry != NULL,
+                  "rename_dir_entry: directory must have a data block");
+
+    // The published copy matches the block while rwlock_b is held
+    dir_snapshot_t const *current = atomic_load(&inode->i_dir_snapshot);
+    size_t from = dir_snapshot_find(current, old_name);
+    size_t to = dir_snapshot_find(current, new_name);
+    if (from == MAX_DIR_ENTRIES ||
+        (to != MAX_DIR_ENTRIES &&
+         dir_entry[to].d_inumber == dir_entry[from].d_inumber)) {
+        // nothing to rename, or both names are links to the same file
+        data_block_write_end(meta.root_block);
+        pthread_rwlock_unlock(&st->rwlock_b);
+        shm_free(snapshot);
+        return from == MAX_DIR_ENTRIES ? -1 : 0;
+    }
+    if (to != MAX_DIR_ENTRIES) {
+        *replaced = dir_entry[to].d_inumber;
+        dir_entry[to].d_inumber = dir_entry[from].d_inumber;
+        dir_entry[from].d_inumber = -1;
+        memset(dir_entry[from].d_name, 0, MAX_FILE_NAME);
+    } else {
+        memset(dir_entry[from].d_name, 0, MAX_FILE_NAME);
+        strncpy(dir_entry[from].d_name, new_name, MAX_FILE_NAME - 1);
+    }
+    data_block_write_end(meta.root_block);
+    dir_snapshot_publish(inode, snapshot, dir_entry);
+    pthread_rwlock_unlock(&st->rwlock_b);
+    return 0;
 }
 
 /**
@@ -410,35 +1922,80 @@ int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
  *   - Directory does not contain a file named sub_name.
  */
 int find_in_dir(inode_t const *inode, char const *sub_name) {
+    struct state *st = STATE;
     ALWAYS_ASSERT(inode != NULL, "find_in_dir: inode must be non-NULL");
     ALWAYS_ASSERT(sub_name != NULL, "find_in_dir: sub_name must be non-NULL");
 
     insert_delay(); // simulate storage access delay to inode with inumber
 
-    if (inode->i_node_type != T_DIRECTORY) {
+    inode_meta_t meta = inode_meta_get(inode);
+    if (meta.type != T_DIRECTORY) {
         return -1; // not a directory
     }
 
 
-    // Locates the block containing the entries of the directory
-    
-    pthread_rwlock_wrlock(&rwlock_b);
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "find_in_dir: directory inode must have a data block");
+    // Scans the published copy of the entries: lookups take no locks (but
+    // in shared volumes) and the copy is not freed before they are done
+    dir_read_begin();
+    dir_snapshot_t const *snapshot =
+        atomic_load_explicit(&inode->i_dir_snapshot, memory_order_acquire);
+    ALWAYS_ASSERT(snapshot != NULL,
+                  "find_in_dir: directory inode must have published entries");
+
+    // Looks for an entry that has the target name, comparing names only
+    // where the name hashes match
+    int sub_inumber = -1;
+    size_t i = dir_snapshot_find(snapshot, sub_name);
+    if (i != MAX_DIR_ENTRIES) {
+        sub_inumber = snapshot->entries[i].d_inumber;
+    }
+    dir_read_end();
 
-    // Iterates over the directory entries looking for one that has the target
-    // name
-    
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
-            pthread_rwlock_unlock(&rwlock_b);
-            int sub_inumber = dir_entry[i].d_inumber;
-            return sub_inumber;
+    return sub_inumber;
+}
+
+/**
+ * List the entries of a directory, with their sizes.
+ *
+ * Like find_in_dir, reads the published copy of the entries without locks.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - entries: output array
+ *   - max: capacity of entries
+ *
+ * Returns the number of entries in the directory, which can be larger than
+ * max (only the first max are stored), or -1 if inode is not a directory.
+ */
+ssize_t list_dir(inode_t const *inode, tfs_file_info *entries, size_t max) {
+    struct state *st = STATE;
+    insert_delay(); // simulate storage access delay to inode with inumber
+
+    if (inode_meta_get(inode).type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    dir_read_begin();
+    dir_snapshot_t const *snapshot =
+        atomic_load_explicit(&inode->i_dir_snapshot, memory_order_acquire);
+    ALWAYS_ASSERT(snapshot != NULL,
+                  "list_dir: directory inode must have published entries");
+
+    size_t found = 0;
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        dir_entry_t const *entry = &snapshot->entries[i];
+        if (entry->d_inumber == -1) {
+            continue;
+        }
+        if (found < max) {
+            memcpy(entries[found].name, entry->d_name, MAX_FILE_NAME);
+            entries[found].size = inode_size_of(entry->d_inumber);
         }
-    pthread_rwlock_unlock(&rwlock_b);
-    return -1; // entry not found
+        found++;
+    }
+    dir_read_end();
+
+    return (ssize_t)found;
 }
 
 /**
@@ -450,18 +2007,78 @@ int find_in_dir(inode_t const *inode, char const *sub_name) {
  *   - No free data blocks.
  */
 int data_block_alloc(void) {
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
-        }
+    struct state *st = STATE;
+    return alloc_pool_get(&st->block_pool);
+}
+
+/**
+ * Allocate several data blocks at once, preferring one contiguous run.
+ *
+ * Input:
+ *   - count: number of blocks to allocate
+ *   - reserved: whether the blocks were previously set aside with
+ *     data_block_reserve (the reservation is consumed)
+ *   - block_numbers: output array with room for count block numbers
+ *
+ * Returns 0 if successful, -1 otherwise (nothing is allocated on failure).
+ *
+ * Possible errors:
+ *   - Not enough (unreserved) free data blocks.
+ */
+int data_block_alloc_run(size_t count, bool reserved, int *block_numbers) {
+    struct state *st = STATE;
+    if (!reserved && alloc_pool_claim(&st->block_pool, count) == -1) {
+        return -1; // no space (the data region grows if it can)
+    }
 
-        if (free_blocks[i] == FREE) {
-            free_blocks[i] = TAKEN;
+    insert_delay(); // simulate storage access delay to free_blocks
+
+    alloc_pool_take(&st->block_pool, count, block_numbers);
+    return 0;
+}
 
-            return (int)i;
+/**
+ * Set aside free data blocks for a later data_block_alloc_run.
+ *
+ * Used by delayed allocation: the blocks are not chosen yet, but they can no
+ * longer be taken by other allocations.
+ *
+ * Input:
+ *   - count: number of blocks to reserve
+ *
+ * Returns 0 if successful, -1 if there are not enough free blocks.
+ */
+int data_block_reserve(size_t count) {
+    struct state *st = STATE;
+    return alloc_pool_claim(&st->block_pool, count);
+}
+
+/**
+ * Give back blocks previously reserved with data_block_reserve.
+ *
+ * Input:
+ *   - count: number of reserved blocks no longer needed
+ */
+void data_block_unreserve(size_t count) {
+    struct state *st = STATE;
+    alloc_pool_unclaim(&st->block_pool, count);
+}
+
+/**
+ * Drop one owner of a data block, if it has more than one.
+ *
+ * Returns true if the block is still in use (by its other owners).
+ */
+static bool block_drop_share(int block_number) {
+    struct state *st = STATE;
+    unsigned int shares = atomic_load(&st->block_shares[block_number]);
+    while (shares > 0) {
+        if (atomic_compare_exchange_weak(&st->block_shares[block_number],
+                                         &shares, shares - 1)) {
+            return true;
         }
     }
-    return -1;
+    return false;
 }
 
 /**
@@ -471,12 +2088,86 @@ int data_block_alloc(void) {
  *   - block_number: the block number/index
  */
 void data_block_free(int block_number) {
+    struct state *st = STATE;
     ALWAYS_ASSERT(valid_block_number(block_number),
                   "data_block_free: invalid block number");
 
+    if (block_drop_share(block_number)) {
+        return;
+    }
+
+    insert_delay(); // simulate storage access delay to free_blocks
+
+    atomic_store(&st->block_checksums[block_number], 0);
+    alloc_pool_put(&st->block_pool, block_number);
+}
+
+/**
+ * Free several data blocks (such as the tail of a file) with a single update
+ * of the free block bitmap.
+ *
+ * Input:
+ *   - block_numbers: the blocks; overwritten
+ *   - count: number of blocks
+ */
+void data_block_free_many(int *block_numbers, size_t count) {
+    struct state *st = STATE;
+    size_t unowned = 0;
+    for (size_t i = 0; i < count; i++) {
+        ALWAYS_ASSERT(valid_block_number(block_numbers[i]),
+                      "data_block_free_many: invalid block number");
+        if (!block_drop_share(block_numbers[i])) {
+            atomic_store(&st->block_checksums[block_numbers[i]], 0);
+            block_numbers[unowned++] = block_numbers[i];
+        }
+    }
+    if (unowned == 0) {
+        return;
+    }
+
     insert_delay(); // simulate storage access delay to free_blocks
 
-    free_blocks[block_number] = FREE;
+    alloc_pool_put_many(&st->block_pool, block_numbers, unowned);
+}
+
+/**
+ * Whether a data block has more than one owner (files, clones, snapshots).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+bool data_block_shared(int block_number) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_shared: invalid block number");
+    return atomic_load(&st->block_shares[block_number]) > 0;
+}
+
+/**
+ * Count the owners of a data block (files, clones, snapshots).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+unsigned int data_block_owners(int block_number) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_owners: invalid block number");
+    return atomic_load(&st->block_shares[block_number]) + 1;
+}
+
+/**
+ * Add an owner to a data block that is in use (it is only freed once every
+ * owner called data_block_free).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_hold(int block_number) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_hold: invalid block number");
+    atomic_fetch_add(&st->block_shares[block_number], 1);
 }
 
 /**
@@ -488,11 +2179,509 @@ void data_block_free(int block_number) {
  * Returns a pointer to the first byte of the block.
  */
 void *data_block_get(int block_number) {
+    struct state *st = STATE;
     ALWAYS_ASSERT(valid_block_number(block_number),
                   "data_block_get: invalid block number");
 
     insert_delay(); // simulate storage access delay to block
-    return &fs_data[(size_t)block_number * BLOCK_SIZE];
+    return &st->fs_data[(size_t)block_number * BLOCK_SIZE];
+}
+
+static pthread_mutex_t *block_lock(int block_number) {
+    struct state *st = STATE;
+    return &st->block_locks[(size_t)block_number % CHECKSUM_LOCK_STRIPES];
+}
+
+/**
+ * Start changing the contents of a data block. With checksums
+ * (tfs_params.checksums), readers verifying the block and the scrubber are
+ * held off until data_block_write_end, which updates its checksum.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *
+ * Returns a pointer to the first byte of the block.
+ */
+void *data_block_write_begin(int block_number) {
+    struct state *st = STATE;
+    void *block = data_block_get(block_number);
+    if (st->fs_params.checksums) {
+        shm_mutex_lock(block_lock(block_number));
+    }
+    return block;
+}
+
+/**
+ * Finish the changes started with data_block_write_begin.
+ */
+void data_block_write_end(int block_number) {
+    struct state *st = STATE;
+    if (st->fs_params.checksums) {
+        uint32_t crc = crc32c(
+            0, &st->fs_data[(size_t)block_number * BLOCK_SIZE], BLOCK_SIZE);
+        atomic_store(&st->block_checksums[block_number], CHECKSUM_VALID | crc);
+        pthread_mutex_unlock(block_lock(block_number));
+    }
+}
+
+/**
+ * Update the checksum of a data block that was filled through
+ * data_block_get while no one else could see it (just allocated).
+ */
+void data_block_seal(int block_number) {
+    data_block_write_begin(block_number);
+    data_block_write_end(block_number);
+}
+
+/**
+ * Start reading a data block, verifying its checksum first (if it has one).
+ * The block does not change until data_block_read_end.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *
+ * Returns a pointer to the first byte of the block, or NULL if the checksum
+ * does not match (counted in tfs_stats.checksum_errors; there is nothing to
+ * end then).
+ */
+void const *data_block_read_begin(int block_number) {
+    struct state *st = STATE;
+    void const *block = data_block_get(block_number);
+    if (!st->fs_params.checksums) {
+        return block;
+    }
+
+    shm_mutex_lock(block_lock(block_number));
+    uint64_t stored = atomic_load(&st->block_checksums[block_number]);
+    if ((stored & CHECKSUM_VALID) != 0 &&
+        (uint32_t)stored != crc32c(0, block, BLOCK_SIZE)) {
+        pthread_mutex_unlock(block_lock(block_number));
+        atomic_fetch_add(&st->checksum_errors, 1);
+        return NULL;
+    }
+    return block;
+}
+
+/**
+ * Finish the read started with data_block_read_begin.
+ */
+void data_block_read_end(int block_number) {
+    struct state *st = STATE;
+    if (st->fs_params.checksums) {
+        pthread_mutex_unlock(block_lock(block_number));
+    }
+}
+
+/**
+ * Verify the checksum of a data block, if it is in use and has one.
+ *
+ * Returns 0 if it matches (or there is none), -1 otherwise.
+ */
+int data_block_verify(int block_number) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_verify: invalid block number");
+    if (st->free_blocks[block_number] != TAKEN) {
+        return 0;
+    }
+    if (data_block_read_begin(block_number) == NULL) {
+        return -1;
+    }
+    data_block_read_end(block_number);
+    return 0;
+}
+
+/**
+ * Make a copy of a file or symlink that shares its blocks.
+ * The inode must not change meanwhile (see snapshot_create and inode_clone).
+ *
+ * Input:
+ *   - inumber: the inode to copy
+ *   - frozen: whether the copy is part of a snapshot (read-only)
+ *
+ * Returns the inumber of the copy, or -1 if the inode table is full.
+ */
+static int inode_copy_shared(int inumber, bool frozen) {
+    struct state *st = STATE;
+    inode_t const *inode = &st->inode_table[inumber];
+    inode_meta_t meta = inode_meta_get(inode);
+    ALWAYS_ASSERT(meta.type != T_DIRECTORY,
+                  "inode_copy_shared: directories are not copied");
+
+    int copy = inode_create(meta.type);
+    if (copy == -1) {
+        return -1;
+    }
+
+    inode_t *target = &st->inode_table[copy];
+    inode_meta_write_begin(target);
+    target->i_size = meta.size;
+    for (size_t i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+        int bnum = inode->i_data_blocks[i];
+        if (bnum != -1) {
+            atomic_fetch_add(&st->block_shares[bnum], 1);
+        }
+        target->i_data_blocks[i] = bnum;
+        target->i_block_extents[i] = inode->i_block_extents[i];
+    }
+    target->i_frozen = frozen;
+    inode_meta_write_end(target);
+    atomic_store(&target->i_tail, meta.size);
+    return copy;
+}
+
+/**
+ * Clone a file: create an inode with the same contents that shares the
+ * file's data blocks. Only the block map is copied; whichever of the two
+ * changes a shared block first copies it (copy-on-write).
+ *
+ * Input:
+ *   - inumber: the file to clone (not a directory)
+ *   - flush: called once writes to the file are held off, to write back its
+ *     buffered data (may be NULL)
+ *
+ * Returns the inumber of the clone, or -1 if the inode table is full.
+ */
+int inode_clone(int inumber, void (*flush)(int)) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_clone: invalid inumber");
+    inode_t *inode = &st->inode_table[inumber];
+
+    range_t range;
+    range_lock(&inode->i_range_lock, &range, -1, 0, SIZE_MAX);
+    if (flush != NULL) {
+        flush(inumber);
+    }
+    int copy = inode_copy_shared(inumber, false);
+    range_unlock(&inode->i_range_lock, &range);
+    return copy;
+}
+
+/**
+ * Take a snapshot of the file system: a frozen copy of the root directory
+ * whose entries point to frozen copies of the files.
+ *
+ * Only metadata is copied (one inode per file): the copies share their data
+ * blocks with the live files, which copy a block before changing it
+ * (copy-on-write). Directory changes and writes are held off while the
+ * copies are made, so the snapshot is a single point in time.
+ *
+ * Input:
+ *   - flush: called once writes are held off, to write back buffered data
+ *     (may be NULL)
+ *
+ * Returns the snapshot's number, or -1 in the case of error.
+ *
+ * Possible errors:
+ *   - MAX_SNAPSHOTS snapshots already exist.
+ *   - No free inodes for the copies.
+ */
+int snapshot_create(void (*flush)(void)) {
+    struct state *st = STATE;
+    shm_mutex_lock(&st->snapshots_lock);
+    int id = 0;
+    while (id < MAX_SNAPSHOTS && st->snapshots[id] != -1) {
+        id++;
+    }
+    int *copies = malloc(MAX_DIR_ENTRIES * sizeof(int));
+    range_t *ranges = malloc(MAX_DIR_ENTRIES * sizeof(range_t));
+    dir_snapshot_t *published = dir_snapshot_alloc();
+    int root_copy = -1;
+    if (id == MAX_SNAPSHOTS || copies == NULL || ranges == NULL ||
+        published == NULL || (root_copy = inode_create(T_DIRECTORY)) == -1) {
+        pthread_mutex_unlock(&st->snapshots_lock);
+        free(copies);
+        free(ranges);
+        shm_free(published);
+        return -1;
+    }
+
+    // Hold off directory changes, then writes to each file (once per inode,
+    // as hard links share one)
+    pthread_rwlock_wrlock(&st->rwlock_b);
+    inode_t *root = &st->inode_table[ROOT_DIR_INUM];
+    dir_entry_t const *entries =
+        data_block_get(inode_meta_get(root).root_block);
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        copies[i] = -1;
+        int inumber = entries[i].d_inumber;
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; j++) {
+            seen = entries[j].d_inumber == inumber;
+        }
+        if (inumber != -1 && !seen) {
+            range_lock(&st->inode_table[inumber].i_range_lock, &ranges[i], -1,
+                       0, SIZE_MAX);
+        }
+    }
+    if (flush != NULL) {
+        flush();
+    }
+
+    // Freeze every file
+    bool failed = false;
+    for (size_t i = 0; i < MAX_DIR_ENTRIES && !failed; i++) {
+        int inumber = entries[i].d_inumber;
+        if (inumber == -1) {
+            continue;
+        }
+        for (size_t j = 0; j < i && copies[i] == -1; j++) {
+            if (entries[j].d_inumber == inumber) {
+                copies[i] = copies[j];
+            }
+        }
+        if (copies[i] == -1) {
+            copies[i] = inode_copy_shared(inumber, true);
+            failed = copies[i] == -1;
+        }
+    }
+
+    if (!failed) {
+        inode_t *frozen_root = &st->inode_table[root_copy];
+        int frozen_block = inode_meta_get(frozen_root).root_block;
+        dir_entry_t *frozen_entries = data_block_write_begin(frozen_block);
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            frozen_entries[i] = entries[i];
+            frozen_entries[i].d_inumber = copies[i];
+        }
+        data_block_write_end(frozen_block);
+        dir_snapshot_publish(frozen_root, published, frozen_entries);
+        frozen_root->i_frozen = true;
+        st->snapshots[id] = root_copy;
+    }
+
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        int inumber = entries[i].d_inumber;
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; j++) {
+            seen = entries[j].d_inumber == inumber;
+        }
+        if (inumber != -1 && !seen) {
+            range_unlock(&st->inode_table[inumber].i_range_lock, &ranges[i]);
+            if (failed && copies[i] != -1) {
+                inode_delete(copies[i]);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&st->rwlock_b);
+
+    if (failed) {
+        inode_delete(root_copy);
+        shm_free(published);
+        id = -1;
+    }
+    pthread_mutex_unlock(&st->snapshots_lock);
+    free(copies);
+    free(ranges);
+    return id;
+}
+
+/**
+ * Find a file in a snapshot. If found, the snapshot cannot be deleted until
+ * snapshot_lookup_end is called (so the file can be opened meanwhile).
+ *
+ * Input:
+ *   - snapshot: the snapshot's number
+ *   - name: the file's name (without the leading '/')
+ *
+ * Returns the inumber of the file's frozen copy, or -1 if there is no such
+ * snapshot or file.
+ */
+int snapshot_lookup(int snapshot, char const *name) {
+    struct state *st = STATE;
+    if (snapshot < 0 || snapshot >= MAX_SNAPSHOTS) {
+        return -1;
+    }
+    shm_mutex_lock(&st->snapshots_lock);
+    int root_copy = st->snapshots[snapshot];
+    int inumber = root_copy == -1
+                      ? -1
+                      : find_in_dir(&st->inode_table[root_copy], name);
+    if (inumber == -1) {
+        pthread_mutex_unlock(&st->snapshots_lock);
+    }
+    return inumber;
+}
+
+/**
+ * Let snapshots be deleted again, after a successful snapshot_lookup.
+ */
+void snapshot_lookup_end(void) {
+    struct state *st = STATE;
+    pthread_mutex_unlock(&st->snapshots_lock);
+}
+
+/**
+ * Delete a snapshot, releasing its inodes and its shares of the blocks.
+ *
+ * Input:
+ *   - snapshot: the snapshot's number
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No such snapshot.
+ *   - Some of its files are open.
+ */
+int snapshot_delete(int snapshot) {
+    struct state *st = STATE;
+    if (snapshot < 0 || snapshot >= MAX_SNAPSHOTS) {
+        return -1;
+    }
+    shm_mutex_lock(&st->snapshots_lock);
+    int root_copy = st->snapshots[snapshot];
+    if (root_copy == -1) {
+        pthread_mutex_unlock(&st->snapshots_lock);
+        return -1;
+    }
+
+    // Frozen: the entries no longer change
+    dir_entry_t const *entries =
+        data_block_get(inode_meta_get(&st->inode_table[root_copy]).root_block);
+
+    // (no handle can be opened on them until they are deleted)
+    pthread_rwlock_wrlock(&st->rwlock_a);
+    for (int f = 0; f < MAX_OPEN_FILES; f++) {
+        if (st->free_open_file_entries[f] != TAKEN) {
+            continue;
+        }
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            if (entries[i].d_inumber != -1 &&
+                entries[i].d_inumber == st->open_file_table[f].of_inumber) {
+                pthread_rwlock_unlock(&st->rwlock_a);
+                pthread_mutex_unlock(&st->snapshots_lock);
+                return -1; // in use
+            }
+        }
+    }
+
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        int inumber = entries[i].d_inumber;
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; j++) {
+            seen = entries[j].d_inumber == inumber;
+        }
+        if (inumber != -1 && !seen) {
+            inode_delete(inumber);
+        }
+    }
+    pthread_rwlock_unlock(&st->rwlock_a);
+    inode_delete(root_copy);
+    st->snapshots[snapshot] = -1;
+    pthread_mutex_unlock(&st->snapshots_lock);
+    return 0;
+}
+
+/**
+ * Whether a file is open in some handle.
+ * Must be called with rwlock_a held.
+ */
+static bool inode_is_open_locked(int inumber) {
+    struct state *st = STATE;
+    bool open = false;
+    for (int f = 0; f < MAX_OPEN_FILES && !open; f++) {
+        open = st->free_open_file_entries[f] == TAKEN &&
+               st->open_file_table[f].of_inumber == inumber;
+    }
+    return open;
+}
+
+/**
+ * Drop a link to an inode whose directory entry was just removed.
+ *
+ * An inode left without links while open is only deleted once its last
+ * handle is closed (see remove_from_open_file_table), so readers that opened
+ * it before an unlink, or before a rename onto its name, can finish.
+ *
+ * Input:
+ *   - inumber: the inode
+ *
+ * Returns true if the inode has no links left and is not open: the caller
+ * must then delete it.
+ */
+bool inode_drop_link(int inumber) {
+    struct state *st = STATE;
+    ALWAYS_ASSERT(valid_inumber(inumber), "inode_drop_link: invalid inumber");
+    inode_t *inode = &st->inode_table[inumber];
+
+    // (rwlock_a keeps handles from being opened or closed meanwhile)
+    pthread_rwlock_wrlock(&st->rwlock_a);
+    inode_meta_write_begin(inode);
+    int links = --inode->hardlinks_counter;
+    inode_meta_write_end(inode);
+    bool unused = links == 0 && !inode_is_open_locked(inumber);
+    pthread_rwlock_unlock(&st->rwlock_a);
+    return unused;
+}
+
+/**
+ * Deduplicate the full data blocks of the files that are not open: each
+ * block is replaced by the identical block that canonical returns (if it is
+ * another one), which then gains an owner.
+ *
+ * Files are handled one at a time, each with its directory entry held in
+ * place, its writes held off and no file opened meanwhile (reads take no
+ * lock, so a file opened mid-swap could still be reading the blocks freed).
+ *
+ * Input:
+ *   - canonical: returns an identical block to use instead of the given one
+ *     (or that one); it must own the block it returns, so it cannot change
+ *   - flush: called once writes to a file are held off, to write back its
+ *     buffered data (may be NULL)
+ *
+ * Returns the number of blocks that were replaced.
+ */
+size_t dedup_files(int (*canonical)(int block_number),
+                   void (*flush)(int inumber)) {
+    struct state *st = STATE;
+    inode_t const *root = &st->inode_table[ROOT_DIR_INUM];
+    size_t replaced = 0;
+
+    for (size_t e = 0; e < MAX_DIR_ENTRIES; e++) {
+        // (tfs_unlink removes the entry before the inode)
+        pthread_rwlock_rdlock(&st->rwlock_b);
+        dir_entry_t const *entries =
+            data_block_get(inode_meta_get(root).root_block);
+        int inumber = entries[e].d_inumber;
+        pthread_rwlock_rdlock(&st->rwlock_a);
+        if (inumber == -1 || inode_is_open_locked(inumber) ||
+            inode_meta_get(&st->inode_table[inumber]).type != T_FILE) {
+            pthread_rwlock_unlock(&st->rwlock_a);
+            pthread_rwlock_unlock(&st->rwlock_b);
+            continue;
+        }
+        inode_t *inode = &st->inode_table[inumber];
+
+        range_t range;
+        range_lock(&inode->i_range_lock, &range, -1, 0, SIZE_MAX);
+        if (flush != NULL) {
+            flush(inumber);
+        }
+        size_t full_blocks = inode_meta_get(inode).size / BLOCK_SIZE;
+        for (size_t i = 0; i < full_blocks; i++) {
+            // (compressed blocks hold more than their own contents)
+            int bnum = inode->i_data_blocks[i];
+            if (bnum == -1 || inode->i_block_extents[i].length != 0) {
+                continue;
+            }
+            int same = canonical(bnum);
+            if (same == bnum) {
+                continue;
+            }
+            data_block_hold(same);
+            shm_mutex_lock(&st->block_map_lock);
+            inode_meta_write_begin(inode);
+            inode->i_data_blocks[i] = same;
+            inode_meta_write_end(inode);
+            pthread_mutex_unlock(&st->block_map_lock);
+            data_block_free(bnum);
+            replaced++;
+        }
+        range_unlock(&inode->i_range_lock, &range);
+        pthread_rwlock_unlock(&st->rwlock_a);
+        pthread_rwlock_unlock(&st->rwlock_b);
+    }
+    return replaced;
 }
 
 /**
@@ -501,24 +2690,36 @@ void *data_block_get(int block_number) {
  * Input:
  *   - inumber: inode number of the file to open
  *   - offset: initial offset
+ *   - mode: mode the file was opened with
  *
  * Returns file handle if successful, -1 otherwise.
  *
  * Possible errors:
  *   - No space in open file table for a new open file.
  */
-int add_to_open_file_table(int inumber, size_t offset) {
-    pthread_rwlock_wrlock(&rwlock_a);
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == FREE) {
-            free_open_file_entries[i] = TAKEN;
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-            pthread_rwlock_unlock(&rwlock_a);
-            return i;
-        }
+int add_to_open_file_table(int inumber, size_t offset, tfs_file_mode_t mode) {
+    struct state *st = STATE;
+    pthread_rwlock_wrlock(&st->rwlock_a);
+    if (st->inode_table[inumber].hardlinks_counter == 0) {
+        pthread_rwlock_unlock(&st->rwlock_a);
+        return -1; // unlinked since it was looked up
     }
-    pthread_rwlock_unlock(&rwlock_a);
+    int i = 0;
+    do {
+        for (; i < MAX_OPEN_FILES; i++) {
+            if (st->free_open_file_entries[i] == FREE) {
+                st->free_open_file_entries[i] = TAKEN;
+                st->open_file_table[i].of_inumber = inumber;
+                st->open_file_table[i].of_offset = offset;
+                st->open_file_table[i].of_mode = mode;
+                st->open_file_used++;
+                pthread_rwlock_unlock(&st->rwlock_a);
+                return i;
+            }
+        }
+        // table full: grow it and look at the new entries
+    } while (grow_open_files() == 0);
+    pthread_rwlock_unlock(&st->rwlock_a);
     return -1;
 }
 
@@ -527,17 +2728,25 @@ int add_to_open_file_table(int inumber, size_t offset) {
  *
  * Input:
  *   - fhandle: file handle to free/close
+ *
+ * Returns true if the file has no links left (see inode_drop_link) and this
+ * was its last handle: the caller must then delete it.
  */
-void remove_from_open_file_table(int fhandle) {
+bool remove_from_open_file_table(int fhandle) {
+    struct state *st = STATE;
     ALWAYS_ASSERT(valid_file_handle(fhandle),
                   "remove_from_open_file_table: file handle must be valid");
 
-    ALWAYS_ASSERT(free_open_file_entries[fhandle] == TAKEN,
+    ALWAYS_ASSERT(st->free_open_file_entries[fhandle] == TAKEN,
                   "remove_from_open_file_table: file handle must be taken");
-    pthread_rwlock_wrlock(&rwlock_a);
-    free_open_file_entries[fhandle] = FREE;
-    pthread_rwlock_unlock(&rwlock_a);
-
+    pthread_rwlock_wrlock(&st->rwlock_a);
+    st->free_open_file_entries[fhandle] = FREE;
+    st->open_file_used--;
+    int inumber = st->open_file_table[fhandle].of_inumber;
+    bool orphan = st->inode_table[inumber].hardlinks_counter == 0 &&
+                  !inode_is_open_locked(inumber);
+    pthread_rwlock_unlock(&st->rwlock_a);
+    return orphan;
 }
 
 /**
@@ -550,13 +2759,14 @@ void remove_from_open_file_table(int fhandle) {
  * opened.
  */
 open_file_entry_t *get_open_file_entry(int fhandle) {
+    struct state *st = STATE;
     if (!valid_file_handle(fhandle)) {
         return NULL;
     }
 
-    if (free_open_file_entries[fhandle] != TAKEN) {
+    if (st->free_open_file_entries[fhandle] != TAKEN) {
         return NULL;
     }
 
-    return &open_file_table[fhandle];
+    return &st->open_file_table[fhandle];
 }
@@ -1,10 +1,17 @@
 #ifndef STATE_H
 #define STATE_H
 
+#include "alloc.h"
 #include "config.h"
+#include "epoch.h"
 #include "operations.h"
+#include "rangelock.h"
 
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -17,50 +24,169 @@ typedef struct {
     int d_inumber;
 } dir_entry_t;
 
+/**
+ * Published copy of a directory's entries, read without locks (see
+ * find_in_dir)
+ */
+typedef struct {
+    epoch_entry_t retired;
+    uint32_t *hashes;     // name hash of each entry, 0 for free entries
+    dir_entry_t *entries; // copy of the entries
+} dir_snapshot_t;
+
 typedef enum { T_FILE, T_DIRECTORY, T_SYMLINK } inode_type;
 
+/**
+ * Where a compressed file block is kept: a byte range of its data block,
+ * which may hold several (see compress.c)
+ */
+typedef struct {
+    uint16_t offset;
+    uint16_t length; // 0 if the block is stored whole, uncompressed
+} block_extent_t;
+
+/*
+ * Unless built with TFS_PACKED_LAYOUT (make LAYOUT=packed), the fields that
+ * writes update start on a cache line of their own, apart from the
+ * read-mostly ones, and inodes and open file entries are padded to whole
+ * cache lines, so that neighbours in the tables never share one.
+ */
+#ifdef TFS_PACKED_LAYOUT
+#define CACHE_ALIGNED
+#else
+#define CACHE_ALIGNED alignas(CACHE_LINE_SIZE)
+#endif
+
 /**
  * Inode
  */
 typedef struct {
-    inode_type i_node_type;
+    // Hot: updated by writes
+
+    // metadata sequence lock: odd while i_node_type, i_size,
+    // hardlinks_counter or the block map are being changed (see
+    // inode_meta_write_begin); lets readers take a consistent snapshot
+    // without writing to the inode
+    CACHE_ALIGNED atomic_uint i_meta_seq;
 
     size_t i_size;
-    int i_data_block;
+
+    // atomic appends: bytes reserved so far (i_size only advances, in order,
+    // as appends complete, so it acts as the commit index)
+    atomic_size_t i_tail;
+    pthread_mutex_t i_commit_lock;
+    pthread_cond_t i_commit_cond;
+
+    // byte ranges locked by writes and tfs_lock_range
+    range_lock_t i_range_lock;
+
+    // Cold: set on creation, read-mostly afterwards
+
+    CACHE_ALIGNED inode_type i_node_type;
     int hardlinks_counter;
+    int i_data_blocks[MAX_BLOCKS_PER_FILE]; // -1 if not allocated
+    block_extent_t i_block_extents[MAX_BLOCKS_PER_FILE];
+
+    // directories: current copy of the entries, replaced on every change
+    _Atomic(dir_snapshot_t *) i_dir_snapshot;
+
+    // part of a snapshot (see snapshot_create): read-only, and its blocks may
+    // be shared with the live file
+    bool i_frozen;
 
     // in a more complete FS, more fields could exist here
 } inode_t;
 
-typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
+/**
+ * Consistent snapshot of an inode's metadata
+ */
+typedef struct {
+    inode_type type;
+    size_t size;
+    int links;
+    int root_block; // first entry of the block map
+} inode_meta_t;
 
 /**
  * Open file entry (in open file table)
  */
 typedef struct {
+    CACHE_ALIGNED atomic_size_t of_offset; // (readers claim ranges of it)
     int of_inumber;
-    size_t of_offset;
+    tfs_file_mode_t of_mode;
 } open_file_entry_t;
 
 int state_init(tfs_params);
 int state_destroy(void);
+int state_get_stats(tfs_stats *stats);
+int state_statfs(tfs_statfs_info *info);
 
 size_t state_block_size(void);
+size_t state_max_file_size(void);
 
 int inode_create(inode_type n_type);
 void inode_delete(int inumber);
+bool inode_drop_link(int inumber);
 inode_t *inode_get(int inumber);
-
-int clear_dir_entry(inode_t *inode, char const *sub_name);
+inode_meta_t inode_meta_get(inode_t const *inode);
+void inode_meta_write_begin(inode_t *inode);
+void inode_meta_write_end(inode_t *inode);
+int inode_verify(int inumber);
+size_t inode_scan(inode_type type, int *inumbers, size_t *sizes, size_t max);
+size_t inode_total_size(inode_type type);
+size_t inode_size_of(int inumber);
+void inode_truncate(inode_t *inode, int owner);
+ssize_t inode_write_data(inode_t *inode, size_t offset, void const *buffer,
+                         size_t len);
+int inode_read_data(inode_t const *inode, size_t offset, void *buffer,
+                    size_t len);
+int inode_read_block(inode_t const *inode, size_t index, void *page);
+ssize_t inode_seek(inode_t const *inode, size_t offset, bool data);
+void inode_extend_size(inode_t *inode, size_t size);
+size_t inode_size_reserve(inode_t *inode, size_t end);
+size_t inode_size_commit(inode_t *inode, size_t start, size_t end,
+                         size_t done);
+int inode_preallocate(int inumber, size_t offset, size_t len, int owner,
+                      void (*flush)(int));
+int inode_resize(int inumber, size_t size, int owner, void (*flush)(int));
+int inode_block_unshare(inode_t *inode, size_t index, bool reserved);
+int inode_clone(int inumber, void (*flush)(int));
+size_t inode_append_reserve(inode_t *inode, size_t len, size_t *start);
+
+int clear_dir_entry(inode_t *inode, char const *sub_name, int *cleared);
 int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber);
+int rename_dir_entry(inode_t *inode, char const *old_name,
+                     char const *new_name, int *replaced);
 int find_in_dir(inode_t const *inode, char const *sub_name);
+ssize_t list_dir(inode_t const *inode, tfs_file_info *entries, size_t max);
 
 int data_block_alloc(void);
+int data_block_alloc_run(size_t count, bool reserved, int *block_numbers);
+int data_block_reserve(size_t count);
+void data_block_unreserve(size_t count);
 void data_block_free(int block_number);
+void data_block_free_many(int *block_numbers, size_t count);
+bool data_block_shared(int block_number);
+unsigned int data_block_owners(int block_number);
+void data_block_hold(int block_number);
 void *data_block_get(int block_number);
-
-int add_to_open_file_table(int inumber, size_t offset);
-void remove_from_open_file_table(int fhandle);
+void *data_block_write_begin(int block_number);
+void data_block_write_end(int block_number);
+void data_block_seal(int block_number);
+void const *data_block_read_begin(int block_number);
+void data_block_read_end(int block_number);
+int data_block_verify(int block_number);
+
+int snapshot_create(void (*flush)(void));
+int snapshot_lookup(int snapshot, char const *name);
+void snapshot_lookup_end(void);
+int snapshot_delete(int snapshot);
+
+size_t dedup_files(int (*canonical)(int block_number),
+                   void (*flush)(int inumber));
+
+int add_to_open_file_table(int inumber, size_t offset, tfs_file_mode_t mode);
+bool remove_from_open_file_table(int fhandle);
 open_file_entry_t *get_open_file_entry(int fhandle);
 
 #endif // STATE_H
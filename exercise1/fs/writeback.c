@@ -0,0 +1,713 @@
+#include "writeback.h"
+#include "betterassert.h"
+#include "compress.h"
+#include "instance.h"
+#include "state.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Write-back cache.
+ *
+ * When enabled, tfs_write only copies into per-inode page buffers (one page
+ * per file block) and records the dirty byte ranges. Blocks for pages that
+ * have no backing block yet are only reserved, not chosen; the actual
+ * allocation is delayed until the inode is flushed, at which point each group
+ * of consecutive new pages is allocated as one contiguous run. Adjacent and
+ * overlapping dirty ranges are coalesced, so a stream of tiny writes ends up
+ * as a few large copies into fs_data.
+ *
+ * The same cache serves the small-append coalescing mode (write_back off,
+ * append_flush_threshold set): only appends at the end of the file that are
+ * shorter than the threshold are buffered, so a stream of small messages is
+ * merged into one block-level write once threshold bytes are pending. Any
+ * other write first flushes the inode and then goes straight to its blocks.
+ *
+ * An inode is flushed by a background thread once its oldest buffered byte
+ * is older than the deadline (flush_interval_ms, or append_flush_deadline_ms
+ * when coalescing appends), or synchronously by the writer once more than
+ * max_dirty_bytes are buffered.
+ */
+
+// Dirty ranges kept per inode before the closest ones are merged
+#define WB_MAX_EXTENTS (8)
+
+typedef struct {
+    size_t start;
+    size_t end; // exclusive
+} wb_extent_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    char *pages[MAX_BLOCKS_PER_FILE]; // cached copy of each block, or NULL
+    // the page had no backing block: a block is reserved to allocate on flush
+    bool unmapped[MAX_BLOCKS_PER_FILE];
+    // the page's block is shared (with a snapshot or a clone): a block is
+    // reserved to copy it to on flush
+    bool cow[MAX_BLOCKS_PER_FILE];
+    wb_extent_t extents[WB_MAX_EXTENTS + 1]; // sorted, disjoint, non-adjacent
+    size_t extent_count;
+    size_t dirty_bytes;
+    atomic_bool dirty;
+    atomic_uint_fast64_t dirty_since_ms; // when the inode last became dirty
+} wb_inode_t;
+
+// Cache of an instance (see instance.h), if enabled
+struct wb {
+    bool write_back; // buffer every write, not only small appends
+    wb_inode_t *wb_inodes;
+    size_t wb_inode_count;
+    size_t block_size;
+    size_t max_dirty_bytes;
+    size_t append_threshold;
+    unsigned int deadline_ms;
+    atomic_size_t total_dirty_bytes;
+
+    pthread_t flusher;
+    pthread_mutex_t flusher_lock;
+    pthread_cond_t flusher_cond;
+    bool flusher_stop;
+};
+
+#define WB (tfs_current->wb)
+
+static uint64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/**
+ * Flush every inode whose buffered data reached the deadline.
+ *
+ * Returns the number of milliseconds until the next inode expires.
+ */
+static uint64_t flush_expired(void) {
+    struct wb *wb = WB;
+    uint64_t next = wb->deadline_ms;
+    uint64_t now = now_ms();
+
+    for (size_t i = 0; i < wb->wb_inode_count; i++) {
+        if (!atomic_load(&wb->wb_inodes[i].dirty)) {
+            continue;
+        }
+
+        uint64_t age = now - atomic_load(&wb->wb_inodes[i].dirty_since_ms);
+        if (age >= wb->deadline_ms) {
+            wb_flush((int)i);
+        } else if (wb->deadline_ms - age < next) {
+            next = wb->deadline_ms - age;
+        }
+    }
+
+    return next;
+}
+
+/**
+ * Background flusher: writes back inodes as their deadlines expire.
+ */
+static void *wb_flusher(void *arg) {
+    instance_enter(arg); // the instance that started it
+    struct wb *wb = WB;
+
+    uint64_t wait_ms = wb->deadline_ms;
+    pthread_mutex_lock(&wb->flusher_lock);
+    while (!wb->flusher_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += (time_t)(wait_ms / 1000);
+        deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&wb->flusher_cond, &wb->flusher_lock, &deadline);
+        if (wb->flusher_stop) {
+            break;
+        }
+
+        pthread_mutex_unlock(&wb->flusher_lock);
+        wait_ms = flush_expired();
+        pthread_mutex_lock(&wb->flusher_lock);
+    }
+    pthread_mutex_unlock(&wb->flusher_lock);
+
+    return NULL;
+}
+
+/**
+ * Initialize the write-back cache (a no-op unless params->write_back or
+ * params->append_flush_threshold is set).
+ *
+ * Input:
+ *   - params: TécnicoFS parameters
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - The flush deadline is 0.
+ *   - malloc or thread creation failure.
+ */
+int wb_init(tfs_params const *params) {
+    if (!params->write_back && params->append_flush_threshold == 0) {
+        return 0; // not enabled
+    }
+
+    unsigned int deadline_ms = params->write_back
+                                   ? params->flush_interval_ms
+                                   : params->append_flush_deadline_ms;
+    if (deadline_ms == 0) {
+        return -1;
+    }
+
+    struct wb *wb = calloc(1, sizeof(struct wb));
+    if (wb == NULL) {
+        return -1;
+    }
+    wb->write_back = params->write_back;
+    wb->append_threshold = params->append_flush_threshold;
+    wb->deadline_ms = deadline_ms;
+
+    // room for every inode the table can grow to
+    wb->wb_inode_count = params->inode_count_limit > params->max_inode_count
+                             ? params->inode_count_limit
+                             : params->max_inode_count;
+    wb->block_size = params->block_size;
+    wb->max_dirty_bytes = params->max_dirty_bytes;
+    atomic_store(&wb->total_dirty_bytes, 0);
+
+    wb->wb_inodes = calloc(wb->wb_inode_count, sizeof(wb_inode_t));
+    if (wb->wb_inodes == NULL) {
+        free(wb);
+        return -1;
+    }
+
+    for (size_t i = 0; i < wb->wb_inode_count; i++) {
+        pthread_mutex_init(&wb->wb_inodes[i].lock, NULL);
+        atomic_init(&wb->wb_inodes[i].dirty, false);
+        atomic_init(&wb->wb_inodes[i].dirty_since_ms, 0);
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wb->flusher_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&wb->flusher_lock, NULL);
+
+    WB = wb;
+    wb->flusher_stop = false;
+    if (pthread_create(&wb->flusher, NULL, wb_flusher, tfs_current) != 0) {
+        WB = NULL;
+        pthread_cond_destroy(&wb->flusher_cond);
+        pthread_mutex_destroy(&wb->flusher_lock);
+        free(wb->wb_inodes);
+        free(wb);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stop the flusher, write back every dirty inode and release the cache.
+ */
+void wb_destroy(void) {
+    struct wb *wb = WB;
+    if (wb == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&wb->flusher_lock);
+    wb->flusher_stop = true;
+    pthread_cond_signal(&wb->flusher_cond);
+    pthread_mutex_unlock(&wb->flusher_lock);
+    pthread_join(wb->flusher, NULL);
+
+    wb_flush_all();
+
+    for (size_t i = 0; i < wb->wb_inode_count; i++) {
+        pthread_mutex_destroy(&wb->wb_inodes[i].lock);
+    }
+    pthread_cond_destroy(&wb->flusher_cond);
+    pthread_mutex_destroy(&wb->flusher_lock);
+    free(wb->wb_inodes);
+    free(wb);
+    WB = NULL;
+}
+
+bool wb_enabled(void) { return WB != NULL; }
+
+/**
+ * Record [start, end) as dirty, coalescing it with overlapping or adjacent
+ * ranges. If that leaves too many ranges, the two closest ones are merged
+ * (the gap between them is clean, so writing it back again is harmless).
+ */
+static void extent_add(wb_inode_t *wbi, size_t start, size_t end) {
+    struct wb *wb = WB;
+    wb_extent_t *ext = wbi->extents;
+    size_t n = wbi->extent_count;
+
+    size_t i = 0;
+    while (i < n && ext[i].end < start) {
+        i++;
+    }
+
+    size_t j = i;
+    while (j < n && ext[j].start <= end) {
+        if (ext[j].start < start) {
+            start = ext[j].start;
+        }
+        if (ext[j].end > end) {
+            end = ext[j].end;
+        }
+        j++;
+    }
+
+    memmove(&ext[i + 1], &ext[j], (n - j) * sizeof(wb_extent_t));
+    ext[i].start = start;
+    ext[i].end = end;
+    n = n - (j - i) + 1;
+
+    if (n > WB_MAX_EXTENTS) {
+        size_t closest = 0;
+        for (size_t k = 1; k + 1 < n; k++) {
+            if (ext[k + 1].start - ext[k].end <
+                ext[closest + 1].start - ext[closest].end) {
+                closest = k;
+            }
+        }
+        ext[closest].end = ext[closest + 1].end;
+        memmove(&ext[closest + 1], &ext[closest + 2],
+                (n - closest - 2) * sizeof(wb_extent_t));
+        n--;
+    }
+    wbi->extent_count = n;
+
+    size_t dirty = 0;
+    for (size_t k = 0; k < n; k++) {
+        dirty += ext[k].end - ext[k].start;
+    }
+    atomic_fetch_add(&wb->total_dirty_bytes, dirty - wbi->dirty_bytes);
+    wbi->dirty_bytes = dirty;
+    if (!atomic_load(&wbi->dirty)) {
+        atomic_store(&wbi->dirty_since_ms, now_ms());
+        atomic_store(&wbi->dirty, true);
+    }
+}
+
+/**
+ * Obtain the cached page for a block of the file, creating it if needed.
+ *
+ * A new page starts as a copy of the backing block; if there is none yet, a
+ * block is reserved for it (to be allocated on flush) and the page is zeroed.
+ * So is one if the backing block is shared with a snapshot or a clone, to
+ * copy it to, or if storage is compressed (pages are packed anew on flush).
+ *
+ * Returns the page, or NULL if no block could be reserved, malloc failed or
+ * the backing block failed its checksum.
+ */
+static char *page_get(wb_inode_t *wbi, inode_t const *inode, size_t index) {
+    struct wb *wb = WB;
+    if (wbi->pages[index] != NULL) {
+        return wbi->pages[index];
+    }
+
+    bool unmapped = inode->i_data_blocks[index] == -1;
+    bool cow = !unmapped && (compress_enabled() ||
+                             data_block_shared(inode->i_data_blocks[index]));
+    if ((unmapped || cow) && data_block_reserve(1) == -1) {
+        return NULL; // no space
+    }
+
+    char *page = malloc(wb->block_size);
+    if (page == NULL) {
+        if (unmapped || cow) {
+            data_block_unreserve(1);
+        }
+        return NULL;
+    }
+
+    if (unmapped) {
+        memset(page, 0, wb->block_size);
+    } else if (inode_read_block(inode, index, page) == -1) {
+        free(page);
+        if (cow) {
+            data_block_unreserve(1);
+        }
+        return NULL; // the block failed its checksum
+    }
+
+    wbi->pages[index] = page;
+    wbi->unmapped[index] = unmapped;
+    wbi->cow[index] = cow;
+    return page;
+}
+
+/**
+ * Compressed write-back (see compress.c): compress every page and pack the
+ * results into new data blocks, in place of the previous copies. Each page
+ * has a block reserved (see page_get); the ones left over are given back.
+ */
+static void pack_pages(wb_inode_t *wbi, inode_t *inode) {
+    struct wb *wb = WB;
+    // without it, pages are stored whole
+    char *packed = malloc(wb->block_size);
+    int pack = -1; // block being filled
+    size_t pack_used = 0;
+    size_t reserved = 0;
+
+    for (size_t i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+        char const *page = wbi->pages[i];
+        if (page == NULL) {
+            continue;
+        }
+        reserved++;
+        wbi->cow[i] = false;
+
+        int bnum;
+        block_extent_t extent = {.offset = 0, .length = 0};
+        size_t size = packed == NULL ? 0 : compress_block(page, packed);
+        if (size == 0) {
+            data_block_alloc_run(1, true, &bnum);
+            reserved--;
+            memcpy(data_block_get(bnum), page, wb->block_size);
+            data_block_seal(bnum);
+        } else {
+            // the pack gains an owner per page in it
+            if (pack == -1 || wb->block_size - pack_used < size) {
+                data_block_alloc_run(1, true, &pack);
+                reserved--;
+                compress_forget(pack);
+                pack_used = 0;
+            } else {
+                data_block_hold(pack);
+            }
+            bnum = pack;
+            memcpy((char *)data_block_write_begin(pack) + pack_used, packed,
+                   size);
+            data_block_write_end(pack);
+            extent.offset = (uint16_t)pack_used;
+            extent.length = (uint16_t)size;
+            pack_used += size;
+        }
+
+        int old = inode->i_data_blocks[i];
+        inode_meta_write_begin(inode);
+        inode->i_data_blocks[i] = bnum;
+        inode->i_block_extents[i] = extent;
+        inode_meta_write_end(inode);
+        if (old != -1) {
+            data_block_free(old);
+        }
+    }
+
+    if (reserved > 0) {
+        data_block_unreserve(reserved);
+    }
+    free(packed);
+}
+
+/**
+ * Release the pages of an inode, which is clean from then on.
+ * Must be called with wbi->lock held.
+ */
+static void pages_release(wb_inode_t *wbi) {
+    struct wb *wb = WB;
+    for (size_t i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+        free(wbi->pages[i]);
+        wbi->pages[i] = NULL;
+        wbi->unmapped[i] = false;
+    }
+
+    atomic_fetch_sub(&wb->total_dirty_bytes, wbi->dirty_bytes);
+    wbi->dirty_bytes = 0;
+    wbi->extent_count = 0;
+    atomic_store(&wbi->dirty, false);
+}
+
+/**
+ * Write back the dirty ranges of an inode and release its pages.
+ * Must be called with wbi->lock held.
+ */
+static void flush_locked(wb_inode_t *wbi, inode_t *inode) {
+    struct wb *wb = WB;
+    if (!atomic_load(&wbi->dirty)) {
+        return;
+    }
+
+    if (compress_enabled()) {
+        pack_pages(wbi, inode);
+        pages_release(wbi);
+        return;
+    }
+
+    // Delayed allocation: one contiguous run per group of consecutive pages
+    // that have no backing block yet, written whole (the parts of the page
+    // outside the dirty ranges are holes, zeroed in the page)
+    bool fresh[MAX_BLOCKS_PER_FILE] = {false};
+    size_t index = 0;
+    while (index < MAX_BLOCKS_PER_FILE) {
+        if (wbi->pages[index] == NULL || inode->i_data_blocks[index] != -1) {
+            index++;
+            continue;
+        }
+
+        size_t first = index;
+        while (index < MAX_BLOCKS_PER_FILE && wbi->pages[index] != NULL &&
+               inode->i_data_blocks[index] == -1) {
+            index++;
+        }
+
+        int blocks[MAX_BLOCKS_PER_FILE];
+        size_t count = index - first;
+        data_block_alloc_run(count, true, blocks);
+        for (size_t k = 0; k < count; k++) {
+            memcpy(data_block_get(blocks[k]), wbi->pages[first + k],
+                   wb->block_size);
+            data_block_seal(blocks[k]);
+            fresh[first + k] = true;
+        }
+        inode_meta_write_begin(inode);
+        for (size_t k = 0; k < count; k++) {
+            inode->i_data_blocks[first + k] = blocks[k];
+        }
+        inode_meta_write_end(inode);
+    }
+
+    // Pages whose block was mapped since they were created (by a direct
+    // write) give back the block reserved for them
+    size_t unused = 0;
+    for (size_t i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+        if (wbi->unmapped[i] && !fresh[i]) {
+            unused++;
+        }
+    }
+    if (unused > 0) {
+        data_block_unreserve(unused);
+    }
+
+    // Copy-on-write of the blocks shared with snapshots and clones
+    for (size_t i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+        if (wbi->cow[i]) {
+            if (inode_block_unshare(inode, i, true) == -1) {
+                // the shared block failed its checksum: its page is dropped
+                free(wbi->pages[i]);
+                wbi->pages[i] = NULL;
+            }
+            wbi->cow[i] = false;
+        }
+    }
+
+    for (size_t e = 0; e < wbi->extent_count; e++) {
+        size_t pos = wbi->extents[e].start;
+        while (pos < wbi->extents[e].end) {
+            size_t page_index = pos / wb->block_size;
+            size_t page_offset = pos % wb->block_size;
+            size_t chunk = wb->block_size - page_offset;
+            if (chunk > wbi->extents[e].end - pos) {
+                chunk = wbi->extents[e].end - pos;
+            }
+
+            // pages may be missing inside a merged gap: those bytes are clean
+            // (fresh ones were written whole above)
+            char const *page = wbi->pages[page_index];
+            if (page != NULL && !fresh[page_index]) {
+                int bnum = inode->i_data_blocks[page_index];
+                char *block = data_block_write_begin(bnum);
+                ALWAYS_ASSERT(block != NULL,
+                              "flush_locked: data block deleted mid-write");
+                memcpy(block + page_offset, page + page_offset, chunk);
+                data_block_write_end(bnum);
+            }
+            pos += chunk;
+        }
+    }
+
+    pages_release(wbi);
+}
+
+/**
+ * Write to a file through the cache.
+ *
+ * In write-back mode every write is buffered. Otherwise only small appends
+ * are; other writes flush the inode and are written through.
+ *
+ * Input:
+ *   - inumber: inode of the file
+ *   - offset: byte offset in the file
+ *   - buffer: contents to write
+ *   - len: number of bytes (offset + len must not exceed the max file size)
+ *
+ * Returns the number of bytes written (lower than len if no more blocks can
+ * be reserved or allocated), or -1 if nothing could be written.
+ */
+ssize_t wb_write(int inumber, size_t offset, void const *buffer, size_t len) {
+    struct wb *wb = WB;
+    wb_inode_t *wbi = &wb->wb_inodes[inumber];
+    inode_t *inode = inode_get(inumber);
+    ALWAYS_ASSERT(inode != NULL, "wb_write: inode of open file deleted");
+
+    pthread_mutex_lock(&wbi->lock);
+
+    if (!wb->write_back &&
+        (offset != inode_meta_get(inode).size || len >= wb->append_threshold)) {
+        flush_locked(wbi, inode);
+        ssize_t ret = inode_write_data(inode, offset, buffer, len);
+        pthread_mutex_unlock(&wbi->lock);
+        return ret;
+    }
+
+    size_t written = 0;
+    while (written < len) {
+        size_t pos = offset + written;
+        size_t page_offset = pos % wb->block_size;
+        size_t chunk = wb->block_size - page_offset;
+        if (chunk > len - written) {
+            chunk = len - written;
+        }
+
+        char *page = page_get(wbi, inode, pos / wb->block_size);
+        if (page == NULL) {
+            break;
+        }
+        memcpy(page + page_offset, (char const *)buffer + written, chunk);
+        written += chunk;
+    }
+
+    if (written > 0) {
+        extent_add(wbi, offset, offset + written);
+    }
+
+    // Enough small appends were merged: write them back as one
+    if (!wb->write_back && wbi->dirty_bytes >= wb->append_threshold) {
+        flush_locked(wbi, inode);
+    }
+
+    // Memory pressure: write back this inode now and wake the flusher for
+    // the others
+    bool pressure = atomic_load(&wb->total_dirty_bytes) > wb->max_dirty_bytes;
+    if (pressure) {
+        flush_locked(wbi, inode);
+    }
+    pthread_mutex_unlock(&wbi->lock);
+
+    if (pressure) {
+        pthread_mutex_lock(&wb->flusher_lock);
+        pthread_cond_signal(&wb->flusher_cond);
+        pthread_mutex_unlock(&wb->flusher_lock);
+    }
+
+    if (written == 0 && len > 0) {
+        return -1;
+    }
+    return (ssize_t)written;
+}
+
+/**
+ * Read from a file, seeing buffered writes that were not flushed yet.
+ *
+ * Input:
+ *   - inumber: inode of the file
+ *   - offset: byte offset in the file
+ *   - buffer: destination buffer
+ *   - len: number of bytes (must be within the file size)
+ *
+ * Returns 0 if successful, -1 if a block failed its checksum.
+ */
+int wb_read(int inumber, size_t offset, void *buffer, size_t len) {
+    struct wb *wb = WB;
+    wb_inode_t *wbi = &wb->wb_inodes[inumber];
+    inode_t const *inode = inode_get(inumber);
+    ALWAYS_ASSERT(inode != NULL, "wb_read: inode of open file deleted");
+
+    pthread_mutex_lock(&wbi->lock);
+
+    size_t done = 0;
+    while (done < len) {
+        size_t pos = offset + done;
+        size_t page_offset = pos % wb->block_size;
+        size_t chunk = wb->block_size - page_offset;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+
+        char const *page = wbi->pages[pos / wb->block_size];
+        if (page != NULL) {
+            memcpy((char *)buffer + done, page + page_offset, chunk);
+        } else if (inode_read_data(inode, pos, (char *)buffer + done,
+                                   chunk) == -1) {
+            pthread_mutex_unlock(&wbi->lock);
+            return -1;
+        }
+        done += chunk;
+    }
+
+    pthread_mutex_unlock(&wbi->lock);
+    return 0;
+}
+
+/**
+ * Write back the buffered contents of one file.
+ *
+ * Input:
+ *   - inumber: inode of the file
+ */
+void wb_flush(int inumber) {
+    struct wb *wb = WB;
+    wb_inode_t *wbi = &wb->wb_inodes[inumber];
+
+    pthread_mutex_lock(&wbi->lock);
+    flush_locked(wbi, inode_get(inumber));
+    pthread_mutex_unlock(&wbi->lock);
+}
+
+/**
+ * Write back the buffered contents of every file.
+ */
+void wb_flush_all(void) {
+    struct wb *wb = WB;
+    for (size_t i = 0; i < wb->wb_inode_count; i++) {
+        if (atomic_load(&wb->wb_inodes[i].dirty)) {
+            wb_flush((int)i);
+        }
+    }
+}
+
+/**
+ * Discard the buffered contents of a file (which is being truncated or
+ * deleted), giving back the blocks reserved for it.
+ *
+ * Input:
+ *   - inumber: inode of the file
+ */
+void wb_drop(int inumber) {
+    struct wb *wb = WB;
+    wb_inode_t *wbi = &wb->wb_inodes[inumber];
+
+    pthread_mutex_lock(&wbi->lock);
+    for (size_t i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+        if (wbi->pages[i] != NULL) {
+            if (wbi->unmapped[i] || wbi->cow[i]) {
+                data_block_unreserve(1);
+            }
+            wbi->unmapped[i] = false;
+            wbi->cow[i] = false;
+            free(wbi->pages[i]);
+            wbi->pages[i] = NULL;
+        }
+    }
+
+    atomic_fetch_sub(&wb->total_dirty_bytes, wbi->dirty_bytes);
+    wbi->dirty_bytes = 0;
+    wbi->extent_count = 0;
+    atomic_store(&wbi->dirty, false);
+    pthread_mutex_unlock(&wbi->lock);
+}
@@ -0,0 +1,19 @@
+#ifndef WRITEBACK_H
+#define WRITEBACK_H
+
+#include "operations.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+int wb_init(tfs_params const *params);
+void wb_destroy(void);
+bool wb_enabled(void);
+
+ssize_t wb_write(int inumber, size_t offset, void const *buffer, size_t len);
+int wb_read(int inumber, size_t offset, void *buffer, size_t len);
+void wb_flush(int inumber);
+void wb_flush_all(void);
+void wb_drop(int inumber);
+
+#endif // WRITEBACK_H
@@ -0,0 +1,102 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS (4)
+#define FILES_PER_THREAD (3)
+#define BLOCKS_PER_FILE (4)
+#define BLOCK_SIZE (1024)
+#define TOTAL_BLOCKS (64)
+
+static char file_content(int thread, int file, int block) {
+    return (char)('A' + (thread * FILES_PER_THREAD + file + block) % 26);
+}
+
+// Every thread creates its own files and fills them in parallel, allocating
+// inodes and blocks from its own group as long as there are free ones there
+void *creator(void *arg) {
+    int thread = *(int *)arg;
+    char path[] = "/t0_f0";
+    path[2] = (char)('0' + thread);
+
+    char block[BLOCK_SIZE];
+    for (int file = 0; file < FILES_PER_THREAD; file++) {
+        path[5] = (char)('0' + file);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        for (int b = 0; b < BLOCKS_PER_FILE; b++) {
+            memset(block, file_content(thread, file, b), sizeof(block));
+            assert(tfs_pwrite(f, block, sizeof(block),
+                              (size_t)b * BLOCK_SIZE) == sizeof(block));
+        }
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_block_count = TOTAL_BLOCKS;
+    params.max_file_blocks = BLOCKS_PER_FILE;
+    assert(tfs_init(&params) != -1);
+
+    pthread_t tids[THREADS];
+    int ids[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        ids[t] = t;
+        assert(pthread_create(&tids[t], NULL, creator, &ids[t]) == 0);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        assert(pthread_join(tids[t], NULL) == 0);
+    }
+
+    // No block was handed out twice
+    char path[] = "/t0_f0";
+    char block[BLOCK_SIZE];
+    char expected[BLOCK_SIZE];
+    for (int t = 0; t < THREADS; t++) {
+        path[2] = (char)('0' + t);
+        for (int file = 0; file < FILES_PER_THREAD; file++) {
+            path[5] = (char)('0' + file);
+            int f = tfs_open(path, 0);
+            assert(f != -1);
+            for (int b = 0; b < BLOCKS_PER_FILE; b++) {
+                memset(expected, file_content(t, file, b), sizeof(expected));
+                assert(tfs_read(f, block, sizeof(block)) == sizeof(block));
+                assert(memcmp(block, expected, sizeof(block)) == 0);
+            }
+            assert(tfs_close(f) != -1);
+        }
+    }
+
+    // Once its home group is full, a thread steals from the others: every
+    // block left (all but the root directory's and the ones above) is found
+    int used = 1 + THREADS * FILES_PER_THREAD * BLOCKS_PER_FILE;
+    int filled = 0;
+    char fill_path[] = "/fill0";
+    memset(block, 'z', sizeof(block));
+    for (int file = 0; filled < TOTAL_BLOCKS - used; file++) {
+        fill_path[5] = (char)('0' + file);
+        int f = tfs_open(fill_path, TFS_O_CREAT);
+        assert(f != -1);
+        for (int b = 0; b < BLOCKS_PER_FILE && filled < TOTAL_BLOCKS - used;
+             b++) {
+            assert(tfs_write(f, block, sizeof(block)) == sizeof(block));
+            filled++;
+        }
+        assert(tfs_close(f) != -1);
+    }
+    int f = tfs_open("/full", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, block, sizeof(block)) == -1); // no blocks left
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
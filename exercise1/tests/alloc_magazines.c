@@ -0,0 +1,108 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS (4)
+#define INODES (24)
+#define BLOCKS (48)
+#define BLOCK_SIZE (1024)
+
+// Creates files with one block each until inodes or blocks run out, removes
+// them, and returns how many there were
+static int fill_and_empty(int id) {
+    char path[] = "/0_00";
+    path[1] = (char)('a' + id);
+    char block[BLOCK_SIZE];
+    memset(block, 'm', sizeof(block));
+
+    int files = 0;
+    for (;; files++) {
+        path[3] = (char)('0' + files / 10);
+        path[4] = (char)('0' + files % 10);
+        int f = tfs_open(path, TFS_O_CREAT);
+        if (f == -1) {
+            break;
+        }
+        ssize_t written = tfs_write(f, block, sizeof(block));
+        assert(tfs_close(f) != -1);
+        if (written == -1) {
+            assert(tfs_unlink(path) != -1);
+            break;
+        }
+    }
+    for (int i = 0; i < files; i++) {
+        path[3] = (char)('0' + i / 10);
+        path[4] = (char)('0' + i % 10);
+        assert(tfs_unlink(path) != -1);
+    }
+    return files;
+}
+
+// Frees entries into its magazines, then exits (which drains them)
+void *churner(void *arg) {
+    int id = *(int *)arg;
+    char path[] = "/0_churn";
+    path[1] = (char)('a' + id);
+    for (int i = 0; i < 50; i++) {
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, "x", 1) == 1);
+        assert(tfs_close(f) != -1);
+        assert(tfs_unlink(path) != -1);
+    }
+    return NULL;
+}
+
+void *filler(void *arg) {
+    int *files = arg;
+    *files = fill_and_empty(THREADS);
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_inode_count = INODES;
+    params.max_block_count = BLOCKS;
+    assert(tfs_init(&params) != -1);
+
+    // Everything but the root directory's inode is available
+    int files = fill_and_empty(0);
+    assert(files == INODES - 1);
+
+    // The entries cached by threads that exited went back to the pool
+    pthread_t tids[THREADS];
+    int ids[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        ids[t] = t;
+        assert(pthread_create(&tids[t], NULL, churner, &ids[t]) == 0);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        assert(pthread_join(tids[t], NULL) == 0);
+    }
+    assert(fill_and_empty(1) == INODES - 1);
+
+    // The entries cached by this (live) thread are found by another one
+    pthread_t tid;
+    int other_files = 0;
+    assert(pthread_create(&tid, NULL, filler, &other_files) == 0);
+    assert(pthread_join(tid, NULL) == 0);
+    assert(other_files == INODES - 1);
+
+    assert(tfs_destroy() != -1);
+
+    // Blocks run out before inodes: every block but the root directory's is
+    // found
+    params.max_inode_count = INODES;
+    params.max_block_count = BLOCKS / 3;
+    assert(tfs_init(&params) != -1);
+    assert(fill_and_empty(2) == BLOCKS / 3 - 1);
+    assert(fill_and_empty(3) == BLOCKS / 3 - 1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
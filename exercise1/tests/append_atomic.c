@@ -0,0 +1,110 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define N_WRITERS (4)
+#define RECORDS (48)
+#define RECORD_SIZE (40)
+
+char const path[] = "/box";
+volatile bool writers_done = false;
+
+void *writer(void *arg) {
+    char tag = (char)('a' + *(int *)arg);
+
+    int f = tfs_open(path, TFS_O_APPEND_ATOMIC);
+    assert(f != -1);
+
+    char record[RECORD_SIZE];
+    for (int i = 0; i < RECORDS; i++) {
+        // record: tag, sequence number, tag padding
+        memset(record, tag, sizeof(record));
+        record[1] = (char)i;
+        assert(tfs_write(f, record, sizeof(record)) == sizeof(record));
+    }
+
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+void assert_record_ok(char const *record) {
+    for (int i = 2; i < RECORD_SIZE; i++) {
+        assert(record[i] == record[0]);
+    }
+}
+
+// Readers must never see a record that is only partially written
+void *reader(void *arg) {
+    (void)arg;
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+
+    char record[RECORD_SIZE];
+    size_t pending = 0;
+    while (true) {
+        bool done = writers_done;
+        ssize_t r = tfs_read(f, record + pending, sizeof(record) - pending);
+        assert(r != -1);
+        pending += (size_t)r;
+        if (pending == sizeof(record)) {
+            assert_record_ok(record);
+            pending = 0;
+        } else if (r == 0 && done) {
+            break;
+        }
+    }
+    assert(pending == 0);
+
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 8;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    pthread_t readers;
+    pthread_t writers[N_WRITERS];
+    int ids[N_WRITERS];
+    assert(pthread_create(&readers, NULL, reader, NULL) == 0);
+    for (int i = 0; i < N_WRITERS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&writers[i], NULL, writer, &ids[i]) == 0);
+    }
+    for (int i = 0; i < N_WRITERS; i++) {
+        assert(pthread_join(writers[i], NULL) == 0);
+    }
+    writers_done = true;
+    assert(pthread_join(readers, NULL) == 0);
+
+    // Every record is intact, and each writer's records are in order
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    int next[N_WRITERS] = {0};
+    char record[RECORD_SIZE];
+    for (int i = 0; i < N_WRITERS * RECORDS; i++) {
+        assert(tfs_read(f, record, sizeof(record)) == sizeof(record));
+        assert_record_ok(record);
+        int w = record[0] - 'a';
+        assert(w >= 0 && w < N_WRITERS);
+        assert(record[1] == next[w]);
+        next[w]++;
+    }
+    assert(tfs_read(f, record, sizeof(record)) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
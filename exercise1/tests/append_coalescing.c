@@ -0,0 +1,102 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define MESSAGE_SIZE (100)
+#define MESSAGES (20)
+
+char const path[] = "/box";
+
+static size_t blocks_free(void) {
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) != -1);
+    return info.blocks_free;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 2;
+    params.append_flush_threshold = 512;
+    params.append_flush_deadline_ms = 20;
+    assert(tfs_init(&params) != -1);
+
+    int writer = tfs_open(path, TFS_O_CREAT | TFS_O_APPEND);
+    assert(writer != -1);
+    int reader = tfs_open(path, 0);
+    assert(reader != -1);
+
+    // Each small append is visible to the reader right away, whether it is
+    // still buffered or was already merged into a block-level write
+    char message[MESSAGE_SIZE];
+    char buffer[MESSAGE_SIZE];
+    for (int i = 0; i < MESSAGES; i++) {
+        memset(message, 'a' + i, sizeof(message));
+        assert(tfs_write(writer, message, sizeof(message)) ==
+               sizeof(message));
+
+        assert(tfs_read(reader, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(memcmp(buffer, message, sizeof(buffer)) == 0);
+    }
+    assert(tfs_read(reader, buffer, sizeof(buffer)) == 0);
+
+    // Contents survive the deadline flush
+    struct timespec wait = {.tv_sec = 0, .tv_nsec = 50 * 1000 * 1000};
+    nanosleep(&wait, NULL);
+    assert(tfs_close(reader) != -1);
+    reader = tfs_open(path, 0);
+    assert(reader != -1);
+    for (int i = 0; i < MESSAGES; i++) {
+        assert(tfs_read(reader, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(buffer[0] == 'a' + i && buffer[MESSAGE_SIZE - 1] == 'a' + i);
+    }
+
+    // A write that is not an append goes straight through (after the pending
+    // appends)
+    assert(tfs_write(writer, message, 10) == 10);
+    int overwriter = tfs_open(path, 0);
+    assert(overwriter != -1);
+    memset(message, 'z', sizeof(message));
+    assert(tfs_write(overwriter, message, sizeof(message)) == sizeof(message));
+    assert(tfs_close(overwriter) != -1);
+    assert(tfs_close(reader) != -1);
+
+    reader = tfs_open(path, 0);
+    assert(reader != -1);
+    assert(tfs_read(reader, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(buffer[0] == 'z' && buffer[MESSAGE_SIZE - 1] == 'z');
+    assert(tfs_close(reader) != -1);
+
+    assert(tfs_close(writer) != -1);
+
+    // Atomic appends on another handle go through the same buffers: they are
+    // read back right away, and no block reserved for a page is left behind
+    size_t initial = blocks_free();
+    int atomic = tfs_open("/mixed", TFS_O_CREAT | TFS_O_APPEND_ATOMIC);
+    assert(atomic != -1);
+    writer = tfs_open("/mixed", TFS_O_APPEND);
+    assert(writer != -1);
+    memset(message, 'p', sizeof(message));
+    assert(tfs_write(writer, message, sizeof(message)) == sizeof(message));
+    memset(message, 'q', sizeof(message));
+    assert(tfs_write(atomic, message, sizeof(message)) == sizeof(message));
+    reader = tfs_open("/mixed", 0);
+    assert(reader != -1);
+    assert(tfs_read(reader, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(buffer[0] == 'p' && buffer[MESSAGE_SIZE - 1] == 'p');
+    assert(tfs_read(reader, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(buffer[0] == 'q' && buffer[MESSAGE_SIZE - 1] == 'q');
+    assert(tfs_close(reader) != -1);
+    assert(tfs_close(writer) != -1);
+    assert(tfs_close(atomic) != -1);
+    nanosleep(&wait, NULL);
+    assert(tfs_unlink("/mixed") != -1);
+    assert(blocks_free() == initial);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define N_APPENDERS (3)
+#define RECORDS (48)
+#define RECORD_SIZE (40)
+#define TRUNCATIONS (4)
+#define ROUNDS (20)
+
+char const path[] = "/box";
+
+void *appender(void *arg) {
+    char tag = (char)('a' + *(int *)arg);
+
+    int f = tfs_open(path, TFS_O_APPEND_ATOMIC);
+    assert(f != -1);
+
+    char record[RECORD_SIZE];
+    for (int i = 0; i < RECORDS; i++) {
+        memset(record, tag, sizeof(record));
+        record[1] = (char)i;
+        assert(tfs_write(f, record, sizeof(record)) == sizeof(record));
+    }
+
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+// Ordinary writes, often past the end while appends are in flight
+void *pwriter(void *arg) {
+    (void)arg;
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+
+    char record[RECORD_SIZE];
+    memset(record, 'z', sizeof(record));
+    for (size_t i = 0; i < RECORDS; i++) {
+        assert(tfs_pwrite(f, record, sizeof(record), 3 * i * RECORD_SIZE) ==
+               sizeof(record));
+    }
+
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+// Truncations wait for the appends in flight to commit
+void *truncator(void *arg) {
+    (void)arg;
+
+    for (int i = 0; i < TRUNCATIONS; i++) {
+        int f = tfs_open(path, TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 32;
+    assert(tfs_init(&params) != -1);
+
+    alarm(60); // a commit waiting forever fails the test
+
+    for (int round = 0; round < ROUNDS; round++) {
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+
+        pthread_t threads[N_APPENDERS + 2];
+        int ids[N_APPENDERS];
+        for (int i = 0; i < N_APPENDERS; i++) {
+            ids[i] = i;
+            assert(pthread_create(&threads[i], NULL, appender, &ids[i]) == 0);
+        }
+        assert(pthread_create(&threads[N_APPENDERS], NULL, pwriter, NULL) ==
+               0);
+        if (round % 2 == 1) {
+            assert(pthread_create(&threads[N_APPENDERS + 1], NULL, truncator,
+                                  NULL) == 0);
+        }
+        for (int i = 0; i < N_APPENDERS + 1 + round % 2; i++) {
+            assert(pthread_join(threads[i], NULL) == 0);
+        }
+
+        // Records are whole (appended, written, or a gap), and each
+        // appender's surviving records are in order (truncations only drop
+        // earlier ones)
+        f = tfs_open(path, 0);
+        assert(f != -1);
+        int last[N_APPENDERS] = {-1, -1, -1};
+        char record[RECORD_SIZE];
+        ssize_t r;
+        while ((r = tfs_read(f, record, sizeof(record))) > 0) {
+            assert(r == sizeof(record));
+            for (size_t i = 2; i < RECORD_SIZE; i++) {
+                assert(record[i] == record[0]);
+            }
+            int w = record[0] - 'a';
+            if (w >= 0 && w < N_APPENDERS) {
+                assert(record[1] > last[w]);
+                last[w] = record[1];
+            } else {
+                assert(record[0] == 'z' || record[0] == '\0');
+            }
+        }
+        assert(r == 0);
+        assert(tfs_close(f) != -1);
+        assert(tfs_unlink(path) != -1);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
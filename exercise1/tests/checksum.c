@@ -0,0 +1,147 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCK_SIZE (1024)
+#define FILE_BLOCKS (4)
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE)
+
+static size_t checksum_errors(void) {
+    tfs_stats stats;
+    assert(tfs_get_stats(&stats) != -1);
+    return stats.checksum_errors;
+}
+
+static void write_file(char const *path, char const *buffer, size_t len) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, len) == (ssize_t)len);
+    assert(tfs_close(f) != -1);
+}
+
+static void check_file(char const *path, char const *expected, size_t len) {
+    char buffer[FILE_SIZE + 1];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+// Flips a byte of a file's first block behind the FS's back, as storage
+// corruption would
+static void corrupt_file(char const *path) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    int inumber = get_open_file_entry(f)->of_inumber;
+    assert(tfs_close(f) != -1);
+    char *block = data_block_get(inode_meta_get(inode_get(inumber)).root_block);
+    block[BLOCK_SIZE / 2] ^= 1;
+}
+
+static void run(bool write_back, bool compress) {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_file_blocks = FILE_BLOCKS;
+    params.write_back = write_back;
+    params.max_dirty_bytes = 0; // write back on every write
+    params.compress = compress;
+    params.checksums = true;
+    assert(tfs_init(&params) != -1);
+
+    char payload[FILE_SIZE];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (char)('a' + i % 26);
+    }
+
+    // Everything written reads back, through links, clones and snapshots
+    write_file("/f", payload, FILE_SIZE);
+    write_file("/g", payload, FILE_SIZE);
+    assert(tfs_sym_link("/f", "/s") != -1);
+    assert(tfs_link("/f", "/h") != -1);
+    assert(tfs_clone("/f", "/c") != -1);
+    int snapshot = tfs_snapshot();
+    assert(snapshot != -1);
+    int f = tfs_open("/c", 0);
+    assert(f != -1);
+    assert(tfs_pwrite(f, "XYZ", 3, BLOCK_SIZE - 1) == 3);
+    assert(tfs_close(f) != -1);
+    check_file("/s", payload, FILE_SIZE);
+    check_file("/h", payload, FILE_SIZE);
+    f = tfs_snapshot_open(snapshot, "/c");
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_snapshot_delete(snapshot) != -1);
+    assert(checksum_errors() == 0);
+
+    // A corrupted block fails the read instead of returning bad data (g was
+    // not read yet, so none of it is in the decompressed cache)
+    corrupt_file("/g");
+    f = tfs_open("/g", 0);
+    assert(f != -1);
+    char buffer[FILE_SIZE];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == -1);
+    assert(tfs_close(f) != -1);
+    assert(checksum_errors() > 0);
+
+    // So does a corrupted inode, when opened
+    f = tfs_open("/f", 0);
+    assert(f != -1);
+    inode_t *inode = inode_get(get_open_file_entry(f)->of_inumber);
+    assert(tfs_close(f) != -1);
+    inode->i_size--;
+    assert(tfs_open("/f", 0) == -1);
+    inode->i_size++;
+    check_file("/f", payload, FILE_SIZE);
+
+    // And a corrupted symbolic link, when followed inside a snapshot
+    snapshot = tfs_snapshot();
+    assert(snapshot != -1);
+    int link = find_in_dir(inode_get(ROOT_DIR_INUM), "s");
+    assert(link != -1);
+    char *target = data_block_get(inode_meta_get(inode_get(link)).root_block);
+    target[1] ^= 1; // "/f" reads as "/g"
+    assert(tfs_snapshot_open(snapshot, "/s") == -1);
+    target[1] ^= 1;
+    f = tfs_snapshot_open(snapshot, "/s");
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_snapshot_delete(snapshot) != -1);
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    run(false, false);
+    run(true, false);
+    run(true, true);
+
+    // The scrubber finds corruption in blocks no one reads
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_file_blocks = FILE_BLOCKS;
+    params.checksums = true;
+    params.scrub_blocks_per_sec = 10000;
+    assert(tfs_init(&params) != -1);
+    char payload[FILE_SIZE];
+    memset(payload, 'p', sizeof(payload));
+    write_file("/f", payload, FILE_SIZE);
+    corrupt_file("/f");
+    struct timespec wait = {.tv_sec = 0, .tv_nsec = 10 * 1000 * 1000};
+    for (int i = 0; i < 500 && checksum_errors() == 0; i++) {
+        nanosleep(&wait, NULL);
+    }
+    assert(checksum_errors() > 0);
+    tfs_stats stats;
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.scrubbed_blocks > 0);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
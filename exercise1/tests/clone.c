@@ -0,0 +1,122 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE (1024)
+#define FILE_SIZE (4 * BLOCK_SIZE)
+#define ROUNDS (500)
+
+static size_t free_blocks(void) {
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) != -1);
+    return info.blocks_free;
+}
+
+// Checks that a file holds len bytes: 'first' at offset 0, 'rest' after it
+static void check_file(char const *path, char first, char rest, size_t len) {
+    char buffer[FILE_SIZE + 1];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)len);
+    assert(buffer[0] == first);
+    for (size_t i = 1; i < len; i++) {
+        assert(buffer[i] == rest);
+    }
+    assert(tfs_close(f) != -1);
+}
+
+static void *cloner(void *arg) {
+    int *result = arg;
+    *result = tfs_clone("/b", "/r");
+    return NULL;
+}
+
+static void run(bool write_back) {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_file_blocks = FILE_SIZE / BLOCK_SIZE;
+    params.write_back = write_back;
+    assert(tfs_init(&params) != -1);
+
+    char buffer[FILE_SIZE];
+    memset(buffer, 'a', sizeof(buffer));
+    int f = tfs_open("/a", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(tfs_close(f) != -1);
+
+    // The clone shares every block of the source (the write-back cache is
+    // flushed first, so its blocks are allocated before counting)
+    assert(tfs_clone("/a", "/b") != -1);
+    size_t shared = free_blocks();
+    assert(tfs_clone("/a", "/c") != -1);
+    assert(free_blocks() == shared);
+    check_file("/b", 'a', 'a', FILE_SIZE);
+    check_file("/c", 'a', 'a', FILE_SIZE);
+
+    // Changing one copy leaves the others alone
+    f = tfs_open("/b", 0);
+    assert(f != -1);
+    assert(tfs_write(f, "B", 1) == 1);
+    assert(tfs_close(f) != -1);
+    f = tfs_open("/a", 0);
+    assert(f != -1);
+    assert(tfs_write(f, "A", 1) == 1);
+    assert(tfs_close(f) != -1);
+    check_file("/a", 'A', 'a', FILE_SIZE);
+    check_file("/b", 'B', 'a', FILE_SIZE);
+    check_file("/c", 'a', 'a', FILE_SIZE);
+
+    // Removing the source keeps the clones intact
+    assert(tfs_unlink("/a") != -1);
+    check_file("/b", 'B', 'a', FILE_SIZE);
+    check_file("/c", 'a', 'a', FILE_SIZE);
+
+    // Symbolic links are followed to the file they point to
+    assert(tfs_sym_link("/c", "/s") != -1);
+    assert(tfs_clone("/s", "/d") != -1);
+    check_file("/d", 'a', 'a', FILE_SIZE);
+
+    // The clone must be a new file, of an existing one
+    assert(tfs_clone("/b", "/c") == -1);
+    assert(tfs_clone("/missing", "/e") == -1);
+    assert(tfs_clone("/b", "e") == -1);
+
+    // Of two clones racing to the same name, only one gets it
+    for (int i = 0; i < ROUNDS; i++) {
+        pthread_t tids[2];
+        int results[2];
+        for (int t = 0; t < 2; t++) {
+            assert(pthread_create(&tids[t], NULL, cloner, &results[t]) == 0);
+        }
+        for (int t = 0; t < 2; t++) {
+            assert(pthread_join(tids[t], NULL) == 0);
+        }
+        assert((results[0] == -1) != (results[1] == -1));
+        assert(tfs_unlink("/r") != -1);
+        assert(tfs_unlink("/r") == -1);
+    }
+
+    // Once every copy is gone, so are the blocks
+    assert(tfs_unlink("/s") != -1);
+    assert(tfs_unlink("/b") != -1);
+    assert(tfs_unlink("/c") != -1);
+    assert(tfs_unlink("/d") != -1);
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) != -1);
+    assert(info.blocks_free == info.blocks - 1);
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    run(false);
+    run(true);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
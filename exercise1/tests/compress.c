@@ -0,0 +1,125 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE (1024)
+#define FILE_BLOCKS (8)
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE)
+
+static size_t used_blocks(void) {
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) != -1);
+    return info.blocks - info.blocks_free;
+}
+
+static void write_file(char const *path, char const *buffer, size_t len) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, len) == (ssize_t)len);
+    assert(tfs_close(f) != -1);
+}
+
+static void check_file(char const *path, char const *expected, size_t len) {
+    char buffer[FILE_SIZE + 1];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_file_blocks = FILE_BLOCKS;
+    params.compress = true;
+
+    // The write-back cache does the compression
+    assert(tfs_init(&params) == -1);
+    params.write_back = true;
+    params.max_dirty_bytes = 0; // write back on every write
+    assert(tfs_init(&params) != -1);
+
+    char text[FILE_SIZE];
+    for (size_t i = 0; i < sizeof(text); i++) {
+        text[i] = "announcement to every tenant #"[i % 30];
+    }
+    char noise[FILE_SIZE];
+    srand(42);
+    for (size_t i = 0; i < sizeof(noise); i++) {
+        noise[i] = (char)rand();
+    }
+
+    // Text takes a fraction of its size
+    size_t before = used_blocks();
+    write_file("/text", text, FILE_SIZE);
+    assert(used_blocks() - before < FILE_BLOCKS / 2);
+    check_file("/text", text, FILE_SIZE);
+
+    tfs_stats stats;
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.compress_bytes_in == FILE_SIZE);
+    assert(stats.compress_bytes_out * 4 < stats.compress_bytes_in);
+
+    // Noise does not compress: it is stored whole
+    before = used_blocks();
+    write_file("/noise", noise, FILE_SIZE);
+    assert(used_blocks() - before == FILE_BLOCKS);
+    check_file("/noise", noise, FILE_SIZE);
+
+    // Repeated reads decompress once
+    assert(tfs_get_stats(&stats) != -1);
+    size_t misses = stats.decompress_cache_misses;
+    check_file("/text", text, FILE_SIZE);
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.decompress_cache_misses == misses);
+    assert(stats.decompress_cache_hits >= FILE_BLOCKS);
+
+    // Partial rewrites, inside and across blocks
+    int f = tfs_open("/text", 0);
+    assert(f != -1);
+    assert(tfs_pwrite(f, "XYZ", 3, 10) == 3);
+    assert(tfs_pwrite(f, "crossing", 8, 2 * BLOCK_SIZE - 4) == 8);
+    assert(tfs_close(f) != -1);
+    memcpy(text + 10, "XYZ", 3);
+    memcpy(text + 2 * BLOCK_SIZE - 4, "crossing", 8);
+    check_file("/text", text, FILE_SIZE);
+
+    // Clones share the packed blocks, and keep their contents
+    assert(tfs_clone("/text", "/copy") != -1);
+    f = tfs_open("/text", 0);
+    assert(f != -1);
+    assert(tfs_pwrite(f, "changed", 7, 0) == 7);
+    assert(tfs_close(f) != -1);
+    check_file("/copy", text, FILE_SIZE);
+    memcpy(text, "changed", 7);
+    check_file("/text", text, FILE_SIZE);
+
+    // Atomic appends write in place, after decompressing the block
+    char tail[BLOCK_SIZE / 2];
+    memset(tail, 't', sizeof(tail));
+    write_file("/log", text, BLOCK_SIZE / 2);
+    f = tfs_open("/log", TFS_O_APPEND_ATOMIC);
+    assert(f != -1);
+    assert(tfs_write(f, tail, sizeof(tail)) == sizeof(tail));
+    assert(tfs_close(f) != -1);
+    char log[BLOCK_SIZE];
+    memcpy(log, text, BLOCK_SIZE / 2);
+    memcpy(log + BLOCK_SIZE / 2, tail, sizeof(tail));
+    check_file("/log", log, BLOCK_SIZE);
+
+    // Every block is given back
+    assert(tfs_unlink("/text") != -1);
+    assert(tfs_unlink("/copy") != -1);
+    assert(tfs_unlink("/noise") != -1);
+    assert(tfs_unlink("/log") != -1);
+    assert(used_blocks() == 1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCK_SIZE (1024)
+#define FILE_BLOCKS (4)
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE)
+#define ROUNDS (200)
+
+static atomic_bool done;
+
+static size_t free_blocks(void) {
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) != -1);
+    return info.blocks_free;
+}
+
+// Block i of a payload is filled with 'a' + i; 'first' replaces byte 0
+static void fill(char *buffer, char first) {
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        buffer[i] = (char)('a' + i / BLOCK_SIZE);
+    }
+    buffer[0] = first;
+}
+
+static void write_file(char const *path, char const *buffer, size_t len) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, len) == (ssize_t)len);
+    assert(tfs_close(f) != -1);
+}
+
+static void check_file(char const *path, char const *expected, size_t len) {
+    char buffer[FILE_SIZE + 1];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+// Opens and reads a file that passes keep deduplicating
+static void *reader(void *arg) {
+    char const *payload = arg;
+    while (!atomic_load(&done)) {
+        check_file("/r", payload, FILE_SIZE);
+    }
+    return NULL;
+}
+
+static void run(bool write_back) {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_file_blocks = FILE_BLOCKS;
+    params.write_back = write_back;
+    params.dedup = true;
+    params.dedup_interval_ms = 0;
+    assert(tfs_init(&params) != -1);
+
+    char payload[FILE_SIZE];
+    char other[FILE_SIZE];
+    fill(payload, 'a');
+    fill(other, 'X');
+
+    // Three copies of the payload, one that differs in its first block, and
+    // one whose last block is partial (and never shared)
+    write_file("/p1", payload, FILE_SIZE);
+    write_file("/p2", payload, FILE_SIZE);
+    write_file("/p3", payload, FILE_SIZE);
+    write_file("/o", other, FILE_SIZE);
+    write_file("/t", payload, FILE_SIZE - 1);
+
+    // An open file is left alone
+    int open = tfs_open("/p3", 0);
+    assert(open != -1);
+
+    // p2 shares all of p1's blocks, o and t all but one (with write-back,
+    // the pass also flushes the buffered files, allocating their blocks)
+    size_t before = free_blocks();
+    assert(tfs_dedup() == FILE_BLOCKS + (FILE_BLOCKS - 1) * 2);
+    if (!write_back) {
+        assert(free_blocks() == before + FILE_BLOCKS + (FILE_BLOCKS - 1) * 2);
+    }
+    assert(tfs_dedup() == 0);
+
+    check_file("/p1", payload, FILE_SIZE);
+    check_file("/p2", payload, FILE_SIZE);
+    check_file("/o", other, FILE_SIZE);
+    check_file("/t", payload, FILE_SIZE - 1);
+
+    // Blocks a pass did not share are freed with their file
+    char unique[BLOCK_SIZE];
+    memset(unique, 'u', sizeof(unique));
+    size_t without = free_blocks();
+    write_file("/u", unique, sizeof(unique));
+    assert(tfs_dedup() == 0);
+    assert(tfs_unlink("/u") != -1);
+    assert(free_blocks() == without);
+
+    // Once closed, p3 is deduplicated too
+    assert(tfs_close(open) != -1);
+    assert(tfs_dedup() == FILE_BLOCKS);
+
+    // Shared blocks are copied before they change
+    int f = tfs_open("/p2", 0);
+    assert(f != -1);
+    assert(tfs_write(f, "Z", 1) == 1);
+    assert(tfs_close(f) != -1);
+    check_file("/p1", payload, FILE_SIZE);
+    check_file("/p3", payload, FILE_SIZE);
+    char changed[FILE_SIZE];
+    fill(changed, 'Z');
+    check_file("/p2", changed, FILE_SIZE);
+
+    // Blocks only the index still holds are released by the next pass
+    assert(tfs_unlink("/p1") != -1);
+    assert(tfs_unlink("/p2") != -1);
+    assert(tfs_unlink("/p3") != -1);
+    assert(tfs_unlink("/o") != -1);
+    assert(tfs_unlink("/t") != -1);
+    assert(tfs_dedup() == 0);
+
+    // A file opened while a pass replaces its blocks never reads the ones
+    // freed (and reused by another file meanwhile)
+    write_file("/keep", payload, FILE_SIZE);
+    write_file("/r", payload, FILE_SIZE);
+    assert(tfs_dedup() == FILE_BLOCKS);
+    atomic_store(&done, false);
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, reader, payload) == 0);
+    for (int i = 0; i < ROUNDS; i++) {
+        write_file("/s", payload, FILE_SIZE);
+        assert(tfs_rename("/s", "/r") != -1);
+        assert(tfs_dedup() >= 0);
+        write_file("/o", other, FILE_SIZE);
+        assert(tfs_unlink("/o") != -1);
+    }
+    atomic_store(&done, true);
+    assert(pthread_join(tid, NULL) == 0);
+    assert(tfs_unlink("/keep") != -1);
+    assert(tfs_unlink("/r") != -1);
+    assert(tfs_dedup() == 0);
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) != -1);
+    assert(info.blocks_free == info.blocks - 1);
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    // Not enabled
+    assert(tfs_init(NULL) != -1);
+    assert(tfs_dedup() == -1);
+    assert(tfs_destroy() != -1);
+
+    run(false);
+    run(true);
+
+    // The background pass finds copies by itself
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_file_blocks = FILE_BLOCKS;
+    params.dedup = true;
+    params.dedup_interval_ms = 10;
+    assert(tfs_init(&params) != -1);
+    char payload[FILE_SIZE];
+    fill(payload, 'a');
+    write_file("/p1", payload, FILE_SIZE);
+    size_t one_copy = free_blocks();
+    write_file("/p2", payload, FILE_SIZE);
+    struct timespec wait = {.tv_sec = 0, .tv_nsec = 10 * 1000 * 1000};
+    for (int i = 0; i < 500 && free_blocks() != one_copy; i++) {
+        nanosleep(&wait, NULL);
+    }
+    assert(free_blocks() == one_copy);
+    check_file("/p2", payload, FILE_SIZE);
+    assert(tfs_destroy() != -1);
+
+    // A block that fails its checksum is not shared, even when its corrupted
+    // contents match another block's
+    params.dedup_interval_ms = 0;
+    params.checksums = true;
+    assert(tfs_init(&params) != -1);
+    char other[FILE_SIZE];
+    fill(other, 'X');
+    write_file("/o", other, FILE_SIZE);
+    int f = tfs_open("/o", 0);
+    assert(f != -1);
+    int inumber = get_open_file_entry(f)->of_inumber;
+    assert(tfs_close(f) != -1);
+    char *block = data_block_get(inode_meta_get(inode_get(inumber)).root_block);
+    block[0] = 'a';
+    write_file("/p", payload, FILE_SIZE);
+    assert(tfs_dedup() == FILE_BLOCKS - 1);
+    check_file("/p", payload, FILE_SIZE);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
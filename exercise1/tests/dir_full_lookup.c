@@ -0,0 +1,74 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// Entries that fit in the root directory's block (1024 / 44)
+#define ENTRIES (23)
+
+// Names share a long prefix and only differ near the end
+static void name_of(int i, char *path) {
+    strcpy(path, "/a_fairly_long_shared_name_prefix_0000");
+    path[36] = (char)('a' + i / 10);
+    path[37] = (char)('0' + i % 10);
+}
+
+static void assert_file_is(char const *path, int i) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    char c;
+    assert(tfs_read(f, &c, 1) == 1);
+    assert(c == (char)i);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 2 * ENTRIES;
+    assert(tfs_init(&params) != -1);
+
+    char path[MAX_FILE_NAME];
+    for (int i = 0; i < ENTRIES; i++) {
+        name_of(i, path);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        char c = (char)i;
+        assert(tfs_write(f, &c, 1) == 1);
+        assert(tfs_close(f) != -1);
+    }
+
+    // The directory is full
+    assert(tfs_open("/one_too_many", TFS_O_CREAT) == -1);
+
+    for (int i = 0; i < ENTRIES; i++) {
+        name_of(i, path);
+        assert_file_is(path, i);
+    }
+    assert(tfs_open("/a_fairly_long_shared_name_prefix_00z9", 0) == -1);
+
+    // Freed entries are found and reused
+    for (int i = 3; i < ENTRIES; i += 5) {
+        name_of(i, path);
+        assert(tfs_unlink(path) != -1);
+        assert(tfs_open(path, 0) == -1);
+    }
+    for (int i = 3; i < ENTRIES; i += 5) {
+        name_of(i, path);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        char c = (char)i;
+        assert(tfs_write(f, &c, 1) == 1);
+        assert(tfs_close(f) != -1);
+    }
+    for (int i = 0; i < ENTRIES; i++) {
+        name_of(i, path);
+        assert_file_is(path, i);
+    }
+    assert(tfs_open("/one_too_many", TFS_O_CREAT) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
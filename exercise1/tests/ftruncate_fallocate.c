@@ -0,0 +1,184 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK (1024)
+#define ROUNDS (300)
+
+static atomic_bool done;
+
+static size_t blocks_free(void) {
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) != -1);
+    return info.blocks_free;
+}
+
+static size_t file_size(char const *path) {
+    tfs_file_info entries[8];
+    ssize_t count = tfs_list(entries, 8);
+    assert(count != -1);
+    for (ssize_t i = 0; i < count; i++) {
+        if (strcmp(entries[i].name, path + 1) == 0) {
+            return entries[i].size;
+        }
+    }
+    assert(0);
+    return 0;
+}
+
+// Reads [offset, offset + len) and checks it is filled with 'c'
+static void check_range(char const *path, size_t offset, size_t len, char c) {
+    char buffer[8 * BLOCK];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, offset + len) == (ssize_t)(offset + len));
+    for (size_t i = offset; i < offset + len; i++) {
+        assert(buffer[i] == c);
+    }
+    assert(tfs_close(f) != -1);
+}
+
+// Reads /log over and over: whatever is there is the data written to it
+static void *reader(void *arg) {
+    (void)arg;
+    char buffer[4 * BLOCK];
+    while (!atomic_load(&done)) {
+        int f = tfs_open("/log", 0);
+        assert(f != -1);
+        ssize_t read = tfs_read(f, buffer, sizeof(buffer));
+        assert(read != -1);
+        for (ssize_t i = 0; i < read; i++) {
+            assert(buffer[i] == 'l');
+        }
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+// Retention trims never free blocks from under a reader (where another
+// file's data could land)
+static void truncate_while_reading(void) {
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 4;
+    params.checksums = true;
+    assert(tfs_init(&params) != -1);
+
+    char log[4 * BLOCK];
+    memset(log, 'l', sizeof(log));
+    char other[4 * BLOCK];
+    memset(other, 'o', sizeof(other));
+    int f = tfs_open("/log", TFS_O_CREAT);
+    assert(f != -1);
+    atomic_store(&done, false);
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, reader, NULL) == 0);
+    for (int i = 0; i < ROUNDS; i++) {
+        assert(tfs_pwrite(f, log, sizeof(log), 0) == sizeof(log));
+        assert(tfs_ftruncate(f, 0) != -1);
+        int g = tfs_open("/other", TFS_O_CREAT | TFS_O_TRUNC);
+        assert(g != -1);
+        assert(tfs_write(g, other, sizeof(other)) == sizeof(other));
+        assert(tfs_close(g) != -1);
+    }
+    atomic_store(&done, true);
+    assert(pthread_join(tid, NULL) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+}
+
+static void resize_with_buffered_writes(void) {
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 8;
+    params.write_back = true;
+    assert(tfs_init(&params) != -1);
+
+    // Buffered data past the new end is dropped, the rest is kept
+    char buffer[3 * BLOCK];
+    memset(buffer, 'w', sizeof(buffer));
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(tfs_ftruncate(f, 1000) != -1);
+    assert(tfs_ftruncate(f, 2000) != -1);
+    assert(tfs_close(f) != -1);
+    assert(file_size("/f") == 2000);
+    check_range("/f", 0, 1000, 'w');
+    check_range("/f", 1000, 1000, '\0');
+    assert(blocks_free() == params.max_block_count - 2);
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 8;
+    assert(tfs_init(&params) != -1);
+    size_t initial = blocks_free();
+
+    // Preallocation takes the blocks but leaves the size alone
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_fallocate(f, 0, 4 * BLOCK) != -1);
+    assert(blocks_free() == initial - 4);
+    assert(file_size("/f") == 0);
+    assert(tfs_fallocate(f, 7 * BLOCK, 2 * BLOCK) == -1); // past the max
+    assert(blocks_free() == initial - 4);
+
+    // Writes fill the preallocated blocks
+    char buffer[3 * BLOCK];
+    memset(buffer, 'x', sizeof(buffer));
+    assert(tfs_write(f, buffer, 2500) == 2500);
+    assert(blocks_free() == initial - 4);
+    assert(file_size("/f") == 2500);
+
+    // Shrinking frees the blocks past the new end, preallocated ones too
+    assert(tfs_ftruncate(f, 1500) != -1);
+    assert(file_size("/f") == 1500);
+    assert(blocks_free() == initial - 2);
+    check_range("/f", 0, 1500, 'x');
+
+    // Growing adds zeros, even where the old contents were
+    assert(tfs_ftruncate(f, 3000) != -1);
+    assert(file_size("/f") == 3000);
+    assert(blocks_free() == initial - 2);
+    check_range("/f", 1500, 1500, '\0');
+    assert(tfs_ftruncate(f, 8 * BLOCK + 1) == -1); // past the max
+
+    // A snapshot keeps what the file had
+    int snapshot = tfs_snapshot();
+    assert(snapshot != -1);
+    assert(tfs_ftruncate(f, 100) != -1);
+    assert(tfs_ftruncate(f, 1500) != -1);
+    check_range("/f", 0, 100, 'x');
+    check_range("/f", 100, 1400, '\0');
+    int s = tfs_snapshot_open(snapshot, "/f");
+    assert(s != -1);
+    char old[3000];
+    assert(tfs_read(s, old, sizeof(old)) == sizeof(old));
+    for (size_t i = 0; i < 1500; i++) {
+        assert(old[i] == 'x');
+    }
+    assert(tfs_ftruncate(s, 0) == -1);    // read-only
+    assert(tfs_fallocate(s, 0, 1) == -1); // read-only
+    assert(tfs_close(s) != -1);
+    assert(tfs_snapshot_delete(snapshot) != -1);
+
+    assert(tfs_ftruncate(f, 0) != -1);
+    assert(file_size("/f") == 0);
+    assert(blocks_free() == initial);
+    assert(tfs_close(f) != -1);
+    assert(tfs_ftruncate(f, 0) == -1); // closed
+
+    assert(tfs_destroy() != -1);
+
+    resize_with_buffered_writes();
+    truncate_while_reading();
+
+    printf("Successful test.\n");
+
+    return 0;
+}
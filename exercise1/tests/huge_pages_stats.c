@@ -0,0 +1,55 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static void write_and_read_back(void) {
+    char buffer[1000];
+    memset(buffer, 'h', sizeof(buffer));
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(tfs_close(f) != -1);
+
+    char read_back[1000];
+    f = tfs_open("/f", 0);
+    assert(f != -1);
+    assert(tfs_read(f, read_back, sizeof(read_back)) == sizeof(read_back));
+    assert(memcmp(buffer, read_back, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    tfs_stats stats;
+
+    assert(tfs_get_stats(&stats) == -1); // not initialized
+
+    // Regular pages
+    assert(tfs_init(NULL) != -1);
+    write_and_read_back();
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.data_page_size == page_size);
+    assert(stats.inode_page_size == page_size);
+    assert(tfs_destroy() != -1);
+
+    // Huge pages, or a fallback to regular pages where there are none: the
+    // stats report what was obtained
+    tfs_params params = tfs_default_params();
+    params.huge_pages = true;
+    params.max_block_count = 8192; // 8 MiB
+    assert(tfs_init(&params) != -1);
+    write_and_read_back();
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.data_page_size == page_size ||
+           stats.data_page_size == 2 * 1024 * 1024);
+    assert(stats.inode_page_size == page_size ||
+           stats.inode_page_size == 2 * 1024 * 1024);
+    printf("data region pages: %zu KiB\n", stats.data_page_size / 1024);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
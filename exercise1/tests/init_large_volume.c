@@ -0,0 +1,54 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Resident set size, in bytes
+static size_t resident(void) {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    assert(statm != NULL);
+    size_t size, pages;
+    assert(fscanf(statm, "%zu %zu", &size, &pages) == 2);
+    fclose(statm);
+    return pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+int main() {
+    // 4 GiB of data blocks and a million inodes
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 4 * 1024 * 1024;
+    params.max_inode_count = 1024 * 1024;
+
+    size_t before = resident();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(tfs_init(&params) != -1);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // Neither time nor memory depend on the volume size
+    double elapsed_ms = (double)(end.tv_sec - start.tv_sec) * 1e3 +
+                        (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+    assert(elapsed_ms < 100);
+    assert(resident() - before < 4 * 1024 * 1024);
+
+    // The volume works as usual
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "hello", 5) == 5);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/f", 0);
+    assert(f != -1);
+    char buffer[5];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 5);
+    assert(memcmp(buffer, "hello", 5) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define INSTANCES (4)
+#define WRITES (200)
+
+static void write_file(tfs_t *fs, char const *path, char const *text) {
+    int f = tfs_open_in(fs, path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write_in(fs, f, text, strlen(text)) == (ssize_t)strlen(text));
+    assert(tfs_close_in(fs, f) != -1);
+}
+
+static void check_file(tfs_t *fs, char const *path, char const *text) {
+    char buffer[64];
+    int f = tfs_open_in(fs, path, 0);
+    assert(f != -1);
+    ssize_t r = tfs_read_in(fs, f, buffer, sizeof(buffer));
+    assert(r == (ssize_t)strlen(text));
+    assert(memcmp(buffer, text, strlen(text)) == 0);
+    assert(tfs_close_in(fs, f) != -1);
+}
+
+// Appends to a file of its own instance; no instance sees another's writes
+static void *tenant(void *arg) {
+    tfs_t *fs = arg;
+    int f = tfs_open_in(fs, "/log", TFS_O_CREAT | TFS_O_APPEND);
+    assert(f != -1);
+    for (int i = 0; i < WRITES; i++) {
+        assert(tfs_write_in(fs, f, "x", 1) == 1);
+    }
+    assert(tfs_close_in(fs, f) != -1);
+
+    tfs_statfs_info info;
+    assert(tfs_statfs_in(fs, &info) != -1);
+    assert(info.open_files_free == info.open_files);
+    assert(info.inodes_free == info.inodes - 2); // root and /log
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.write_back = true;
+    tfs_t *a = tfs_instance_create(&params);
+    tfs_t *b = tfs_instance_create(NULL);
+    assert(a != NULL && b != NULL);
+    assert(tfs_init(NULL) != -1);
+
+    // The same paths hold different files in each instance
+    write_file(a, "/f", "in a");
+    write_file(b, "/f", "in b");
+    assert(tfs_open_in(a, "/only_b", 0) == -1);
+    write_file(b, "/only_b", "b");
+    assert(tfs_open_in(a, "/only_b", 0) == -1);
+    check_file(a, "/f", "in a");
+    check_file(b, "/f", "in b");
+
+    // The default instance, through the plain API, is a third one
+    assert(tfs_open("/f", 0) == -1);
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "default", 7) == 7);
+    assert(tfs_close(f) != -1);
+    check_file(a, "/f", "in a");
+
+    // Links, clones and snapshots stay within their instance
+    assert(tfs_link_in(a, "/f", "/h") != -1);
+    assert(tfs_clone_in(b, "/f", "/c") != -1);
+    int snapshot = tfs_snapshot_in(a);
+    assert(snapshot != -1);
+    write_file(a, "/h", "changed");
+    check_file(a, "/f", "changed");
+    check_file(b, "/c", "in b");
+    assert(tfs_open_in(b, "/h", 0) == -1);
+    assert(tfs_snapshot_delete_in(a, snapshot) != -1);
+    assert(tfs_unlink_in(a, "/h") != -1);
+    check_file(b, "/f", "in b");
+
+    tfs_file_info entries[8];
+    assert(tfs_list_in(a, entries, 8) == 1);
+    assert(tfs_list_in(b, entries, 8) == 3);
+
+    // Threads on separate instances run side by side
+    tfs_t *tenants[INSTANCES];
+    pthread_t threads[INSTANCES];
+    for (int i = 0; i < INSTANCES; i++) {
+        tenants[i] = tfs_instance_create(i % 2 == 0 ? NULL : &params);
+        assert(tenants[i] != NULL);
+        assert(pthread_create(&threads[i], NULL, tenant, tenants[i]) == 0);
+    }
+    for (int i = 0; i < INSTANCES; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+        char buffer[WRITES + 1];
+        f = tfs_open_in(tenants[i], "/log", 0);
+        assert(f != -1);
+        assert(tfs_read_in(tenants[i], f, buffer, sizeof(buffer)) == WRITES);
+        assert(tfs_close_in(tenants[i], f) != -1);
+        assert(tfs_instance_destroy(tenants[i]) != -1);
+    }
+
+    assert(tfs_instance_destroy(a) != -1);
+    assert(tfs_instance_destroy(b) != -1);
+    f = tfs_open("/f", 0);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+char const *paths[] = {"/a", "/b", "/c"};
+size_t const sizes[] = {10, 0, 300};
+
+static tfs_file_info const *find(tfs_file_info const *entries, size_t count,
+                                 char const *name) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(entries[i].name, name) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 2;
+    assert(tfs_init(&params) != -1);
+
+    tfs_file_info entries[8];
+    assert(tfs_list(entries, 8) == 0);
+
+    char buffer[300];
+    memset(buffer, 'x', sizeof(buffer));
+    for (size_t i = 0; i < 3; i++) {
+        int f = tfs_open(paths[i], TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, sizes[i]) == (ssize_t)sizes[i]);
+        assert(tfs_close(f) != -1);
+    }
+
+    assert(tfs_list(entries, 8) == 3);
+    for (size_t i = 0; i < 3; i++) {
+        tfs_file_info const *entry = find(entries, 3, paths[i] + 1);
+        assert(entry != NULL);
+        assert(entry->size == sizes[i]);
+    }
+
+    // Sizes follow writes, truncation and unlinks
+    int f = tfs_open("/a", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_unlink("/c") != -1);
+    assert(tfs_list(entries, 8) == 2);
+    tfs_file_info const *a = find(entries, 2, "a");
+    assert(a != NULL && a->size == 0);
+    assert(find(entries, 2, "c") == NULL);
+
+    // A short array gets the first entries, and the full count
+    assert(tfs_list(entries, 1) == 2);
+    assert(tfs_list(NULL, 0) == 2);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define N_READERS (4)
+#define CHURN (100)
+
+char const stable_path[] = "/stable";
+volatile bool churn_done = false;
+
+// Lookups of a file that is never removed always succeed, while other
+// entries of the directory come and go
+void *opener(void *arg) {
+    (void)arg;
+
+    int opens = 0;
+    while (!churn_done || opens == 0) {
+        int f = tfs_open(stable_path, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+        assert(tfs_open("/never_created", 0) == -1);
+        opens++;
+    }
+    return NULL;
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    int f = tfs_open(stable_path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    pthread_t openers[N_READERS];
+    for (int i = 0; i < N_READERS; i++) {
+        assert(pthread_create(&openers[i], NULL, opener, NULL) == 0);
+    }
+
+    char path[] = "/churn_0";
+    for (int i = 0; i < CHURN; i++) {
+        path[7] = (char)('0' + i % 10);
+        f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+        if (i % 10 == 9) {
+            for (char c = '0'; c <= '9'; c++) {
+                path[7] = c;
+                assert(tfs_unlink(path) != -1);
+            }
+        }
+    }
+    churn_done = true;
+
+    for (int i = 0; i < N_READERS; i++) {
+        assert(pthread_join(openers[i], NULL) == 0);
+    }
+
+    // Lookups see the final state of the directory
+    assert(tfs_open("/churn_0", 0) == -1);
+    f = tfs_open(stable_path, 0);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define N_READERS (3)
+#define MESSAGES (200)
+#define MESSAGE_SIZE (10)
+
+char const path[] = "/box";
+char const link_path[] = "/box_link";
+volatile bool writer_done = false;
+atomic_int times_read[10]; // per digit
+
+// Pollers only ever see whole messages that were already written
+void *poller(void *arg) {
+    (void)arg;
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+
+    char message[MESSAGE_SIZE];
+    size_t pending = 0;
+    int seen = 0;
+    while (true) {
+        bool done = writer_done;
+        ssize_t r = tfs_read(f, message + pending, sizeof(message) - pending);
+        assert(r != -1);
+        pending += (size_t)r;
+        if (pending == sizeof(message)) {
+            for (int i = 0; i < MESSAGE_SIZE; i++) {
+                assert(message[i] == (char)('0' + seen % 10));
+            }
+            seen++;
+            pending = 0;
+        } else if (r == 0 && done) {
+            break;
+        }
+    }
+    assert(seen == MESSAGES);
+
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+// Readers sharing a handle each read different messages, whole
+void *sharer(void *arg) {
+    int f = *(int const *)arg;
+    char message[MESSAGE_SIZE];
+    ssize_t r;
+    while ((r = tfs_read(f, message, sizeof(message))) > 0) {
+        assert(r == sizeof(message));
+        for (int i = 1; i < MESSAGE_SIZE; i++) {
+            assert(message[i] == message[0]);
+        }
+        atomic_fetch_add(&times_read[message[0] - '0'], 1);
+    }
+    assert(r == 0);
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 2;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+
+    pthread_t pollers[N_READERS];
+    for (int i = 0; i < N_READERS; i++) {
+        assert(pthread_create(&pollers[i], NULL, poller, NULL) == 0);
+    }
+
+    // Link count changes do not disturb readers of the size
+    char message[MESSAGE_SIZE];
+    for (int i = 0; i < MESSAGES; i++) {
+        memset(message, '0' + i % 10, sizeof(message));
+        assert(tfs_write(f, message, sizeof(message)) == sizeof(message));
+        if (i % 20 == 0) {
+            assert(tfs_link(path, link_path) != -1);
+            assert(tfs_unlink(link_path) != -1);
+        }
+    }
+    writer_done = true;
+
+    for (int i = 0; i < N_READERS; i++) {
+        assert(pthread_join(pollers[i], NULL) == 0);
+    }
+    assert(tfs_close(f) != -1);
+
+    // The file survived the link/unlink cycles
+    f = tfs_open(path, TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_read(f, message, sizeof(message)) == 0);
+    assert(tfs_close(f) != -1);
+
+    // Every message is read once by the readers sharing a handle
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    for (int i = 0; i < N_READERS; i++) {
+        assert(pthread_create(&pollers[i], NULL, sharer, &f) == 0);
+    }
+    for (int i = 0; i < N_READERS; i++) {
+        assert(pthread_join(pollers[i], NULL) == 0);
+    }
+    for (int i = 0; i < 10; i++) {
+        assert(atomic_load(&times_read[i]) == MESSAGES / 10);
+    }
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILES (20)
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 4;
+    params.max_block_count = 8;
+    params.max_open_files_count = 2;
+    params.inode_count_limit = 32;
+    params.block_count_limit = 32;
+    params.open_files_count_limit = 32;
+    assert(tfs_init(&params) != -1);
+
+    tfs_stats stats;
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.inode_capacity == 4);
+    assert(stats.block_capacity == 8);
+    assert(stats.open_file_capacity == 2);
+
+    // Far more files, blocks and open handles than the tables start with,
+    // all kept open while the tables grow under them
+    char path[] = "/f00";
+    char buffer[100];
+    int handles[FILES];
+    for (int i = 0; i < FILES; i++) {
+        path[2] = (char)('0' + i / 10);
+        path[3] = (char)('0' + i % 10);
+        handles[i] = tfs_open(path, TFS_O_CREAT);
+        assert(handles[i] != -1);
+        memset(buffer, 'a' + i, sizeof(buffer));
+        assert(tfs_write(handles[i], buffer, sizeof(buffer)) ==
+               sizeof(buffer));
+    }
+
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.inode_capacity > FILES && stats.inode_capacity <= 32);
+    assert(stats.block_capacity > FILES && stats.block_capacity <= 32);
+    assert(stats.open_file_capacity >= FILES &&
+           stats.open_file_capacity <= 32);
+
+    // Data written before and after each growth is intact
+    char read_back[100];
+    for (int i = 0; i < FILES; i++) {
+        path[2] = (char)('0' + i / 10);
+        path[3] = (char)('0' + i % 10);
+        assert(tfs_close(handles[i]) != -1);
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, read_back, sizeof(read_back)) ==
+               sizeof(read_back));
+        memset(buffer, 'a' + i, sizeof(buffer));
+        assert(memcmp(buffer, read_back, sizeof(buffer)) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    // The limits still hold
+    for (int i = FILES; i < 40; i++) {
+        path[2] = (char)('0' + i / 10);
+        path[3] = (char)('0' + i % 10);
+        int f = tfs_open(path, TFS_O_CREAT);
+        if (f == -1) {
+            break;
+        }
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.inode_capacity == 32);
+    assert(tfs_open("/last", TFS_O_CREAT) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    // Without limits the tables keep their initial sizes
+    params.inode_count_limit = 0;
+    params.block_count_limit = 0;
+    params.open_files_count_limit = 0;
+    assert(tfs_init(&params) != -1);
+    int f1 = tfs_open("/a", TFS_O_CREAT);
+    int f2 = tfs_open("/b", TFS_O_CREAT);
+    assert(f1 != -1 && f2 != -1);
+    assert(tfs_open("/c", TFS_O_CREAT) == -1); // open file table is full
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.open_file_capacity == 2);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define N_WRITERS (4)
+#define STRIPE (300)
+#define ROUNDS (20)
+
+char const path[] = "/box";
+volatile bool unlocked = false;
+
+// Each writer repeatedly rewrites its own stripe of the file
+void *stripe_writer(void *arg) {
+    int id = *(int *)arg;
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+
+    char stripe[STRIPE];
+    for (int i = 0; i < ROUNDS; i++) {
+        memset(stripe, 'a' + id, sizeof(stripe));
+        stripe[0] = (char)i;
+        assert(tfs_pwrite(f, stripe, sizeof(stripe), (size_t)id * STRIPE) ==
+               sizeof(stripe));
+    }
+
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+// Writes into a range locked by another handle, which must wait for it
+void *blocked_writer(void *arg) {
+    (void)arg;
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_pwrite(f, "late", 4, 50) == 4);
+    assert(unlocked);
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 4;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+
+    // Writers to disjoint stripes run concurrently
+    pthread_t writers[N_WRITERS];
+    int ids[N_WRITERS];
+    for (int i = 0; i < N_WRITERS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&writers[i], NULL, stripe_writer, &ids[i]) == 0);
+    }
+    for (int i = 0; i < N_WRITERS; i++) {
+        assert(pthread_join(writers[i], NULL) == 0);
+    }
+
+    char stripe[STRIPE];
+    for (int i = 0; i < N_WRITERS; i++) {
+        assert(tfs_read(f, stripe, sizeof(stripe)) == sizeof(stripe));
+        assert(stripe[0] == ROUNDS - 1);
+        for (int j = 1; j < STRIPE; j++) {
+            assert(stripe[j] == 'a' + i);
+        }
+    }
+    assert(tfs_read(f, stripe, sizeof(stripe)) == 0);
+
+    // pwrite does not move the file offset
+    assert(tfs_pwrite(f, "x", 1, 0) == 1);
+    assert(tfs_read(f, stripe, 1) == 0);
+
+    // A locked range blocks other handles' writes, but not the owner's
+    assert(tfs_lock_range(f, 0, 100) != -1);
+    assert(tfs_pwrite(f, "own", 3, 10) == 3);
+    pthread_t blocked;
+    assert(pthread_create(&blocked, NULL, blocked_writer, NULL) == 0);
+    struct timespec wait = {.tv_sec = 0, .tv_nsec = 50 * 1000 * 1000};
+    nanosleep(&wait, NULL);
+    unlocked = true;
+    assert(tfs_unlock_range(f, 0, 100) != -1);
+    assert(pthread_join(blocked, NULL) == 0);
+
+    // Only held ranges can be unlocked
+    assert(tfs_unlock_range(f, 0, 100) == -1);
+    assert(tfs_lock_range(f, 0, 0) == -1);
+
+    // A handle's own ranges may overlap, and its appends and truncations go
+    // through them
+    int a = tfs_open(path, TFS_O_APPEND_ATOMIC);
+    assert(a != -1);
+    assert(tfs_lock_range(a, 0, 10) != -1);
+    assert(tfs_lock_range(a, 5, 1000) != -1);
+    assert(tfs_write(a, "tail", 4) == 4);
+    assert(tfs_ftruncate(a, 60) != -1);
+    assert(tfs_unlock_range(a, 0, 10) != -1);
+    assert(tfs_unlock_range(a, 5, 1000) != -1);
+    assert(tfs_close(a) != -1);
+
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    char buffer[60];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(buffer[0] == 'x');
+    assert(memcmp(buffer + 10, "own", 3) == 0);
+    assert(memcmp(buffer + 50, "late", 4) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ROTATIONS (200)
+
+static atomic_bool done;
+
+static size_t blocks_free(void) {
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) != -1);
+    return info.blocks_free;
+}
+
+static void create_file(char const *path, char const *text) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, text, strlen(text)) == (ssize_t)strlen(text));
+    assert(tfs_close(f) != -1);
+}
+
+static void check_file(char const *path, char const *text) {
+    char buffer[64];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)strlen(text));
+    assert(memcmp(buffer, text, strlen(text)) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+// The name being replaced never goes missing
+void *reader(void *arg) {
+    (void)arg;
+    while (!atomic_load(&done)) {
+        int f = tfs_open("/current", 0);
+        assert(f != -1);
+        char c;
+        assert(tfs_read(f, &c, 1) == 1);
+        assert(c == 'v');
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+// Truncates whatever file the name maps to when it is opened
+void *truncator(void *arg) {
+    (void)arg;
+    while (!atomic_load(&done)) {
+        int f = tfs_open("/scratch", TFS_O_TRUNC);
+        if (f != -1) {
+            assert(tfs_close(f) != -1);
+        }
+    }
+    return NULL;
+}
+
+// Removes the name being replaced, whichever file it maps to
+void *unlinker(void *arg) {
+    (void)arg;
+    while (!atomic_load(&done)) {
+        tfs_unlink("/current");
+    }
+    return NULL;
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+    size_t initial = blocks_free();
+
+    // A plain rename keeps the contents, and open handles stay valid
+    create_file("/segment", "live data");
+    int f = tfs_open("/segment", 0);
+    assert(f != -1);
+    assert(tfs_rename("/segment", "/segment.1") != -1);
+    assert(tfs_open("/segment", 0) == -1);
+    check_file("/segment.1", "live data");
+    char buffer[16];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 9);
+    assert(tfs_close(f) != -1);
+
+    // Renaming onto an existing file releases that file
+    create_file("/segment", "newer");
+    assert(blocks_free() == initial - 2);
+    assert(tfs_rename("/segment", "/segment.1") != -1);
+    assert(tfs_open("/segment", 0) == -1);
+    check_file("/segment.1", "newer");
+    assert(blocks_free() == initial - 1);
+
+    // ... or only one of its links
+    create_file("/a", "a");
+    assert(tfs_link("/a", "/b") != -1);
+    assert(tfs_rename("/segment.1", "/b") != -1);
+    check_file("/a", "a");
+    check_file("/b", "newer");
+
+    // Two links to the same file, the same name, or no file at all
+    assert(tfs_link("/a", "/c") != -1);
+    assert(tfs_rename("/a", "/c") != -1);
+    check_file("/a", "a");
+    check_file("/c", "a");
+    assert(tfs_rename("/a", "/a") != -1);
+    check_file("/a", "a");
+    assert(tfs_rename("/missing", "/d") == -1);
+    assert(tfs_rename("/a", "") == -1);
+    assert(tfs_rename("/a", "d") == -1);
+
+    // A file replaced while open is only released once closed
+    f = tfs_open("/b", 0);
+    assert(f != -1);
+    size_t before = blocks_free();
+    assert(tfs_rename("/c", "/b") != -1);
+    assert(blocks_free() == before);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 5);
+    assert(memcmp(buffer, "newer", 5) == 0);
+    assert(tfs_close(f) != -1);
+    assert(blocks_free() == before + 1);
+
+    // Rotation: lookups of the replaced name always find a file
+    create_file("/current", "v0");
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, reader, NULL) == 0);
+    for (int i = 0; i < ROTATIONS; i++) {
+        create_file("/next", "v1");
+        assert(tfs_rename("/next", "/current") != -1);
+    }
+    atomic_store(&done, true);
+    assert(pthread_join(tid, NULL) == 0);
+    check_file("/current", "v1");
+
+    // An open whose file is replaced (and its inode reused by another file)
+    // before it is pinned never truncates the other file
+    atomic_store(&done, false);
+    assert(pthread_create(&tid, NULL, truncator, NULL) == 0);
+    for (int i = 0; i < ROTATIONS; i++) {
+        create_file("/scratch", "s");
+        assert(tfs_unlink("/scratch") != -1);
+        create_file("/keep", "kept");
+        check_file("/keep", "kept");
+        assert(tfs_unlink("/keep") != -1);
+    }
+    atomic_store(&done, true);
+    assert(pthread_join(tid, NULL) == 0);
+
+    // Unlinks racing with renames onto the same name drop the link of the
+    // file they removed: every file is released once its name is gone
+    assert(tfs_unlink("/current") != -1);
+    size_t before_rotation = blocks_free();
+    atomic_store(&done, false);
+    assert(pthread_create(&tid, NULL, unlinker, NULL) == 0);
+    for (int i = 0; i < ROTATIONS; i++) {
+        create_file("/next", "v2");
+        assert(tfs_rename("/next", "/current") != -1);
+    }
+    atomic_store(&done, true);
+    assert(pthread_join(tid, NULL) == 0);
+    tfs_unlink("/current");
+    assert(blocks_free() == before_rotation);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
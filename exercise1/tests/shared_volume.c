@@ -0,0 +1,169 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define RECORDS (200)
+#define RECORD_SIZE (4)
+
+static tfs_params volume_params(char const *name) {
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 4;
+    params.shm_name = name;
+    return params;
+}
+
+static void check_file(char const *path, char const *text) {
+    char buffer[64];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)strlen(text));
+    assert(memcmp(buffer, text, strlen(text)) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+static void append_records(char tag) {
+    int f = tfs_open("/log", TFS_O_APPEND_ATOMIC);
+    assert(f != -1);
+    char record[RECORD_SIZE];
+    memset(record, tag, sizeof(record));
+    for (int i = 0; i < RECORDS; i++) {
+        assert(tfs_write(f, record, sizeof(record)) == sizeof(record));
+    }
+    assert(tfs_close(f) != -1);
+}
+
+// Another process, using the volume the parent created
+static int child(char const *role, char const *name) {
+    tfs_params params = volume_params(name);
+    params.block_size = 64; // ignored: the volume has its own
+    assert(tfs_init(&params) != -1);
+
+    if (strcmp(role, "writer") == 0) {
+        check_file("/f", "from the parent");
+        int f = tfs_open("/g", TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, "from the child", 14) == 14);
+        assert(tfs_close(f) != -1);
+        append_records('c');
+        assert(tfs_destroy() != -1);
+    } else {
+        // Dies holding the commit lock of /log, mid-change if "torn"
+        int f = tfs_open("/log", 0);
+        assert(f != -1);
+        inode_t *inode = inode_get(get_open_file_entry(f)->of_inumber);
+        if (strcmp(role, "torn") == 0) {
+            inode_meta_write_begin(inode);
+        } else {
+            pthread_mutex_lock(&inode->i_commit_lock);
+        }
+        _exit(0);
+    }
+    return 0;
+}
+
+static void run_child(char const *role, char const *name, pid_t *pid) {
+    *pid = fork();
+    assert(*pid != -1);
+    if (*pid == 0) {
+        execl("/proc/self/exe", "shared_volume", role, name, (char *)NULL);
+        _exit(1);
+    }
+}
+
+static void wait_child(pid_t pid) {
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3) {
+        return child(argv[1], argv[2]);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "/tfs_shared_volume_%d", (int)getpid());
+    tfs_params params = volume_params(name);
+
+    // Buffers of their own in each process are not allowed
+    params.write_back = true;
+    assert(tfs_init(&params) == -1);
+    params.write_back = false;
+
+    assert(tfs_init(&params) != -1);
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "from the parent", 15) == 15);
+    assert(tfs_close(f) != -1);
+    f = tfs_open("/log", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    // Both processes see each other's files, and append to one at once
+    pid_t pid;
+    run_child("writer", name, &pid);
+    append_records('p');
+    wait_child(pid);
+    check_file("/g", "from the child");
+
+    char records[2 * RECORDS * RECORD_SIZE];
+    f = tfs_open("/log", 0);
+    assert(f != -1);
+    assert(tfs_read(f, records, sizeof(records)) == sizeof(records));
+    assert(tfs_close(f) != -1);
+    size_t counts[2] = {0, 0};
+    for (size_t i = 0; i < sizeof(records); i += RECORD_SIZE) {
+        assert(records[i] == 'p' || records[i] == 'c');
+        for (size_t j = 1; j < RECORD_SIZE; j++) {
+            assert(records[i + j] == records[i]);
+        }
+        counts[records[i] == 'c']++;
+    }
+    assert(counts[0] == RECORDS && counts[1] == RECORDS);
+
+    // A lock left held by a process that died is taken over
+    run_child("crash", name, &pid);
+    wait_child(pid);
+    f = tfs_open("/log", TFS_O_APPEND_ATOMIC);
+    assert(f != -1);
+    assert(tfs_write(f, "more", 4) == 4);
+    assert(tfs_close(f) != -1);
+    tfs_stats stats;
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.recovered_locks == 1);
+    assert(stats.repaired_inodes == 0);
+
+    // ... and an inode it left mid-change is usable again, by readers too
+    run_child("torn", name, &pid);
+    wait_child(pid);
+    f = tfs_open("/log", 0);
+    assert(f != -1);
+    assert(tfs_read(f, records, RECORD_SIZE) == RECORD_SIZE);
+    assert(tfs_close(f) != -1);
+    assert(tfs_get_stats(&stats) != -1);
+    assert(stats.recovered_locks == 2);
+    assert(stats.repaired_inodes == 1);
+    f = tfs_open("/log", TFS_O_APPEND_ATOMIC);
+    assert(f != -1);
+    assert(tfs_write(f, "more", 4) == 4);
+    assert(tfs_close(f) != -1);
+
+    // (the crashed process never detached, so the volume outlives this one)
+    assert(tfs_destroy() != -1);
+    assert(shm_unlink(name) == 0);
+
+    // The last process to detach removes the volume
+    assert(tfs_init(&params) != -1);
+    assert(tfs_destroy() != -1);
+    assert(shm_open(name, O_RDONLY, 0) == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
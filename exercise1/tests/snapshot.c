@@ -0,0 +1,185 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE (1024)
+#define FILE_SIZE (4 * BLOCK_SIZE)
+
+static void write_file(char const *path, char fill, size_t len) {
+    char buffer[FILE_SIZE];
+    memset(buffer, fill, len);
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, len) == (ssize_t)len);
+    assert(tfs_close(f) != -1);
+}
+
+// Checks that a file of a snapshot holds len bytes, all equal to fill
+static void check_snapshot_file(int snapshot, char const *path, char fill,
+                                size_t len) {
+    char buffer[FILE_SIZE + 1];
+    int f = tfs_snapshot_open(snapshot, path);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)len);
+    for (size_t i = 0; i < len; i++) {
+        assert(buffer[i] == fill);
+    }
+    assert(tfs_close(f) != -1);
+}
+
+static size_t free_blocks(void) {
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) != -1);
+    return info.blocks_free;
+}
+
+static volatile bool writer_done = false;
+
+// Rewrites the whole file with one byte value after another
+void *writer(void *arg) {
+    (void)arg;
+    char buffer[FILE_SIZE];
+    int f = tfs_open("/w", 0);
+    assert(f != -1);
+    for (int round = 0; !writer_done; round++) {
+        memset(buffer, 'a' + round % 26, sizeof(buffer));
+        assert(tfs_pwrite(f, buffer, sizeof(buffer), 0) == sizeof(buffer));
+    }
+    assert(tfs_close(f) != -1);
+    return NULL;
+}
+
+static atomic_int latest_snapshot;
+
+// Opens /s in the latest snapshot while snapshots come and go
+void *snapshot_reader(void *arg) {
+    (void)arg;
+    char buffer[FILE_SIZE + 1];
+    while (!writer_done) {
+        int f = tfs_snapshot_open(atomic_load(&latest_snapshot), "/s");
+        if (f == -1) {
+            continue; // deleted meanwhile
+        }
+        assert(tfs_read(f, buffer, sizeof(buffer)) == FILE_SIZE);
+        for (size_t i = 0; i < FILE_SIZE; i++) {
+            assert(buffer[i] == 's');
+        }
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+static void run(bool write_back) {
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_file_blocks = FILE_SIZE / BLOCK_SIZE;
+    params.write_back = write_back;
+    assert(tfs_init(&params) != -1);
+
+    write_file("/a", 'a', FILE_SIZE);
+    write_file("/b", 'b', 10);
+    assert(tfs_sym_link("/a", "/s") != -1);
+    assert(tfs_link("/a", "/h") != -1);
+
+    // No data is copied: only the snapshot's directory takes a block (with
+    // write-back, the flush also allocates the blocks of the buffered writes)
+    size_t before = free_blocks();
+    int snap = tfs_snapshot();
+    assert(snap != -1);
+    if (!write_back) {
+        assert(free_blocks() == before - 1);
+    }
+
+    // Change everything after the snapshot
+    int f = tfs_open("/a", 0);
+    assert(f != -1);
+    assert(tfs_write(f, "AAAA", 4) == 4);
+    assert(tfs_close(f) != -1);
+    write_file("/b", 'B', 20);
+    write_file("/c", 'c', 10);
+    assert(tfs_unlink("/h") != -1);
+
+    // The live files see the changes...
+    char buffer[FILE_SIZE];
+    f = tfs_open("/a", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, 4) == 4);
+    assert(memcmp(buffer, "AAAA", 4) == 0);
+    assert(tfs_close(f) != -1);
+
+    // ...the snapshot does not
+    check_snapshot_file(snap, "/a", 'a', FILE_SIZE);
+    check_snapshot_file(snap, "/s", 'a', FILE_SIZE);
+    check_snapshot_file(snap, "/h", 'a', FILE_SIZE);
+    check_snapshot_file(snap, "/b", 'b', 10);
+    assert(tfs_snapshot_open(snap, "/c") == -1);
+    assert(tfs_snapshot_open(snap + 1, "/a") == -1);
+
+    // Snapshot files are read-only
+    f = tfs_snapshot_open(snap, "/a");
+    assert(f != -1);
+    assert(tfs_write(f, "x", 1) == -1);
+    assert(tfs_pwrite(f, "x", 1, 0) == -1);
+
+    // Deleting it frees the blocks only the snapshot still uses
+    assert(tfs_snapshot_delete(snap) == -1); // a file is open
+    assert(tfs_close(f) != -1);
+    size_t with_snapshot = free_blocks();
+    assert(tfs_snapshot_delete(snap) != -1);
+    assert(free_blocks() > with_snapshot);
+    assert(tfs_snapshot_delete(snap) == -1);
+
+    // Snapshots taken while a file is being rewritten see one whole write
+    write_file("/w", 'a', FILE_SIZE);
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, writer, NULL) == 0);
+    for (int i = 0; i < 20; i++) {
+        snap = tfs_snapshot();
+        assert(snap != -1);
+        f = tfs_snapshot_open(snap, "/w");
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        for (size_t j = 1; j < sizeof(buffer); j++) {
+            assert(buffer[j] == buffer[0]);
+        }
+        assert(tfs_close(f) != -1);
+        assert(tfs_snapshot_delete(snap) != -1);
+    }
+    writer_done = true;
+    assert(pthread_join(tid, NULL) == 0);
+    writer_done = false;
+
+    // A file is never opened in a snapshot being deleted (whose inodes other
+    // files may get)
+    write_file("/s", 's', FILE_SIZE);
+    atomic_store(&latest_snapshot, -1);
+    assert(pthread_create(&tid, NULL, snapshot_reader, NULL) == 0);
+    for (int i = 0; i < 200; i++) {
+        snap = tfs_snapshot();
+        assert(snap != -1);
+        atomic_store(&latest_snapshot, snap);
+        while (tfs_snapshot_delete(snap) == -1) {
+            // the reader has a file of it open
+        }
+        write_file("/x", 'x', FILE_SIZE);
+        assert(tfs_unlink("/x") != -1);
+    }
+    writer_done = true;
+    assert(pthread_join(tid, NULL) == 0);
+    writer_done = false;
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    run(false);
+    run(true);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
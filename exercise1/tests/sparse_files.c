@@ -0,0 +1,81 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK (1024)
+
+static size_t blocks_free(void) {
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) != -1);
+    return info.blocks_free;
+}
+
+static void check_sparse_file(bool write_back) {
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 9;
+    params.max_file_blocks = 8;
+    params.write_back = write_back;
+    assert(tfs_init(&params) != -1);
+    size_t initial = blocks_free();
+
+    // Leave garbage in every block the sparse file can get
+    char buffer[8 * BLOCK];
+    memset(buffer, 'g', sizeof(buffer));
+    int f = tfs_open("/garbage", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(tfs_close(f) != -1);
+    assert(tfs_unlink("/garbage") != -1);
+
+    // Data at 100 in block 1 and 6000 in block 5, holes everywhere else
+    f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_pwrite(f, "data", 4, 6000) == 4);
+    assert(tfs_pwrite(f, "more", 4, BLOCK + 100) == 4);
+    assert(tfs_seek_data(f, 0) == BLOCK); // (flushes buffered writes)
+    assert(blocks_free() == initial - 2);
+
+    // Holes, and the parts of written blocks never written, read as zeros
+    assert(tfs_seek_data(f, 0) == BLOCK);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == 6004 - BLOCK);
+    for (size_t i = 0; i < 6004 - BLOCK; i++) {
+        if (i == 100) {
+            assert(memcmp(&buffer[i], "more", 4) == 0);
+            i += 3;
+        } else if (i == 6000 - BLOCK) {
+            assert(memcmp(&buffer[i], "data", 4) == 0);
+            i += 3;
+        } else {
+            assert(buffer[i] == '\0');
+        }
+    }
+
+    // Walking the file by data and holes only visits the written blocks
+    assert(tfs_seek_hole(f, 0) == 0);
+    assert(tfs_seek_data(f, 0) == BLOCK);
+    assert(tfs_seek_data(f, BLOCK + 500) == BLOCK + 500);
+    assert(tfs_seek_hole(f, BLOCK) == 2 * BLOCK);
+    assert(tfs_seek_data(f, 2 * BLOCK) == 5 * BLOCK);
+    assert(tfs_seek_hole(f, 5 * BLOCK) == 6004); // the end of the file
+    assert(tfs_seek_data(f, 6004) == -1);
+    assert(tfs_seek_hole(f, 6004) == -1);
+
+    // The offset moves to what was found
+    assert(tfs_seek_data(f, 3 * BLOCK) == 5 * BLOCK);
+    assert(tfs_read(f, buffer, BLOCK) == 6004 - 5 * BLOCK);
+    assert(memcmp(&buffer[6000 - 5 * BLOCK], "data", 4) == 0);
+
+    assert(tfs_close(f) != -1);
+    assert(tfs_seek_data(f, 0) == -1); // closed
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    check_sparse_file(false);
+    check_sparse_file(true);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
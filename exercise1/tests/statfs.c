@@ -0,0 +1,100 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS (4)
+
+void *churner(void *arg) {
+    char path[] = "/t0";
+    path[2] = (char)('0' + *(int *)arg);
+    for (int i = 0; i < 20; i++) {
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, "data", 4) == 4);
+        assert(tfs_close(f) != -1);
+        assert(tfs_unlink(path) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_statfs_info info;
+    assert(tfs_statfs(&info) == -1); // not initialized
+
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 4;
+    params.max_inode_count = 16;
+    params.inode_count_limit = 32;
+    assert(tfs_init(&params) != -1);
+
+    // Only the root directory (one inode, one block) is in use
+    assert(tfs_statfs(&info) != -1);
+    assert(info.block_size == params.block_size);
+    assert(info.blocks == params.max_block_count);
+    assert(info.blocks_free == info.blocks - 1);
+    assert(info.blocks_max == params.max_block_count);
+    assert(info.inodes == 16);
+    assert(info.inodes_free == 15);
+    assert(info.inodes_max == 32);
+    assert(info.open_files == params.max_open_files_count);
+    assert(info.open_files_free == info.open_files);
+    assert(info.open_files_max == params.max_open_files_count);
+
+    // A file with three blocks, open twice
+    char buffer[3 * 1024];
+    memset(buffer, 's', sizeof(buffer));
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    int g = tfs_open("/f", 0);
+    assert(g != -1);
+
+    assert(tfs_statfs(&info) != -1);
+    assert(info.blocks_free == info.blocks - 4);
+    assert(info.inodes_free == 14);
+    assert(info.open_files_free == info.open_files - 2);
+
+    // Everything is given back
+    assert(tfs_close(f) != -1);
+    assert(tfs_close(g) != -1);
+    assert(tfs_unlink("/f") != -1);
+    assert(tfs_statfs(&info) != -1);
+    assert(info.blocks_free == info.blocks - 1);
+    assert(info.inodes_free == 15);
+    assert(info.open_files_free == info.open_files);
+
+    // Entries freed by other threads count as free, wherever they are kept
+    pthread_t tids[THREADS];
+    int ids[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        ids[t] = t;
+        assert(pthread_create(&tids[t], NULL, churner, &ids[t]) == 0);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        assert(pthread_join(tids[t], NULL) == 0);
+    }
+    assert(tfs_statfs(&info) != -1);
+    assert(info.blocks_free == info.blocks - 1);
+    assert(info.inodes_free == info.inodes - 1);
+
+    // Growing the inode table adds free inodes
+    char path[] = "/g00";
+    for (int i = 0; i < 20; i++) {
+        path[2] = (char)('0' + i / 10);
+        path[3] = (char)('0' + i % 10);
+        f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_statfs(&info) != -1);
+    assert(info.inodes == 32);
+    assert(info.inodes_free == 32 - 21);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
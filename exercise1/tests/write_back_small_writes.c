@@ -0,0 +1,72 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define MESSAGE_SIZE (64)
+#define FILE_BLOCKS (3)
+
+char const path[] = "/box";
+
+void assert_contents_ok(size_t size) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+
+    char buffer[FILE_BLOCKS * 1024 + 1];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == size);
+    for (size_t i = 0; i < size; i++) {
+        assert(buffer[i] == (char)('a' + (i / MESSAGE_SIZE) % 26));
+    }
+
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_block_count = FILE_BLOCKS + 1; // root directory + file
+    params.max_file_blocks = FILE_BLOCKS + 1;
+    params.write_back = true;
+
+    // A failed initialization (no flush deadline) leaves nothing set up
+    params.flush_interval_ms = 0;
+    assert(tfs_init(&params) == -1);
+    params.flush_interval_ms = 10;
+    assert(tfs_init(&params) != -1);
+
+    // Many tiny appends, as a publisher would do
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+
+    char message[MESSAGE_SIZE];
+    size_t messages = FILE_BLOCKS * 1024 / MESSAGE_SIZE;
+    for (size_t i = 0; i < messages; i++) {
+        memset(message, 'a' + (int)(i % 26), sizeof(message));
+        assert(tfs_write(f, message, sizeof(message)) == sizeof(message));
+    }
+
+    // Every block is reserved: writing past them must fail, even before the
+    // buffered data was flushed
+    assert(tfs_write(f, message, sizeof(message)) == -1);
+    assert(tfs_close(f) != -1);
+
+    // Buffered writes are visible to readers, before and after the flush
+    assert_contents_ok(FILE_BLOCKS * 1024);
+    struct timespec wait = {.tv_sec = 0, .tv_nsec = 50 * 1000 * 1000};
+    nanosleep(&wait, NULL);
+    assert_contents_ok(FILE_BLOCKS * 1024);
+
+    // Truncating releases the blocks
+    f = tfs_open(path, TFS_O_TRUNC);
+    assert(f != -1);
+    memset(message, 'a', sizeof(message));
+    assert(tfs_write(f, message, sizeof(message)) == sizeof(message));
+    assert(tfs_close(f) != -1);
+    assert_contents_ok(MESSAGE_SIZE);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}